@@ -80,6 +80,7 @@ struct host1x_overlay;
 struct host1x_client;
 struct host1x_gr2d;
 struct host1x_gr3d;
+struct host1x_gr2d_rect;
 struct host1x_bo_priv;
 struct host1x;
 
@@ -176,6 +177,16 @@ int host1x_pixelbuffer_load_data(struct host1x *host1x,
 				 unsigned long data_size,
 				 enum pixel_format data_format,
 				 enum layout_format data_layout);
+int host1x_pixelbuffer_update_rect(struct host1x_pixelbuffer *pixbuf,
+				   unsigned x, unsigned y,
+				   unsigned width, unsigned height,
+				   const void *data, unsigned data_pitch);
+void host1x_pixelbuffer_tile_16x16(void *dst, unsigned dst_pitch,
+				   const void *src, unsigned src_pitch,
+				   unsigned row_bytes, unsigned rows);
+void host1x_pixelbuffer_untile_16x16(void *dst, unsigned dst_pitch,
+				     const void *src, unsigned src_pitch,
+				     unsigned row_bytes, unsigned rows);
 void host1x_pixelbuffer_setup_guard(struct host1x_pixelbuffer *pixbuf);
 void host1x_pixelbuffer_check_guard(struct host1x_pixelbuffer *pixbuf);
 void host1x_pixelbuffer_disable_bo_guard(void);
@@ -220,6 +231,10 @@ int host1x_display_get_resolution(struct host1x_display *display,
 int host1x_display_set(struct host1x_display *display,
 		       struct host1x_framebuffer *fb,
 		       bool vsync, bool reflect_y);
+void host1x_display_set_damage(struct host1x_display *display,
+			       const struct host1x_gr2d_rect *rects,
+			       unsigned int count);
+int host1x_display_wait(struct host1x_display *display);
 
 int host1x_overlay_create(struct host1x_overlay **overlayp,
 			  struct host1x_display *display);
@@ -239,6 +254,9 @@ int host1x_bo_invalidate(struct host1x_bo *bo, unsigned long offset,
 int host1x_bo_flush(struct host1x_bo *bo, unsigned long offset,
 		    size_t length);
 int host1x_bo_mmap(struct host1x_bo *bo, void **ptr);
+int host1x_bo_cpu_prep(struct host1x_bo *bo, unsigned long access,
+		       uint32_t timeout);
+int host1x_bo_cpu_fini(struct host1x_bo *bo);
 int host1x_bo_export(struct host1x_bo *bo, uint32_t *handle);
 struct host1x_bo *host1x_bo_import(struct host1x *host1x, uint32_t handle);
 
@@ -346,12 +364,17 @@ static inline struct host1x_bo *host1x_bo_import_helper(struct host1x *host1x,
 #define HOST1X_OPCODE_EXTEND(subop, value) \
 	((0xeu << 28) | (((subop) & 0xf) << 24) | ((value) & 0xffffff))
 
+#define HOST1X_BO_ACCESS_READ	(1 << 0)
+#define HOST1X_BO_ACCESS_WRITE	(1 << 1)
+#define HOST1X_BO_ACCESS_RW	(HOST1X_BO_ACCESS_READ | HOST1X_BO_ACCESS_WRITE)
+
 struct host1x_pushbuf_reloc {
 	unsigned long source_offset;
 	struct host1x_bo *target_bo;
 	unsigned long target_handle;
 	unsigned long target_offset;
 	unsigned long shift;
+	unsigned long access;
 };
 
 struct host1x_pushbuf {
@@ -381,6 +404,10 @@ struct host1x_pushbuf *host1x_job_append(struct host1x_job *job,
 int host1x_pushbuf_push(struct host1x_pushbuf *pb, uint32_t word);
 int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
 			    unsigned long offset, unsigned long shift);
+int host1x_pushbuf_relocate_access(struct host1x_pushbuf *pb,
+				   struct host1x_bo *target,
+				   unsigned long offset, unsigned long shift,
+				   unsigned long access);
 int host1x_client_submit(struct host1x_client *client, struct host1x_job *job);
 int host1x_client_flush(struct host1x_client *client, uint32_t *fence);
 int host1x_client_wait(struct host1x_client *client, uint32_t fence,
@@ -430,6 +457,22 @@ static inline int host1x_pushbuf_relocate_helper(struct host1x_pushbuf *pb,
 	return err;
 }
 
+static inline int host1x_pushbuf_relocate_access_helper(
+					struct host1x_pushbuf *pb,
+					struct host1x_bo *target,
+					unsigned long offset,
+					unsigned long shift,
+					unsigned long access,
+					const char *file, int line)
+{
+	int err = host1x_pushbuf_relocate_access(pb, target, offset, shift,
+						 access);
+	if (err)
+		host1x_error("host1x_pushbuf_relocate_access() failed %d\n",
+			     err);
+	return err;
+}
+
 static inline int host1x_client_submit_helper(struct host1x_client *client,
 					      struct host1x_job *job,
 					      const char *file, int line)
@@ -470,6 +513,10 @@ static inline int host1x_client_wait_helper(struct host1x_client *client,
 	host1x_pushbuf_relocate_helper(pb, target, offset, shift, \
 					__FILE__, __LINE__)
 
+#define HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, target, offset, shift, access) \
+	host1x_pushbuf_relocate_access_helper(pb, target, offset, shift, \
+					      access, __FILE__, __LINE__)
+
 #define HOST1X_CLIENT_SUBMIT(client, job) \
 	host1x_client_submit_helper(client, job, __FILE__, __LINE__)
 
@@ -493,6 +540,19 @@ int host1x_framebuffer_save(struct host1x *host1x,
 struct host1x_gr2d;
 struct host1x_gr3d;
 
+struct host1x_gr2d_rect {
+	unsigned x, y;
+	unsigned width, height;
+};
+
+/* a negative height flips the copy vertically */
+struct host1x_gr2d_blit_rect {
+	unsigned sx, sy;
+	unsigned dx, dy;
+	unsigned width;
+	int height;
+};
+
 int host1x_gr2d_clear(struct host1x_gr2d *gr2d,
 		      struct host1x_pixelbuffer *pixbuf,
 		      uint32_t color);
@@ -501,6 +561,16 @@ int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
 			   uint32_t color,
 			   unsigned x, unsigned y,
 			   unsigned width, unsigned height);
+int host1x_gr2d_fill_rects(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *pixbuf,
+			   const struct host1x_gr2d_rect *rects,
+			   const uint32_t *colors,
+			   unsigned num_rects);
+int host1x_gr2d_blit_rects(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *src,
+			   struct host1x_pixelbuffer *dst,
+			   const struct host1x_gr2d_blit_rect *rects,
+			   unsigned num_rects);
 int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
 		     struct host1x_pixelbuffer *src,
 		     struct host1x_pixelbuffer *dst,
@@ -514,6 +584,16 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 			     unsigned int src_width, int src_height,
 			     unsigned int dx, unsigned int dy,
 			     unsigned int dst_width, int dst_height);
+int host1x_gr2d_surface_blit_rects(struct host1x_gr2d *gr2d,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *dst,
+				   const struct host1x_gr2d_blit_rect *rects,
+				   unsigned num_rects);
+int host1x_gr2d_surface_blit_chain(struct host1x_gr2d *gr2d,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *levels,
+				   const unsigned long *offsets,
+				   unsigned num_levels);
 int host1x_gr3d_triangle(struct host1x_gr3d *gr3d,
 			 struct host1x_pixelbuffer *pixbuf);
 
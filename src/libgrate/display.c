@@ -69,7 +69,16 @@ void grate_display_show(struct grate_display *display,
 			struct grate_framebuffer *fb,
 			bool vsync, bool reflect_y)
 {
+	const struct host1x_gr2d_rect *damage;
+	unsigned int count;
+
+	damage = grate_framebuffer_get_damage(fb, &count);
+	host1x_display_set_damage(display->base, damage, count);
 	host1x_display_set(display->base, fb->front, vsync, reflect_y);
+
+	/* the old front buffer is rendered to next unless there's a spare */
+	if (!fb->spare)
+		host1x_display_wait(display->base);
 }
 
 struct grate_overlay *grate_overlay_create(struct grate_display *display)
@@ -12,7 +12,17 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 #include "etc1.h"
+#include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ETC1_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ETC1_SSE2
+#endif
+#define ETC1_MAX_THREADS 16
 /* From http://www.khronos.org/registry/gles/extensions/OES/OES_compressed_ETC1_RGB8_texture.txt
  The number of bits that represent a 4x4 texel block is 64 bits if
  <internalformat> is given by ETC1_RGB8_OES.
@@ -248,75 +258,158 @@ static
 inline int square(int x) {
     return x * x;
 }
-static etc1_uint32 chooseModifier(const etc1_byte* pBaseColors,
-        const etc1_byte* pIn, etc1_uint32 *pLow, int bitIndex,
+// The pixels of a sub-block gathered in encoding order, along with the bit
+// positions of their indices in the low word.
+typedef struct {
+    short r[8];
+    short g[8];
+    short b[8];
+    int bitIndex[8];
+    etc1_uint32 validMask;
+} etc_subblock;
+static
+void etc_gather_subblock(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc_subblock* pSub, bool flipped, bool second) {
+    int n = 0;
+    pSub->validMask = 0;
+    for (int j = 0; j < 8; j++) {
+        int x, y;
+        if (flipped) {
+            x = j & 3;
+            y = (second ? 2 : 0) + (j >> 2);
+        } else {
+            x = (second ? 2 : 0) + (j & 1);
+            y = j >> 1;
+        }
+        int i = x + 4 * y;
+        const etc1_byte* p = pIn + i * 3;
+        pSub->r[n] = p[0];
+        pSub->g[n] = p[1];
+        pSub->b[n] = p[2];
+        pSub->bitIndex[n] = y + x * 4;
+        if (inMask & (1 << i)) {
+            pSub->validMask |= 1 << n;
+        }
+        n++;
+    }
+}
+// Find the best modifier of the table for each pixel of the sub-block. The
+// score is 6 * dG^2 + 3 * dR^2 + dB^2, ties go to the lowest index.
+static void chooseModifiers(const etc1_byte* pBaseColors,
+        const etc_subblock* pSub, etc1_uint32* pScores, int* pIndices,
         const int* pModifierTable) {
-    etc1_uint32 bestScore = ~0;
-    int bestIndex = 0;
-    int pixelR = pIn[0];
-    int pixelG = pIn[1];
-    int pixelB = pIn[2];
     int r = pBaseColors[0];
     int g = pBaseColors[1];
     int b = pBaseColors[2];
+#if defined(ETC1_SSE2)
+    __m128i pr = _mm_loadu_si128((const __m128i*) pSub->r);
+    __m128i pg = _mm_loadu_si128((const __m128i*) pSub->g);
+    __m128i pb = _mm_loadu_si128((const __m128i*) pSub->b);
+    __m128i w = _mm_set_epi16(3, 6, 3, 6, 3, 6, 3, 6);
+    __m128i zero = _mm_setzero_si128();
+    __m128i best0 = _mm_set1_epi32(0x7fffffff);
+    __m128i best1 = best0;
+    __m128i index0 = zero;
+    __m128i index1 = zero;
     for (int i = 0; i < 4; i++) {
         int modifier = pModifierTable[i];
-        int decodedG = clamp(g + modifier);
-        etc1_uint32 score = (etc1_uint32) (6 * square(decodedG - pixelG));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedR = clamp(r + modifier);
-        score += (etc1_uint32) (3 * square(decodedR - pixelR));
-        if (score >= bestScore) {
-            continue;
-        }
-        int decodedB = clamp(b + modifier);
-        score += (etc1_uint32) square(decodedB - pixelB);
-        if (score < bestScore) {
-            bestScore = score;
-            bestIndex = i;
+        __m128i dg = _mm_sub_epi16(_mm_set1_epi16(clamp(g + modifier)), pg);
+        __m128i dr = _mm_sub_epi16(_mm_set1_epi16(clamp(r + modifier)), pr);
+        __m128i db = _mm_sub_epi16(_mm_set1_epi16(clamp(b + modifier)), pb);
+        __m128i gr0 = _mm_unpacklo_epi16(dg, dr);
+        __m128i gr1 = _mm_unpackhi_epi16(dg, dr);
+        __m128i b0 = _mm_unpacklo_epi16(db, zero);
+        __m128i b1 = _mm_unpackhi_epi16(db, zero);
+        __m128i score0 = _mm_add_epi32(
+                _mm_madd_epi16(gr0, _mm_mullo_epi16(gr0, w)),
+                _mm_madd_epi16(b0, b0));
+        __m128i score1 = _mm_add_epi32(
+                _mm_madd_epi16(gr1, _mm_mullo_epi16(gr1, w)),
+                _mm_madd_epi16(b1, b1));
+        __m128i lt0 = _mm_cmplt_epi32(score0, best0);
+        __m128i lt1 = _mm_cmplt_epi32(score1, best1);
+        __m128i idx = _mm_set1_epi32(i);
+        best0 = _mm_or_si128(_mm_and_si128(lt0, score0),
+                _mm_andnot_si128(lt0, best0));
+        best1 = _mm_or_si128(_mm_and_si128(lt1, score1),
+                _mm_andnot_si128(lt1, best1));
+        index0 = _mm_or_si128(_mm_and_si128(lt0, idx),
+                _mm_andnot_si128(lt0, index0));
+        index1 = _mm_or_si128(_mm_and_si128(lt1, idx),
+                _mm_andnot_si128(lt1, index1));
+    }
+    _mm_storeu_si128((__m128i*) pScores, best0);
+    _mm_storeu_si128((__m128i*) (pScores + 4), best1);
+    _mm_storeu_si128((__m128i*) pIndices, index0);
+    _mm_storeu_si128((__m128i*) (pIndices + 4), index1);
+#elif defined(ETC1_NEON)
+    int16x8_t pr = vld1q_s16(pSub->r);
+    int16x8_t pg = vld1q_s16(pSub->g);
+    int16x8_t pb = vld1q_s16(pSub->b);
+    uint32x4_t best0 = vdupq_n_u32(0xffffffff);
+    uint32x4_t best1 = best0;
+    uint32x4_t index0 = vdupq_n_u32(0);
+    uint32x4_t index1 = index0;
+    for (int i = 0; i < 4; i++) {
+        int modifier = pModifierTable[i];
+        int16x8_t dg = vsubq_s16(vdupq_n_s16(clamp(g + modifier)), pg);
+        int16x8_t dr = vsubq_s16(vdupq_n_s16(clamp(r + modifier)), pr);
+        int16x8_t db = vsubq_s16(vdupq_n_s16(clamp(b + modifier)), pb);
+        int16x8_t dg6 = vmulq_n_s16(dg, 6);
+        int16x8_t dr3 = vmulq_n_s16(dr, 3);
+        int32x4_t s0 = vmull_s16(vget_low_s16(dg), vget_low_s16(dg6));
+        int32x4_t s1 = vmull_s16(vget_high_s16(dg), vget_high_s16(dg6));
+        s0 = vmlal_s16(s0, vget_low_s16(dr), vget_low_s16(dr3));
+        s1 = vmlal_s16(s1, vget_high_s16(dr), vget_high_s16(dr3));
+        s0 = vmlal_s16(s0, vget_low_s16(db), vget_low_s16(db));
+        s1 = vmlal_s16(s1, vget_high_s16(db), vget_high_s16(db));
+        uint32x4_t score0 = vreinterpretq_u32_s32(s0);
+        uint32x4_t score1 = vreinterpretq_u32_s32(s1);
+        uint32x4_t lt0 = vcltq_u32(score0, best0);
+        uint32x4_t lt1 = vcltq_u32(score1, best1);
+        uint32x4_t idx = vdupq_n_u32(i);
+        best0 = vbslq_u32(lt0, score0, best0);
+        best1 = vbslq_u32(lt1, score1, best1);
+        index0 = vbslq_u32(lt0, idx, index0);
+        index1 = vbslq_u32(lt1, idx, index1);
+    }
+    vst1q_u32(pScores, best0);
+    vst1q_u32(pScores + 4, best1);
+    vst1q_s32(pIndices, vreinterpretq_s32_u32(index0));
+    vst1q_s32(pIndices + 4, vreinterpretq_s32_u32(index1));
+#else
+    for (int n = 0; n < 8; n++) {
+        etc1_uint32 bestScore = ~0;
+        int bestIndex = 0;
+        for (int i = 0; i < 4; i++) {
+            int modifier = pModifierTable[i];
+            etc1_uint32 score = (etc1_uint32) (6 * square(clamp(g + modifier) - pSub->g[n])
+                    + 3 * square(clamp(r + modifier) - pSub->r[n])
+                    + square(clamp(b + modifier) - pSub->b[n]));
+            if (score < bestScore) {
+                bestScore = score;
+                bestIndex = i;
+            }
         }
+        pScores[n] = bestScore;
+        pIndices[n] = bestIndex;
     }
-    etc1_uint32 lowMask = (((bestIndex >> 1) << 16) | (bestIndex & 1))
-            << bitIndex;
-    *pLow |= lowMask;
-    return bestScore;
+#endif
 }
 static
-void etc_encode_subblock_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc_compressed* pCompressed, bool flipped, bool second,
-        const etc1_byte* pBaseColors, const int* pModifierTable) {
+void etc_encode_subblock_helper(const etc_subblock* pSub,
+        etc_compressed* pCompressed, const etc1_byte* pBaseColors,
+        const int* pModifierTable) {
+    etc1_uint32 scores[8];
+    int indices[8];
     int score = pCompressed->score;
-    if (flipped) {
-        int by = 0;
-        if (second) {
-            by = 2;
-        }
-        for (int y = 0; y < 2; y++) {
-            int yy = by + y;
-            for (int x = 0; x < 4; x++) {
-                int i = x + 4 * yy;
-                if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, yy + x * 4, pModifierTable);
-                }
-            }
-        }
-    } else {
-        int bx = 0;
-        if (second) {
-            bx = 2;
-        }
-        for (int y = 0; y < 4; y++) {
-            for (int x = 0; x < 2; x++) {
-                int xx = bx + x;
-                int i = xx + 4 * y;
-                if (inMask & (1 << i)) {
-                    score += chooseModifier(pBaseColors, pIn + i * 3,
-                            &pCompressed->low, y + xx * 4, pModifierTable);
-                }
-            }
+    chooseModifiers(pBaseColors, pSub, scores, indices, pModifierTable);
+    for (int n = 0; n < 8; n++) {
+        if (pSub->validMask & (1 << n)) {
+            int bestIndex = indices[n];
+            score += scores[n];
+            pCompressed->low |= (((bestIndex >> 1) << 16) | (bestIndex & 1))
+                    << pSub->bitIndex[n];
         }
     }
     pCompressed->score = score;
@@ -373,37 +466,51 @@ static void etc_encodeBaseColors(etc1_byte* pBaseColors,
 }
 static
 void etc_encode_block_helper(const etc1_byte* pIn, etc1_uint32 inMask,
-        const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped) {
+        const etc1_byte* pColors, etc_compressed* pCompressed, bool flipped,
+        int quality) {
     pCompressed->score = ~0;
     pCompressed->high = (flipped ? 1 : 0);
     pCompressed->low = 0;
     etc1_byte pBaseColors[6];
     etc_encodeBaseColors(pBaseColors, pColors, pCompressed);
+    etc_subblock sub;
+    etc_gather_subblock(pIn, inMask, &sub, flipped, false);
     int originalHigh = pCompressed->high;
     const int* pModifierTable = kModifierTable;
+    etc1_uint32 lastScore = ~0;
     for (int i = 0; i < 8; i++, pModifierTable += 4) {
         etc_compressed temp;
         temp.score = 0;
         temp.high = originalHigh | (i << 5);
         temp.low = 0;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, false,
-                pBaseColors, pModifierTable);
+        etc_encode_subblock_helper(&sub, &temp, pBaseColors, pModifierTable);
+        // the error is close to convex in the modifier table index
+        if (quality == ETC1_QUALITY_LOW && temp.score > lastScore) {
+            break;
+        }
+        lastScore = temp.score;
         take_best(pCompressed, &temp);
     }
+    etc_gather_subblock(pIn, inMask, &sub, flipped, true);
     pModifierTable = kModifierTable;
     etc_compressed firstHalf = *pCompressed;
+    lastScore = ~0;
     for (int i = 0; i < 8; i++, pModifierTable += 4) {
         etc_compressed temp;
         temp.score = firstHalf.score;
         temp.high = firstHalf.high | (i << 2);
         temp.low = firstHalf.low;
-        etc_encode_subblock_helper(pIn, inMask, &temp, flipped, true,
-                pBaseColors + 3, pModifierTable);
+        etc_encode_subblock_helper(&sub, &temp, pBaseColors + 3,
+                pModifierTable);
         if (i == 0) {
             *pCompressed = temp;
         } else {
+            if (quality == ETC1_QUALITY_LOW && temp.score > lastScore) {
+                break;
+            }
             take_best(pCompressed, &temp);
         }
+        lastScore = temp.score;
     }
 }
 static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
@@ -412,76 +519,160 @@ static void writeBigEndian(etc1_byte* pOut, etc1_uint32 d) {
     pOut[2] = (etc1_byte)(d >> 8);
     pOut[3] = (etc1_byte) d;
 }
-// Input is a 4 x 4 square of 3-byte pixels in form R, G, B
-// inmask is a 16-bit mask where bit (1 << (x + y * 4)) tells whether the corresponding (x,y)
-// pixel is valid or not. Invalid pixel color values are ignored when compressing.
-// Output is an ETC1 compressed version of the data.
-void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
-        etc1_byte* pOut) {
+// Blocks scoring below this are good enough to skip the flipped orientation,
+// roughly an error of two levels per channel and pixel.
+static const etc1_uint32 kEarlyOutScore[] = { 0, 16 * 40, 16 * 160 };
+static
+void etc_encode_block_quality(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut, int quality) {
     etc1_byte colors[6];
     etc1_byte flippedColors[6];
     etc_average_colors_subblock(pIn, inMask, colors, false, false);
     etc_average_colors_subblock(pIn, inMask, colors + 3, false, true);
-    etc_average_colors_subblock(pIn, inMask, flippedColors, true, false);
-    etc_average_colors_subblock(pIn, inMask, flippedColors + 3, true, true);
     etc_compressed a, b;
-    etc_encode_block_helper(pIn, inMask, colors, &a, false);
-    etc_encode_block_helper(pIn, inMask, flippedColors, &b, true);
-    take_best(&a, &b);
+    etc_encode_block_helper(pIn, inMask, colors, &a, false, quality);
+    if (a.score >= kEarlyOutScore[quality]) {
+        etc_average_colors_subblock(pIn, inMask, flippedColors, true, false);
+        etc_average_colors_subblock(pIn, inMask, flippedColors + 3, true, true);
+        etc_encode_block_helper(pIn, inMask, flippedColors, &b, true, quality);
+        take_best(&a, &b);
+    }
     writeBigEndian(pOut, a.high);
     writeBigEndian(pOut + 4, a.low);
 }
+// Input is a 4 x 4 square of 3-byte pixels in form R, G, B
+// inmask is a 16-bit mask where bit (1 << (x + y * 4)) tells whether the corresponding (x,y)
+// pixel is valid or not. Invalid pixel color values are ignored when compressing.
+// Output is an ETC1 compressed version of the data.
+void etc1_encode_block(const etc1_byte* pIn, etc1_uint32 inMask,
+        etc1_byte* pOut) {
+    etc_encode_block_quality(pIn, inMask, pOut, ETC1_QUALITY_HIGH);
+}
 // Return the size of the encoded image data (does not include size of PKM header).
 etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height) {
     return (((width + 3) & ~3) * ((height + 3) & ~3)) >> 1;
 }
+typedef struct {
+    const etc1_byte* pIn;
+    etc1_uint32 width;
+    etc1_uint32 height;
+    etc1_uint32 pixelSize;
+    etc1_uint32 stride;
+    etc1_byte* pOut;
+    int quality;
+    etc1_uint32 nextRow;
+} etc_encode_job;
+static
+void etc_encode_row(const etc_encode_job* pJob, etc1_uint32 y) {
+    static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
+    static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
+            0xffff };
+    etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
+    etc1_uint32 width = pJob->width;
+    etc1_uint32 pixelSize = pJob->pixelSize;
+    etc1_uint32 encodedWidth = (width + 3) & ~3;
+    etc1_byte* pOut = pJob->pOut + (y >> 2) * (encodedWidth >> 2)
+            * ETC1_ENCODED_BLOCK_SIZE;
+    etc1_uint32 yEnd = pJob->height - y;
+    if (yEnd > 4) {
+        yEnd = 4;
+    }
+    int ymask = kYMask[yEnd];
+    for (etc1_uint32 x = 0; x < encodedWidth; x += 4) {
+        etc1_uint32 xEnd = width - x;
+        if (xEnd > 4) {
+            xEnd = 4;
+        }
+        int mask = ymask & kXMask[xEnd];
+        // the gathers read whole sub-blocks, masked texels included
+        if (mask != 0xffff) {
+            memset(block, 0, sizeof(block));
+        }
+        for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
+            etc1_byte* q = block + (cy * 4) * 3;
+            const etc1_byte* p = pJob->pIn + pixelSize * x
+                    + pJob->stride * (y + cy);
+            if (pixelSize == 3) {
+                memcpy(q, p, xEnd * 3);
+            } else {
+                for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
+                    int pixel = (p[1] << 8) | p[0];
+                    *q++ = convert5To8(pixel >> 11);
+                    *q++ = convert6To8(pixel >> 5);
+                    *q++ = convert5To8(pixel);
+                    p += pixelSize;
+                }
+            }
+        }
+        etc_encode_block_quality(block, mask, pOut, pJob->quality);
+        pOut += ETC1_ENCODED_BLOCK_SIZE;
+    }
+}
+static
+void* etc_encode_worker(void* arg) {
+    etc_encode_job* pJob = (etc_encode_job*) arg;
+    etc1_uint32 encodedHeight = (pJob->height + 3) & ~3;
+    for (;;) {
+        etc1_uint32 y = __atomic_fetch_add(&pJob->nextRow, 4, __ATOMIC_RELAXED);
+        if (y >= encodedHeight) {
+            break;
+        }
+        etc_encode_row(pJob, y);
+    }
+    return NULL;
+}
 // Encode an entire image.
 // pIn - pointer to the image data. Formatted such that the Red component of
 //       pixel (x,y) is at pIn + pixelSize * x + stride * y + redOffset;
 // pOut - pointer to encoded data. Must be large enough to store entire encoded image.
 int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut) {
+    return etc1_encode_image_quality(pIn, width, height, pixelSize, stride,
+            pOut, ETC1_QUALITY_HIGH, 1);
+}
+// Encode an entire image with block rows spread across numThreads threads,
+// 0 picks the number of online CPUs.
+int etc1_encode_image_quality(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_byte* pOut, int quality, etc1_uint32 numThreads) {
     if (pixelSize < 2 || pixelSize > 3) {
         return -1;
     }
-    static const unsigned short kYMask[] = { 0x0, 0xf, 0xff, 0xfff, 0xffff };
-    static const unsigned short kXMask[] = { 0x0, 0x1111, 0x3333, 0x7777,
-            0xffff };
-    etc1_byte block[ETC1_DECODED_BLOCK_SIZE];
-    etc1_byte encoded[ETC1_ENCODED_BLOCK_SIZE];
-    etc1_uint32 encodedWidth = (width + 3) & ~3;
-    etc1_uint32 encodedHeight = (height + 3) & ~3;
-    for (etc1_uint32 y = 0; y < encodedHeight; y += 4) {
-        etc1_uint32 yEnd = height - y;
-        if (yEnd > 4) {
-            yEnd = 4;
-        }
-        int ymask = kYMask[yEnd];
-        for (etc1_uint32 x = 0; x < encodedWidth; x += 4) {
-            etc1_uint32 xEnd = width - x;
-            if (xEnd > 4) {
-                xEnd = 4;
-            }
-            int mask = ymask & kXMask[xEnd];
-            for (etc1_uint32 cy = 0; cy < yEnd; cy++) {
-                etc1_byte* q = block + (cy * 4) * 3;
-                const etc1_byte* p = pIn + pixelSize * x + stride * (y + cy);
-                if (pixelSize == 3) {
-                    memcpy(q, p, xEnd * 3);
-                } else {
-                    for (etc1_uint32 cx = 0; cx < xEnd; cx++) {
-                        int pixel = (p[1] << 8) | p[0];
-                        *q++ = convert5To8(pixel >> 11);
-                        *q++ = convert6To8(pixel >> 5);
-                        *q++ = convert5To8(pixel);
-                        p += pixelSize;
-                    }
-                }
-            }
-            etc1_encode_block(block, mask, encoded);
-            memcpy(pOut, encoded, sizeof(encoded));
-            pOut += sizeof(encoded);
+    if (quality < ETC1_QUALITY_HIGH || quality > ETC1_QUALITY_LOW) {
+        return -1;
+    }
+    etc_encode_job job;
+    job.pIn = pIn;
+    job.width = width;
+    job.height = height;
+    job.pixelSize = pixelSize;
+    job.stride = stride;
+    job.pOut = pOut;
+    job.quality = quality;
+    job.nextRow = 0;
+    etc1_uint32 numRows = (height + 3) >> 2;
+    if (numThreads == 0) {
+        long numCpus = sysconf(_SC_NPROCESSORS_ONLN);
+        numThreads = numCpus > 0 ? numCpus : 1;
+    }
+    if (numThreads > ETC1_MAX_THREADS) {
+        numThreads = ETC1_MAX_THREADS;
+    }
+    if (numThreads > numRows) {
+        numThreads = numRows;
+    }
+    pthread_t threads[ETC1_MAX_THREADS];
+    etc1_uint32 started = 0;
+    // the calling thread works too
+    while (started + 1 < numThreads) {
+        if (pthread_create(&threads[started], NULL, etc_encode_worker, &job)) {
+            break;
         }
+        started++;
+    }
+    etc_encode_worker(&job);
+    for (etc1_uint32 i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
     }
     return 0;
 }
@@ -50,9 +50,21 @@ etc1_uint32 etc1_get_encoded_data_size(etc1_uint32 width, etc1_uint32 height);
 //       pixel (x,y) is at pIn + pixelSize * x + stride * y;
 // pOut - pointer to encoded data. Must be large enough to store entire encoded image.
 // pixelSize can be 2 or 3. 2 is an GL_UNSIGNED_SHORT_5_6_5 image, 3 is a GL_BYTE RGB image.
-// returns non-zero if there is an error.
+// returns non-zero if there is an error. Encodes on the calling thread only.
 int etc1_encode_image(const etc1_byte* pIn, etc1_uint32 width, etc1_uint32 height,
         etc1_uint32 pixelSize, etc1_uint32 stride, etc1_byte* pOut);
+// Speed / quality presets for etc1_encode_image_quality().
+// ETC1_QUALITY_HIGH is the exhaustive search of etc1_encode_image().
+// ETC1_QUALITY_MEDIUM skips the flipped orientation for blocks with a low error.
+// ETC1_QUALITY_LOW also stops the modifier table search once the error grows.
+#define ETC1_QUALITY_HIGH 0
+#define ETC1_QUALITY_MEDIUM 1
+#define ETC1_QUALITY_LOW 2
+// Encode an entire image with the given preset. Block rows are encoded in
+// parallel by numThreads threads, 0 uses one thread per online CPU.
+int etc1_encode_image_quality(const etc1_byte* pIn, etc1_uint32 width,
+        etc1_uint32 height, etc1_uint32 pixelSize, etc1_uint32 stride,
+        etc1_byte* pOut, int quality, etc1_uint32 numThreads);
 // Decode an entire image.
 // pIn - pointer to encoded data.
 // pOut - pointer to the image data. Will be written such that
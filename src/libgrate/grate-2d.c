@@ -67,4 +67,6 @@ void grate_clear(struct grate *grate)
 	err = host1x_gr2d_clear(gr2d, pixbuf, color);
 	if (err < 0)
 		grate_error("host1x_gr2d_clear() failed: %d\n", err);
+
+	grate_framebuffer_damage_all(grate->fb);
 }
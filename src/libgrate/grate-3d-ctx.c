@@ -25,8 +25,17 @@
 
 #include <string.h>
 
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define UNIFORM_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define UNIFORM_SSE2 1
+#endif
+
 #include "libgrate-private.h"
 #include "grate-3d.h"
+#include "matrix.h"
 #include "tgr_3d.xml.h"
 
 static uint32_t float_to_fp20(float f)
@@ -60,6 +69,98 @@ static uint32_t float_to_fx10(float f)
 	return u & 0x3ff;
 }
 
+/*
+ * Vectorised versions of the above, bit-exact with the scalar code for
+ * every input including zero, infinity and NaN. For fx10 this holds as
+ * long as value * 256 is representable as int32, which is far outside
+ * of the fx10 range anyway.
+ */
+static void floats_to_fp20(uint32_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(UNIFORM_SSE2)
+	const __m128i abs_mask = _mm_set1_epi32(0x7fffffff);
+	const __m128i exp_mask = _mm_set1_epi32(0xff);
+	const __m128i exp_bias = _mm_set1_epi32(31 - 127);
+	const __m128i mask_6 = _mm_set1_epi32(0x3f);
+	const __m128i mant_mask = _mm_set1_epi32(0x1fff);
+	const __m128i sign_mask = _mm_set1_epi32(1 << 19);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128i u = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i exp = _mm_and_si128(_mm_srli_epi32(u, 23), exp_mask);
+		__m128i inf = _mm_cmpeq_epi32(exp, exp_mask);
+		__m128i zero = _mm_cmpeq_epi32(_mm_and_si128(u, abs_mask),
+					       _mm_setzero_si128());
+		__m128i v;
+
+		exp = _mm_and_si128(_mm_add_epi32(exp, exp_bias), mask_6);
+		exp = _mm_or_si128(exp, _mm_and_si128(inf, mask_6));
+
+		v = _mm_and_si128(_mm_srli_epi32(u, 12), sign_mask);
+		v = _mm_or_si128(v, _mm_slli_epi32(exp, 13));
+		v = _mm_or_si128(v, _mm_and_si128(_mm_srli_epi32(u, 10),
+						  mant_mask));
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_andnot_si128(zero, v));
+	}
+#elif defined(UNIFORM_NEON)
+	const uint32x4_t exp_mask = vdupq_n_u32(0xff);
+	const uint32x4_t mask_6 = vdupq_n_u32(0x3f);
+
+	for (; i + 4 <= count; i += 4) {
+		uint32x4_t u = vreinterpretq_u32_f32(vld1q_f32(src + i));
+		uint32x4_t exp = vandq_u32(vshrq_n_u32(u, 23), exp_mask);
+		uint32x4_t inf = vceqq_u32(exp, exp_mask);
+		uint32x4_t zero = vceqq_u32(vshlq_n_u32(u, 1), vdupq_n_u32(0));
+		uint32x4_t v;
+
+		exp = vandq_u32(vaddq_u32(exp, vdupq_n_u32(31 - 127)), mask_6);
+		exp = vorrq_u32(exp, vandq_u32(inf, mask_6));
+
+		v = vandq_u32(vshrq_n_u32(u, 12), vdupq_n_u32(1 << 19));
+		v = vorrq_u32(v, vshlq_n_u32(exp, 13));
+		v = vorrq_u32(v, vandq_u32(vshrq_n_u32(u, 10),
+					   vdupq_n_u32(0x1fff)));
+
+		vst1q_u32(dst + i, vbicq_u32(v, zero));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_fp20(src[i]);
+}
+
+static void floats_to_fx10(uint32_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(UNIFORM_SSE2)
+	const __m128 scale = _mm_set1_ps(256.0f);
+	const __m128i mask = _mm_set1_epi32(0x3ff);
+
+	for (; i + 4 <= count; i += 4) {
+		__m128 v = _mm_mul_ps(_mm_loadu_ps(src + i), scale);
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_and_si128(_mm_cvttps_epi32(v), mask));
+	}
+#elif defined(UNIFORM_NEON)
+	const float32x4_t scale = vdupq_n_f32(256.0f);
+	const uint32x4_t mask = vdupq_n_u32(0x3ff);
+
+	/* saturating like the VFP float to unsigned conversion */
+	for (; i + 4 <= count; i += 4) {
+		float32x4_t v = vmulq_f32(vld1q_f32(src + i), scale);
+
+		vst1q_u32(dst + i, vandq_u32(vcvtq_u32_f32(v), mask));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_fx10(src[i]);
+}
+
 struct grate_3d_ctx * grate_3d_alloc_ctx(struct grate *grate)
 {
 	struct grate_3d_ctx *ctx = calloc(1, sizeof(struct grate_3d_ctx));
@@ -69,11 +170,112 @@ struct grate_3d_ctx * grate_3d_alloc_ctx(struct grate *grate)
 		return NULL;
 	}
 
+	ctx->uniforms = calloc(1, sizeof(*ctx->uniforms));
+	if (!ctx->uniforms) {
+		grate_error("Failed to allocate uniforms\n");
+		free(ctx);
+		return NULL;
+	}
+
+	ctx->vs_uniforms = ctx->uniforms->vs;
+	ctx->fs_uniforms = ctx->uniforms->fs;
 	ctx->grate = grate;
 
 	return ctx;
 }
 
+void grate_3d_free_ctx(struct grate_3d_ctx *ctx)
+{
+	unsigned i;
+
+	if (!ctx)
+		return;
+
+	for (i = 0; i < ctx->max_layers; i++)
+		free(ctx->layers[i].uniforms);
+
+	free(ctx->layers);
+	free(ctx->uniforms);
+	free(ctx);
+}
+
+int grate_3d_ctx_push_state(struct grate_3d_ctx *ctx)
+{
+	struct grate_3d_ctx_layer *layers;
+	unsigned max_layers;
+
+	if (ctx->num_layers == ctx->max_layers) {
+		max_layers = ctx->max_layers ? ctx->max_layers * 2 : 2;
+
+		layers = realloc(ctx->layers, max_layers * sizeof(*layers));
+		if (!layers) {
+			grate_error("Failed to allocate state layer\n");
+			return -1;
+		}
+
+		memset(&layers[ctx->max_layers], 0,
+		       (max_layers - ctx->max_layers) * sizeof(*layers));
+
+		ctx->layers = layers;
+		ctx->max_layers = max_layers;
+	}
+
+	memcpy(&ctx->layers[ctx->num_layers++].state, ctx,
+	       GRATE_3D_CTX_STATE_SIZE);
+
+	return 0;
+}
+
+int grate_3d_ctx_pop_state(struct grate_3d_ctx *ctx)
+{
+	if (ctx->num_layers == 0) {
+		grate_error("State stack underflow\n");
+		return -1;
+	}
+
+	memcpy(ctx, &ctx->layers[--ctx->num_layers].state,
+	       GRATE_3D_CTX_STATE_SIZE);
+
+	return 0;
+}
+
+/*
+ * The uniforms are shared with the layer below until the first write,
+ * preserve is false for writers that replace all of them anyway.
+ */
+static int grate_3d_ctx_own_uniforms(struct grate_3d_ctx *ctx, bool preserve)
+{
+	struct grate_3d_ctx_layer *layer;
+
+	if (ctx->num_layers == 0)
+		return 0;
+
+	layer = &ctx->layers[ctx->num_layers - 1];
+
+	if (!layer->uniforms) {
+		layer->uniforms = malloc(sizeof(*layer->uniforms));
+		if (!layer->uniforms) {
+			grate_error("Failed to allocate uniforms\n");
+			return -1;
+		}
+	}
+
+	if (ctx->vs_uniforms == layer->uniforms->vs)
+		return 0;
+
+	if (preserve) {
+		memcpy(layer->uniforms->vs, ctx->vs_uniforms,
+		       sizeof(layer->uniforms->vs));
+		memcpy(layer->uniforms->fs, ctx->fs_uniforms,
+		       sizeof(layer->uniforms->fs));
+	}
+
+	ctx->vs_uniforms = layer->uniforms->vs;
+	ctx->fs_uniforms = layer->uniforms->fs;
+
+	return 0;
+}
+
 int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 				       unsigned location, unsigned size,
 				       unsigned type, unsigned stride,
@@ -113,19 +315,12 @@ int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
-	attr = calloc(1, sizeof(*attr));
-	if (!attr) {
-		grate_error("Allocation failed\n");
-		return -1;
-	}
-
+	attr = &ctx->vtx_attributes[location];
 	attr->stride = stride;
 	attr->type = type;
 	attr->size = size;
 	attr->bo = data_bo;
 
-	ctx->vtx_attributes[location] = attr;
-
 	return 0;
 }
 
@@ -236,13 +431,16 @@ int grate_3d_ctx_bind_program(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
+	if (grate_3d_ctx_own_uniforms(ctx, false))
+		return -1;
+
 	ctx->program = program;
 
 	memcpy(ctx->vs_uniforms, program->vs_constants,
-	       sizeof(ctx->vs_uniforms));
+	       sizeof(ctx->uniforms->vs));
 
 	memcpy(ctx->fs_uniforms, program->fs_constants,
-	       sizeof(ctx->fs_uniforms));
+	       sizeof(ctx->uniforms->fs));
 
 	return 0;
 }
@@ -261,6 +459,9 @@ int grate_3d_ctx_set_vertex_uniform(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
+	if (grate_3d_ctx_own_uniforms(ctx, true))
+		return -1;
+
 	memcpy(&ctx->vs_uniforms[location * 4], values, nb * sizeof(float));
 
 	return 0;
@@ -273,6 +474,68 @@ int grate_3d_ctx_set_vertex_mat4_uniform(struct grate_3d_ctx *ctx,
 					       16, (float *) mat);
 }
 
+/*
+ * Uploads a * b[i] for count matrices to consecutive locations, computed
+ * straight into the uniforms storage.
+ */
+int grate_3d_ctx_set_vertex_mat4_uniform_batch(struct grate_3d_ctx *ctx,
+					       unsigned location,
+					       const struct mat4 *a,
+					       const struct mat4 *b,
+					       unsigned count)
+{
+	if (!ctx->program) {
+		grate_error("No program bound\n");
+		return -1;
+	}
+
+	if (location >= 256 || location + count * 4 > 256) {
+		grate_error("Invalid location %u\n", location);
+		return -1;
+	}
+
+	if (grate_3d_ctx_own_uniforms(ctx, true))
+		return -1;
+
+	mat4_multiply_batch((struct mat4 *)&ctx->vs_uniforms[location * 4],
+			    a, b, count);
+
+	return 0;
+}
+
+static void grate_3d_ctx_write_fragment_uniform(struct grate_3d_ctx *ctx,
+						unsigned location,
+						unsigned components_mask,
+						bool lowp,
+						const float *value)
+{
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		unsigned position = location >> 1;
+		bool fx10_high = !!(location & 1);
+
+		if (!(components_mask & BIT(i)))
+			continue;
+
+		if (lowp) {
+			uint32_t fx10_val = float_to_fx10(value[i]);
+
+			if (fx10_high) {
+				ctx->fs_uniforms[position] &= 0x3ff;
+				ctx->fs_uniforms[position] |= fx10_val << 10;
+			} else {
+				ctx->fs_uniforms[position] &= ~0x3ff;
+				ctx->fs_uniforms[position] |= fx10_val;
+			}
+		} else {
+			ctx->fs_uniforms[position] = float_to_fp20(value[i]);
+		}
+
+		location += lowp ? 1 : 2;
+	}
+}
+
 int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 				      unsigned location, unsigned nb,
 				      float *value)
@@ -280,7 +543,6 @@ int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 	bool lowp = !!(location & 0x8000);
 	unsigned components_mask = (location >> 8) & 0xF;
 	unsigned components_nb = 0;
-	unsigned i;
 
 	if (!ctx->program) {
 		grate_error("No program bound\n");
@@ -323,37 +585,129 @@ int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
-	for (i = 0; i < 4; i++) {
-		unsigned position = location >> 1;
-		bool fx10_high = !!(location & 1);
+	if (grate_3d_ctx_own_uniforms(ctx, true))
+		return -1;
 
-		if (!(components_mask & BIT(i)))
-			continue;
+	grate_3d_ctx_write_fragment_uniform(ctx, location, components_mask,
+					    lowp, value);
 
-		if (lowp) {
-			uint32_t fx10_val = float_to_fx10(value[i]);
+	return 0;
+}
 
-			if (fx10_high) {
-				ctx->fs_uniforms[position] &= 0x3ff;
-				ctx->fs_uniforms[position] |= fx10_val << 10;
-			} else {
-				ctx->fs_uniforms[position] &= ~0x3ff;
-				ctx->fs_uniforms[position] |= fx10_val;
-			}
-		} else {
-			ctx->fs_uniforms[position] = float_to_fp20(value[i]);
-		}
+int grate_3d_ctx_set_fragment_float_uniform(struct grate_3d_ctx *ctx,
+					    unsigned location, float value)
+{
+	return grate_3d_ctx_set_fragment_uniform(ctx, location, 1, &value);
+}
 
-		location += lowp ? 1 : 2;
+/*
+ * Handles were validated when they were resolved, only the number of
+ * values has to cover the vertex uniform range or the fragment
+ * components, which are read at their component index.
+ */
+int grate_3d_ctx_set_uniform(struct grate_3d_ctx *ctx,
+			     struct grate_uniform_handle handle,
+			     unsigned nb, const float *values)
+{
+	unsigned slot = handle.bits & GRATE_UNIFORM_SLOT_MASK;
+	unsigned mask = (handle.bits & GRATE_UNIFORM_MASK) >>
+			GRATE_UNIFORM_MASK_SHIFT;
+
+	if (!(handle.bits & GRATE_UNIFORM_VALID))
+		return -1;
+
+	if (handle.bits & GRATE_UNIFORM_FRAGMENT) {
+		if (!mask || nb < log2_size(mask) + 1)
+			return -1;
+
+		if (grate_3d_ctx_own_uniforms(ctx, true))
+			return -1;
+
+		grate_3d_ctx_write_fragment_uniform(ctx, slot, mask,
+				!!(handle.bits & GRATE_UNIFORM_LOWP), values);
+		return 0;
 	}
 
+	if (slot * 4 + nb > ARRAY_SIZE(ctx->uniforms->vs))
+		return -1;
+
+	if (grate_3d_ctx_own_uniforms(ctx, true))
+		return -1;
+
+	memcpy(&ctx->vs_uniforms[slot * 4], values, nb * sizeof(float));
+
 	return 0;
 }
 
-int grate_3d_ctx_set_fragment_float_uniform(struct grate_3d_ctx *ctx,
-					    unsigned location, float value)
+int grate_3d_ctx_set_uniform_mat4(struct grate_3d_ctx *ctx,
+				  struct grate_uniform_handle handle,
+				  const struct mat4 *mat)
 {
-	return grate_3d_ctx_set_fragment_uniform(ctx, location, 1, &value);
+	return grate_3d_ctx_set_uniform(ctx, handle, 16,
+					(const float *) mat);
+}
+
+/*
+ * Sets nb consecutive fragment uniform components starting at location,
+ * ignoring the components mask. Each highp component occupies a whole
+ * register, lowp components are packed in pairs.
+ */
+int grate_3d_ctx_set_fragment_uniform_block(struct grate_3d_ctx *ctx,
+					    unsigned location, unsigned nb,
+					    const float *values)
+{
+	uint32_t fx10[64];
+	bool lowp = !!(location & 0x8000);
+	unsigned i;
+
+	if (!ctx->program) {
+		grate_error("No program bound\n");
+		return -1;
+	}
+
+	location &= 0xff;
+
+	if (location >= 64 || (lowp ? location : location >> 1) + nb >
+					(lowp ? 64 : 32)) {
+		grate_error("Invalid location %u\n", location);
+		return -1;
+	}
+
+	if (grate_3d_ctx_own_uniforms(ctx, true))
+		return -1;
+
+	if (!lowp) {
+		floats_to_fp20(&ctx->fs_uniforms[location >> 1], values, nb);
+		return 0;
+	}
+
+	floats_to_fx10(fx10, values, nb);
+
+	for (i = 0; i < nb; i++, location++) {
+		uint32_t *reg = &ctx->fs_uniforms[location >> 1];
+
+		if (location & 1)
+			*reg = (*reg & 0x3ff) | fx10[i] << 10;
+		else
+			*reg = (*reg & ~0x3ff) | fx10[i];
+	}
+
+	return 0;
+}
+
+int grate_3d_ctx_set_uniform_block(struct grate_3d_ctx *ctx,
+				   struct grate_uniform_handle handle,
+				   unsigned nb, const float *values)
+{
+	unsigned slot = handle.bits & GRATE_UNIFORM_SLOT_MASK;
+
+	if (!(handle.bits & GRATE_UNIFORM_FRAGMENT))
+		return grate_3d_ctx_set_uniform(ctx, handle, nb, values);
+
+	if (handle.bits & GRATE_UNIFORM_LOWP)
+		slot |= 0x8000;
+
+	return grate_3d_ctx_set_fragment_uniform_block(ctx, slot, nb, values);
 }
 
 void grate_3d_ctx_set_depth_range(struct grate_3d_ctx *ctx,
@@ -505,6 +859,11 @@ int grate_3d_ctx_bind_texture(struct grate_3d_ctx *ctx,
 		return -1;
 	}
 
+	if (tex && grate_texture_make_resident(tex)) {
+		grate_error("failed to restore texture\n");
+		return -1;
+	}
+
 	ctx->textures[location] = tex;
 
 	return 0;
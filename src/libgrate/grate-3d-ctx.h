@@ -32,6 +32,13 @@ struct grate_texture;
 struct grate_3d_ctx;
 struct mat4;
 
+/* opaque, resolved once via grate_get_*_uniform_handle() */
+struct grate_uniform_handle {
+	uint32_t bits;
+};
+
+#define grate_uniform_handle_valid(handle)	((handle).bits != 0)
+
 enum grate_3d_ctx_cull_face
 {
 	GRATE_3D_CTX_CULL_FACE_NONE		= 0xA001,
@@ -80,6 +87,10 @@ enum grate_3d_ctx_stencil_operation {
 };
 
 struct grate_3d_ctx * grate_3d_alloc_ctx(struct grate *grate);
+void grate_3d_free_ctx(struct grate_3d_ctx *ctx);
+
+int grate_3d_ctx_push_state(struct grate_3d_ctx *ctx);
+int grate_3d_ctx_pop_state(struct grate_3d_ctx *ctx);
 
 int grate_3d_ctx_vertex_attrib_pointer(struct grate_3d_ctx *ctx,
 				       unsigned location, unsigned size,
@@ -121,6 +132,12 @@ int grate_3d_ctx_set_vertex_uniform(struct grate_3d_ctx *ctx,
 int grate_3d_ctx_set_vertex_mat4_uniform(struct grate_3d_ctx *ctx,
 					 unsigned location, struct mat4 *mat);
 
+int grate_3d_ctx_set_vertex_mat4_uniform_batch(struct grate_3d_ctx *ctx,
+					       unsigned location,
+					       const struct mat4 *a,
+					       const struct mat4 *b,
+					       unsigned count);
+
 int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 				      unsigned location, unsigned nb,
 				      float *value);
@@ -128,6 +145,22 @@ int grate_3d_ctx_set_fragment_uniform(struct grate_3d_ctx *ctx,
 int grate_3d_ctx_set_fragment_float_uniform(struct grate_3d_ctx *ctx,
 					    unsigned location, float value);
 
+int grate_3d_ctx_set_uniform(struct grate_3d_ctx *ctx,
+			     struct grate_uniform_handle handle,
+			     unsigned nb, const float *values);
+
+int grate_3d_ctx_set_uniform_mat4(struct grate_3d_ctx *ctx,
+				  struct grate_uniform_handle handle,
+				  const struct mat4 *mat);
+
+int grate_3d_ctx_set_fragment_uniform_block(struct grate_3d_ctx *ctx,
+					    unsigned location, unsigned nb,
+					    const float *values);
+
+int grate_3d_ctx_set_uniform_block(struct grate_3d_ctx *ctx,
+				   struct grate_uniform_handle handle,
+				   unsigned nb, const float *values);
+
 void grate_3d_ctx_set_depth_range(struct grate_3d_ctx *ctx,
 				  float near, float far);
 
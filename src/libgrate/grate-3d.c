@@ -40,6 +40,10 @@
 #define TGR3D_BOOL(reg_name, field_name, boolean) \
 	((boolean) ? TGR3D_ ## reg_name ## _ ## field_name : 0)
 
+#define TGR3D_MAX_INDEX_COUNT \
+	((TGR3D_DRAW_PRIMITIVES_INDEX_COUNT__MASK >> \
+	  TGR3D_DRAW_PRIMITIVES_INDEX_COUNT__SHIFT) + 1)
+
 static void grate_shader_emit(struct host1x_pushbuf *pb,
 			      struct grate_shader *shader)
 {
@@ -409,16 +413,17 @@ static void grate_3d_relocate_primitive_indices(struct host1x_pushbuf *pb,
 						unsigned offset)
 {
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_INCR(TGR3D_INDEX_PTR, 1));
-	HOST1X_PUSHBUF_RELOCATE(pb, indices, offset, 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, indices, offset, 0,
+				       HOST1X_BO_ACCESS_READ);
 	host1x_pushbuf_push(pb, 0xdeadbeef);
 }
 
 static void grate_3d_set_draw_params(struct host1x_pushbuf *pb,
 				     struct grate_3d_ctx *ctx,
 				     unsigned primitive_type,
-				     unsigned index_mode)
+				     unsigned index_mode,
+				     unsigned first_vtx)
 {
-	unsigned first_vtx = 0;
 	uint32_t value = 0;
 
 	/*
@@ -443,9 +448,9 @@ static void grate_3d_set_draw_params(struct host1x_pushbuf *pb,
 }
 
 static void grate_3d_draw_primitives(struct host1x_pushbuf *pb,
+				     unsigned first_index,
 				     unsigned index_count)
 {
-	unsigned first_index = 0;
 	uint32_t value = 0;
 
 	value |= TGR3D_VAL(DRAW_PRIMITIVES, INDEX_COUNT, index_count - 1);
@@ -594,13 +599,15 @@ static void grate_3d_set_attribute(struct host1x_pushbuf *pb,
 	host1x_pushbuf_push(pb,
 			    HOST1X_OPCODE_INCR(TGR3D_ATTRIB_PTR(index), 2));
 
-	HOST1X_PUSHBUF_RELOCATE(pb, bo, offset, 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, bo, offset, 0,
+				       HOST1X_BO_ACCESS_READ);
 	host1x_pushbuf_push(pb, 0xdeadbeef);
 	host1x_pushbuf_push(pb, value);
 }
 
 static void grate_3d_setup_attributes(struct host1x_pushbuf *pb,
-				      struct grate_3d_ctx *ctx)
+				      struct grate_3d_ctx *ctx,
+				      unsigned base_vtx)
 {
 	uint32_t enable_mask = ctx->program->attributes_use_mask;
 	uint32_t out_mask = enable_mask & 0xFFFF;
@@ -610,19 +617,20 @@ static void grate_3d_setup_attributes(struct host1x_pushbuf *pb,
 	in_mask &= ctx->attributes_enable_mask;
 
 	for (i = 0; i < 16; i++) {
-		struct grate_vtx_attribute *attr = ctx->vtx_attributes[i];
+		struct grate_vtx_attribute *attr = &ctx->vtx_attributes[i];
 
 		if (!(in_mask & (1u << i)))
 			continue;
 
-		if (!attr) {
+		if (!attr->bo) {
 			in_mask &= ~(1u << i);
 			continue;
 		}
 
 		grate_3d_set_attribute(pb, i,
 				       attr->bo,
-				       attr->bo->offset,
+				       attr->bo->offset +
+					base_vtx * attr->stride,
 				       attr->type,
 				       attr->size,
 				       attr->stride);
@@ -683,7 +691,8 @@ static void grate_3d_relocate_texture(struct host1x_pushbuf *pb,
 {
 	host1x_pushbuf_push(pb,
 			    HOST1X_OPCODE_INCR(TGR3D_TEXTURE_POINTER(index), 1));
-	HOST1X_PUSHBUF_RELOCATE(pb, bo, offset, 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, bo, offset, 0,
+				       HOST1X_BO_ACCESS_READ);
 	host1x_pushbuf_push(pb, 0xdeadbeef);
 }
 
@@ -703,6 +712,7 @@ static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
 	int log2_width = log2_size(pixbuf->width);
 	int log2_height = log2_size(pixbuf->height);
 	bool compressed = false;
+	bool tiled = false;
 	unsigned pixel_format;
 	uint32_t value = 0;
 
@@ -765,6 +775,9 @@ static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
 	}
 
 	switch (pixbuf->layout) {
+	case PIX_BUF_LAYOUT_TILED_16x16:
+		tiled = true;
+		break;
 	case PIX_BUF_LAYOUT_LINEAR:
 		break;
 	default:
@@ -779,6 +792,8 @@ static void grate_3d_set_texture_desc(struct host1x_pushbuf *pb,
 
 	value |= TGR3D_BOOL(TEXTURE_DESC1, COMPRESSED,
 			    compressed);
+	value |= TGR3D_BOOL(TEXTURE_DESC1, TILED,
+			    tiled);
 	value |= TGR3D_BOOL(TEXTURE_DESC1, MINFILTER_LINEAR_WITHIN,
 			    min_filter_enabled);
 	value |= TGR3D_BOOL(TEXTURE_DESC1, MINFILTER_LINEAR_BETWEEN,
@@ -853,16 +868,18 @@ static void grate_3d_setup_textures(struct host1x_pushbuf *pb,
 
 static void grate_3d_setup_indices(struct host1x_pushbuf *pb,
 				   struct host1x_bo *bo,
+				   unsigned long offset,
 				   unsigned index_mode)
 {
 	if (index_mode == TGR3D_INDEX_MODE_NONE)
 		return;
 
-	grate_3d_relocate_primitive_indices(pb, bo, bo->offset);
+	grate_3d_relocate_primitive_indices(pb, bo, bo->offset + offset);
 }
 
 static void grate_3d_setup_context(struct host1x_pushbuf *pb,
-				   struct grate_3d_ctx *ctx)
+				   struct grate_3d_ctx *ctx,
+				   unsigned base_vtx)
 {
 	grate_3d_begin(pb);
 	grate_3d_init(pb);
@@ -890,7 +907,7 @@ static void grate_3d_setup_context(struct host1x_pushbuf *pb,
 	grate_3d_upload_vp_constants(pb, ctx);
 	grate_3d_upload_fp_constants(pb, ctx);
 
-	grate_3d_setup_attributes(pb, ctx);
+	grate_3d_setup_attributes(pb, ctx, base_vtx);
 	grate_3d_setup_render_targets(pb, ctx);
 	grate_3d_setup_textures(pb, ctx);
 
@@ -900,6 +917,34 @@ static void grate_3d_setup_context(struct host1x_pushbuf *pb,
 	grate_shader_emit(pb, ctx->program->linker);
 }
 
+/* bring back evicted textures before any of them is referenced */
+static int grate_3d_restore_textures(struct grate_3d_ctx *ctx)
+{
+	unsigned i;
+	int err;
+
+	grate_residency_tick(ctx->grate);
+
+	for (i = 0; i < 16; i++) {
+		if (ctx->textures[i])
+			grate_texture_touch(ctx->textures[i]);
+	}
+
+	for (i = 0; i < 16; i++) {
+		if (!ctx->textures[i])
+			continue;
+
+		err = grate_texture_restore(ctx->textures[i]);
+		if (err < 0) {
+			grate_error("failed to restore texture %u: %d\n",
+				    i, err);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
 static void grate_3d_check_render_targets_guard(struct grate_3d_ctx *ctx)
 {
 	unsigned i;
@@ -927,11 +972,20 @@ pixbuf_check:
 	}
 }
 
-void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
-			    unsigned primitive_type,
-			    struct host1x_bo *indices_bo,
-			    unsigned index_mode,
-			    unsigned vtx_count)
+/*
+ * base_vtx rebases all attribute pointers, indices_offset (in bytes) rebases
+ * the index buffer pointer. Both are applied via relocations, allowing to
+ * address data beyond the reach of the first index / first vertex fields.
+ */
+static void grate_3d_draw(struct grate_3d_ctx *ctx,
+			  unsigned primitive_type,
+			  struct host1x_bo *indices_bo,
+			  unsigned long indices_offset,
+			  unsigned index_mode,
+			  unsigned first_index,
+			  unsigned vtx_count,
+			  unsigned first_vtx,
+			  unsigned base_vtx)
 {
 	struct grate *grate = ctx->grate;
 	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
@@ -975,6 +1029,24 @@ void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
 		return;
 	}
 
+	if (vtx_count == 0 || vtx_count > TGR3D_MAX_INDEX_COUNT) {
+		grate_error("Invalid vertex count: %u\n", vtx_count);
+		return;
+	}
+
+	if (first_index > TGR3D_DRAW_PRIMITIVES_OFFSET__MASK) {
+		grate_error("Invalid first index: %u\n", first_index);
+		return;
+	}
+
+	if (first_vtx > TGR3D_DRAW_PARAMS_FIRST__MASK) {
+		grate_error("Invalid first vertex: %u\n", first_vtx);
+		return;
+	}
+
+	if (grate_3d_restore_textures(ctx) < 0)
+		return;
+
 	job = HOST1X_JOB_CREATE(syncpt->id, 1);
 	if (!job)
 		return;
@@ -985,10 +1057,10 @@ void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
 		return;
 	}
 
-	grate_3d_setup_context(pb, ctx);
-	grate_3d_setup_indices(pb, indices_bo, index_mode);
-	grate_3d_set_draw_params(pb, ctx, primitive_type, index_mode);
-	grate_3d_draw_primitives(pb, vtx_count);
+	grate_3d_setup_context(pb, ctx, base_vtx);
+	grate_3d_setup_indices(pb, indices_bo, indices_offset, index_mode);
+	grate_3d_set_draw_params(pb, ctx, primitive_type, index_mode, first_vtx);
+	grate_3d_draw_primitives(pb, first_index, vtx_count);
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 0x01));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
@@ -1005,9 +1077,57 @@ void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
 	if (err < 0)
 		return;
 
+	ctx->fence = fence;
+
 	err = HOST1X_CLIENT_WAIT(gr3d->client, fence, ~0u);
 	if (err < 0)
 		return;
 
 	grate_3d_check_render_targets_guard(ctx);
 }
+
+void grate_3d_draw_elements_range(struct grate_3d_ctx *ctx,
+				  unsigned primitive_type,
+				  struct host1x_bo *indices_bo,
+				  unsigned index_mode,
+				  unsigned first_index,
+				  unsigned vtx_count,
+				  unsigned first_vtx)
+{
+	grate_3d_draw(ctx, primitive_type, indices_bo, 0, index_mode,
+		      first_index, vtx_count, first_vtx, 0);
+}
+
+void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
+			    unsigned primitive_type,
+			    struct host1x_bo *indices_bo,
+			    unsigned index_mode,
+			    unsigned vtx_count)
+{
+	grate_3d_draw_elements_range(ctx, primitive_type, indices_bo,
+				     index_mode, 0, vtx_count, 0);
+}
+
+void grate_3d_draw_mesh(struct grate_3d_ctx *ctx,
+			const struct grate_mesh *mesh,
+			struct host1x_bo *indices_bo)
+{
+	/* largest multiple of a triangle that fits into INDEX_COUNT */
+	unsigned max_count = TGR3D_MAX_INDEX_COUNT / 3 * 3;
+	unsigned i, first, count;
+
+	for (i = 0; i < mesh->num_clusters; i++) {
+		const struct grate_mesh_cluster *cluster = &mesh->clusters[i];
+
+		for (first = 0; first < cluster->num_indices; first += count) {
+			count = MIN(cluster->num_indices - first, max_count);
+
+			grate_3d_draw(ctx, TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+				      indices_bo,
+				      cluster->first_index * sizeof(uint16_t),
+				      TGR3D_INDEX_MODE_UINT16,
+				      first, count, 0,
+				      cluster->first_vertex);
+		}
+	}
+}
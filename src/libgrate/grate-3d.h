@@ -1,10 +1,20 @@
 #ifndef GRATE_LIBGRATE_3D_H
 #define GRATE_LIBGRATE_3D_H 1
 
+#include <stddef.h>
 #include <stdint.h>
 
+#include "host1x.h"
+#include "list.h"
+
 #define log2_size(s)		(31 - __builtin_clz(s))
 
+/*
+ * Not described by rnndb's tgr_3d.xml yet, hence kept out of the generated
+ * tgr_3d.xml.h. Selects the 16x16 tiled layout of the texture.
+ */
+#define TGR3D_TEXTURE_DESC1_TILED	0x00000040
+
 struct host1x_bo;
 struct cgc_shader;
 
@@ -18,6 +28,26 @@ struct grate_uniform {
 	const char *name;
 };
 
+struct grate_symbol_entry {
+	uint32_t hash;
+	int position;
+	const char *name;
+};
+
+/* open addressing, built by grate_program_link() */
+struct grate_symbol_table {
+	struct grate_symbol_entry *entries;
+	unsigned mask;
+};
+
+/* bits of struct grate_uniform_handle */
+#define GRATE_UNIFORM_VALID		(1u << 31)
+#define GRATE_UNIFORM_FRAGMENT		(1u << 30)
+#define GRATE_UNIFORM_LOWP		(1u << 29)
+#define GRATE_UNIFORM_MASK_SHIFT	24
+#define GRATE_UNIFORM_MASK		(0xfu << GRATE_UNIFORM_MASK_SHIFT)
+#define GRATE_UNIFORM_SLOT_MASK		0xffffu
+
 struct grate_shader {
 	struct cgc_shader *cgc;
 	unsigned num_words;
@@ -53,6 +83,10 @@ struct grate_program {
 	struct grate_uniform *fs_uniforms;
 	unsigned num_fs_uniforms;
 
+	struct grate_symbol_table attributes_table;
+	struct grate_symbol_table vs_uniforms_table;
+	struct grate_symbol_table fs_uniforms_table;
+
 	uint32_t vs_constants[256 * 4];
 	uint32_t fs_constants[32];
 };
@@ -81,27 +115,53 @@ struct grate_texture {
 	bool min_filter_enabled;
 	bool mip_filter_enabled;
 	bool mipmap_enabled;
+
+	/* residency tracking, see grate-residency.c */
+	struct grate *grate;
+	struct list_head residency;
+	unsigned long last_use;
+	char *source_path;
+	bool pinned;
+	bool evicted;
+	struct host1x_pixelbuffer desc;
+	unsigned evicted_max_lod;
+	void *spill;
+	size_t spill_size;
+	void *mipmap_spill;
+	size_t mipmap_spill_size;
 };
 
-struct grate_3d_ctx {
-	uint32_t vs_uniforms[256 * 4];
-	uint32_t fs_uniforms[32];
+struct grate_3d_uniforms {
+	uint32_t vs[256 * 4];
+	uint32_t fs[32];
+};
 
-	struct grate *grate;
+/*
+ * Everything up to the "grate" member is the layered state, which is
+ * saved by grate_3d_ctx_push_state() and restored by the matching pop.
+ * Uniforms live out of line and are only copied once a layer writes to
+ * them, see grate_3d_ctx_own_uniforms().
+ */
+struct grate_3d_ctx {
+	/* read by every draw */
 	struct grate_program *program;
+	uint32_t *vs_uniforms;
+	uint32_t *fs_uniforms;
+	uint16_t attributes_enable_mask;
+	uint16_t render_targets_enable_mask;
+	bool guarband_enabled;
+	bool provoking_vtx_last;
+	bool tri_face_front_cw;
+	bool depth_test;
+	bool depth_write;
+	bool stencil_test;
 
+	struct grate_vtx_attribute vtx_attributes[16];
 	struct grate_render_target render_targets[16];
-	struct grate_vtx_attribute *vtx_attributes[16];
 	struct grate_texture *textures[16];
 
 	float depth_range_near;
 	float depth_range_far;
-	float point_size;
-	float point_coord_range_min_s;
-	float point_coord_range_min_t;
-	float point_coord_range_max_s;
-	float point_coord_range_max_t;
-	float line_width;
 	float viewport_x_bias;
 	float viewport_y_bias;
 	float viewport_z_bias;
@@ -110,14 +170,13 @@ struct grate_3d_ctx {
 	float viewport_z_scale;
 	float polygon_offset_units;
 	float polygon_offset_factor;
-	bool guarband_enabled;
-	bool provoking_vtx_last;
-	bool tri_face_front_cw;
-	bool depth_test;
-	bool depth_write;
-	bool stencil_test;
+	uint16_t scissor_x;
+	uint16_t scissor_y;
+	uint16_t scissor_width;
+	uint16_t scissor_heigth;
 	unsigned cull_face;
 	unsigned depth_func;
+
 	unsigned stencil_func_front;
 	unsigned stencil_fail_op_front;
 	unsigned stencil_zfail_op_front;
@@ -126,21 +185,38 @@ struct grate_3d_ctx {
 	unsigned stencil_fail_op_back;
 	unsigned stencil_zfail_op_back;
 	unsigned stencil_zpass_op_back;
+	uint8_t stencil_ref_front;
+	uint8_t stencil_ref_back;
+	uint8_t stencil_mask_front;
+	uint8_t stencil_mask_back;
+
+	float point_size;
+	float point_coord_range_min_s;
+	float point_coord_range_min_t;
+	float point_coord_range_max_s;
+	float point_coord_range_max_t;
+	float line_width;
 	uint32_t dither_unk;
 	uint32_t point_params;
 	uint32_t line_params;
-	uint16_t scissor_x;
-	uint16_t scissor_y;
-	uint16_t scissor_width;
-	uint16_t scissor_heigth;
 
-	uint16_t attributes_enable_mask;
-	uint16_t render_targets_enable_mask;
+	/* not layered */
+	struct grate *grate;
 
-	uint8_t stencil_ref_front;
-	uint8_t stencil_ref_back;
-	uint8_t stencil_mask_front;
-	uint8_t stencil_mask_back;
+	/* fence of the last submitted job */
+	uint32_t fence;
+
+	struct grate_3d_uniforms *uniforms;
+	struct grate_3d_ctx_layer *layers;
+	unsigned num_layers;
+	unsigned max_layers;
+};
+
+#define GRATE_3D_CTX_STATE_SIZE	offsetof(struct grate_3d_ctx, grate)
+
+struct grate_3d_ctx_layer {
+	struct grate_3d_ctx state;
+	struct grate_3d_uniforms *uniforms;
 };
 
 #endif
@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "grate.h"
+#include "grate-3d.h"
+
+#include "libgrate-private.h"
+
+/*
+ * Packs many small images into a few large power-of-two pages, each page
+ * is an ordinary grate_texture and can be bound like any other. Space is
+ * handed out with a bottom-left skyline per page. Every entry is framed
+ * by a gutter of padding texels that replicate its edge texels, so that
+ * bilinear filtering at the entry's border doesn't pick up its neighbours.
+ *
+ * The skyline can't reuse released space in the middle of a page, a page
+ * is only reset once it is empty. grate_atlas_compact() repacks the live
+ * entries into fresh pages with GR2D blits, entry handles stay valid but
+ * their page and UV transform change.
+ */
+
+#define ATLAS_PADDING	1
+
+struct atlas_segment {
+	unsigned x;
+	unsigned y;
+	unsigned width;
+};
+
+struct atlas_page {
+	struct grate_texture *tex;
+	struct atlas_segment *skyline;
+	unsigned num_segments;
+	unsigned num_entries;
+};
+
+struct grate_atlas_entry {
+	struct grate_atlas *atlas;
+	unsigned page;
+	unsigned x;
+	unsigned y;
+	unsigned width;
+	unsigned height;
+};
+
+struct grate_atlas {
+	struct grate *grate;
+	enum pixel_format format;
+	unsigned page_size;
+
+	struct atlas_page *pages;
+	unsigned num_pages;
+
+	struct grate_atlas_entry **entries;
+	unsigned num_entries;
+	unsigned max_entries;
+};
+
+static void atlas_page_reset(struct grate_atlas *atlas,
+			     struct atlas_page *page)
+{
+	page->skyline[0].x = 0;
+	page->skyline[0].y = 0;
+	page->skyline[0].width = atlas->page_size;
+	page->num_segments = 1;
+	page->num_entries = 0;
+}
+
+static int atlas_add_page(struct grate_atlas *atlas)
+{
+	struct atlas_page *pages, *page;
+
+	pages = realloc(atlas->pages, (atlas->num_pages + 1) * sizeof(*pages));
+	if (!pages)
+		return -ENOMEM;
+
+	atlas->pages = pages;
+	page = &pages[atlas->num_pages];
+
+	/* a skyline never has more segments than the page has columns */
+	page->skyline = malloc(atlas->page_size * sizeof(*page->skyline));
+	if (!page->skyline)
+		return -ENOMEM;
+
+	page->tex = grate_create_texture(atlas->grate, atlas->page_size,
+					 atlas->page_size, atlas->format,
+					 PIX_BUF_LAYOUT_LINEAR);
+	if (!page->tex) {
+		free(page->skyline);
+		return -ENOMEM;
+	}
+
+	/* entries are uploaded and blitted behind the texture's back */
+	page->tex->pinned = true;
+
+	grate_texture_clear(atlas->grate, page->tex, 0);
+	atlas_page_reset(atlas, page);
+	atlas->num_pages++;
+
+	return 0;
+}
+
+/* height of the skyline under [x, x + width) starting at segment i */
+static bool atlas_fit(struct grate_atlas *atlas, struct atlas_page *page,
+		      unsigned i, unsigned width, unsigned height,
+		      unsigned *y)
+{
+	unsigned x = page->skyline[i].x;
+	unsigned remaining = width;
+
+	if (x + width > atlas->page_size)
+		return false;
+
+	*y = 0;
+
+	while (remaining) {
+		*y = MAX(*y, page->skyline[i].y);
+
+		if (*y + height > atlas->page_size)
+			return false;
+
+		remaining -= MIN(remaining, page->skyline[i].width);
+		i++;
+	}
+
+	return true;
+}
+
+static bool atlas_place(struct grate_atlas *atlas, struct atlas_page *page,
+			unsigned width, unsigned height,
+			unsigned *px, unsigned *py)
+{
+	unsigned best = ~0u, best_y = ~0u, best_width = ~0u;
+	unsigned i, j, y, x, end;
+
+	for (i = 0; i < page->num_segments; i++) {
+		if (!atlas_fit(atlas, page, i, width, height, &y))
+			continue;
+
+		if (y + height < best_y ||
+		    (y + height == best_y && page->skyline[i].width < best_width)) {
+			best = i;
+			best_y = y + height;
+			best_width = page->skyline[i].width;
+		}
+	}
+
+	if (best == ~0u)
+		return false;
+
+	x = page->skyline[best].x;
+	y = best_y - height;
+	end = x + width;
+
+	/* drop or shorten the segments now hidden under the new one */
+	for (i = best; i < page->num_segments; ) {
+		struct atlas_segment *seg = &page->skyline[i];
+
+		if (seg->x >= end)
+			break;
+
+		if (seg->x + seg->width <= end) {
+			memmove(seg, seg + 1,
+				(page->num_segments - i - 1) * sizeof(*seg));
+			page->num_segments--;
+			continue;
+		}
+
+		seg->width -= end - seg->x;
+		seg->x = end;
+		break;
+	}
+
+	memmove(&page->skyline[best + 1], &page->skyline[best],
+		(page->num_segments - best) * sizeof(*page->skyline));
+	page->skyline[best].x = x;
+	page->skyline[best].y = best_y;
+	page->skyline[best].width = width;
+	page->num_segments++;
+
+	/* merge neighbours of equal height */
+	for (i = 0, j = 1; j < page->num_segments; j++) {
+		if (page->skyline[i].y == page->skyline[j].y)
+			page->skyline[i].width += page->skyline[j].width;
+		else
+			page->skyline[++i] = page->skyline[j];
+	}
+
+	page->num_segments = i + 1;
+	page->num_entries++;
+
+	*px = x;
+	*py = y;
+
+	return true;
+}
+
+static int atlas_alloc_space(struct grate_atlas *atlas,
+			     struct grate_atlas_entry *entry)
+{
+	unsigned width = entry->width + 2 * ATLAS_PADDING;
+	unsigned height = entry->height + 2 * ATLAS_PADDING;
+	unsigned i;
+	int err;
+
+	for (i = 0; i < atlas->num_pages; i++) {
+		if (atlas_place(atlas, &atlas->pages[i], width, height,
+				&entry->x, &entry->y))
+			goto placed;
+	}
+
+	err = atlas_add_page(atlas);
+	if (err)
+		return err;
+
+	if (!atlas_place(atlas, &atlas->pages[i], width, height,
+			 &entry->x, &entry->y))
+		return -ENOSPC;
+
+placed:
+	/* the entry sits inside its gutter */
+	entry->page = i;
+	entry->x += ATLAS_PADDING;
+	entry->y += ATLAS_PADDING;
+
+	return 0;
+}
+
+struct grate_atlas *grate_atlas_create(struct grate *grate,
+				       unsigned page_size,
+				       enum pixel_format format)
+{
+	struct grate_atlas *atlas;
+
+	if (page_size < 16 || page_size > 4096 ||
+	    (page_size & (page_size - 1))) {
+		grate_error("Invalid atlas page size %u\n", page_size);
+		return NULL;
+	}
+
+	if (PIX_BUF_FORMAT_COMPRESSED(format)) {
+		grate_error("Compressed atlas format 0x%08x\n", format);
+		return NULL;
+	}
+
+	atlas = calloc(1, sizeof(*atlas));
+	if (!atlas)
+		return NULL;
+
+	atlas->grate = grate;
+	atlas->format = format;
+	atlas->page_size = page_size;
+
+	return atlas;
+}
+
+struct grate_atlas_entry *grate_atlas_alloc(struct grate_atlas *atlas,
+					    unsigned width, unsigned height)
+{
+	struct grate_atlas_entry *entry, **entries;
+	unsigned max;
+
+	if (!width || !height ||
+	    width + 2 * ATLAS_PADDING > atlas->page_size ||
+	    height + 2 * ATLAS_PADDING > atlas->page_size) {
+		grate_error("Invalid atlas entry size %ux%u\n", width, height);
+		return NULL;
+	}
+
+	if (atlas->num_entries == atlas->max_entries) {
+		max = atlas->max_entries ? atlas->max_entries * 2 : 64;
+
+		entries = realloc(atlas->entries, max * sizeof(*entries));
+		if (!entries)
+			return NULL;
+
+		atlas->entries = entries;
+		atlas->max_entries = max;
+	}
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry)
+		return NULL;
+
+	entry->atlas = atlas;
+	entry->width = width;
+	entry->height = height;
+
+	if (atlas_alloc_space(atlas, entry)) {
+		grate_error("Failed to place atlas entry %ux%u\n",
+			    width, height);
+		free(entry);
+		return NULL;
+	}
+
+	atlas->entries[atlas->num_entries++] = entry;
+
+	return entry;
+}
+
+int grate_atlas_entry_upload(struct grate_atlas_entry *entry,
+			     const void *data, unsigned pitch)
+{
+	struct grate_atlas *atlas = entry->atlas;
+	struct host1x_pixelbuffer *pixbuf;
+	unsigned bpp = PIX_BUF_FORMAT_BYTES(atlas->format);
+	unsigned width = entry->width + 2 * ATLAS_PADDING;
+	unsigned height = entry->height + 2 * ATLAS_PADDING;
+	const void *src;
+	unsigned long offset;
+	void *map, *dst;
+	unsigned y, i;
+	int err;
+
+	pixbuf = atlas->pages[entry->page].tex->pixbuf;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &map);
+	if (err)
+		return err;
+
+	/* the gutter around the entry */
+	offset = pixbuf->bo->offset +
+		 (entry->y - ATLAS_PADDING) * pixbuf->pitch +
+		 (entry->x - ATLAS_PADDING) * bpp;
+
+	for (y = 0; y < entry->height; y++) {
+		dst = map + offset + (ATLAS_PADDING + y) * pixbuf->pitch;
+		src = data + y * pitch;
+
+		for (i = 0; i < ATLAS_PADDING; i++) {
+			memcpy(dst + i * bpp, src, bpp);
+			memcpy(dst + (width - 1 - i) * bpp,
+			       src + (entry->width - 1) * bpp, bpp);
+		}
+
+		memcpy(dst + ATLAS_PADDING * bpp, src, entry->width * bpp);
+	}
+
+	for (i = 0; i < ATLAS_PADDING; i++) {
+		memcpy(map + offset + i * pixbuf->pitch,
+		       map + offset + ATLAS_PADDING * pixbuf->pitch,
+		       width * bpp);
+		memcpy(map + offset + (height - 1 - i) * pixbuf->pitch,
+		       map + offset + (height - 1 - ATLAS_PADDING) *
+				      pixbuf->pitch,
+		       width * bpp);
+	}
+
+	return HOST1X_BO_FLUSH(pixbuf->bo, offset,
+			       (height - 1) * pixbuf->pitch + width * bpp);
+}
+
+struct grate_atlas_entry *grate_atlas_load(struct grate_atlas *atlas,
+					   const char *path)
+{
+	struct grate_atlas_entry *entry;
+	struct grate_image img = { 0 };
+
+	if (atlas->format != PIX_BUF_FMT_RGBA8888) {
+		grate_error("Images can only be loaded into RGBA8888 atlases\n");
+		return NULL;
+	}
+
+	if (grate_image_decode(path, atlas->format, 0, 0, &img))
+		return NULL;
+
+	entry = grate_atlas_alloc(atlas, img.width, img.height);
+	if (entry && grate_atlas_entry_upload(entry, img.data, img.pitch)) {
+		grate_atlas_release(entry);
+		entry = NULL;
+	}
+
+	grate_image_free(&img);
+
+	return entry;
+}
+
+void grate_atlas_release(struct grate_atlas_entry *entry)
+{
+	struct grate_atlas *atlas;
+	struct atlas_page *page;
+	unsigned i;
+
+	if (!entry)
+		return;
+
+	atlas = entry->atlas;
+	page = &atlas->pages[entry->page];
+
+	if (--page->num_entries == 0)
+		atlas_page_reset(atlas, page);
+
+	for (i = 0; i < atlas->num_entries; i++) {
+		if (atlas->entries[i] == entry) {
+			atlas->entries[i] = atlas->entries[--atlas->num_entries];
+			break;
+		}
+	}
+
+	free(entry);
+}
+
+struct grate_texture *
+grate_atlas_entry_texture(const struct grate_atlas_entry *entry)
+{
+	return entry->atlas->pages[entry->page].tex;
+}
+
+void grate_atlas_entry_uv(const struct grate_atlas_entry *entry,
+			  float *scale, float *offset)
+{
+	float size = entry->atlas->page_size;
+
+	/* uv' = uv * scale + offset maps [0, 1] onto the entry's texels */
+	scale[0] = entry->width / size;
+	scale[1] = entry->height / size;
+	offset[0] = entry->x / size;
+	offset[1] = entry->y / size;
+}
+
+static int atlas_compare_height(const void *a, const void *b)
+{
+	const struct grate_atlas_entry *ea = *(struct grate_atlas_entry **)a;
+	const struct grate_atlas_entry *eb = *(struct grate_atlas_entry **)b;
+
+	if (ea->height != eb->height)
+		return eb->height - ea->height;
+
+	return eb->width - ea->width;
+}
+
+struct atlas_move {
+	unsigned src_page;
+	unsigned dst_page;
+	struct host1x_gr2d_blit_rect rect;
+};
+
+static int atlas_compare_move(const void *a, const void *b)
+{
+	const struct atlas_move *ma = a;
+	const struct atlas_move *mb = b;
+
+	if (ma->src_page != mb->src_page)
+		return ma->src_page < mb->src_page ? -1 : 1;
+
+	if (ma->dst_page != mb->dst_page)
+		return ma->dst_page < mb->dst_page ? -1 : 1;
+
+	return 0;
+}
+
+/* one batch of blits per pair of old and new page */
+static int atlas_move_entries(struct grate_atlas *atlas,
+			      struct atlas_page *old_pages,
+			      struct atlas_move *moves, unsigned num_moves)
+{
+	struct host1x_gr2d *gr2d = host1x_get_gr2d(atlas->grate->host1x);
+	struct host1x_gr2d_blit_rect *rects;
+	unsigned i, j, n;
+	int err = 0;
+
+	rects = malloc(num_moves * sizeof(*rects));
+	if (!rects)
+		return -ENOMEM;
+
+	qsort(moves, num_moves, sizeof(*moves), atlas_compare_move);
+
+	for (i = 0; i < num_moves; i = j) {
+		for (j = i, n = 0; j < num_moves &&
+		     !atlas_compare_move(&moves[i], &moves[j]); j++)
+			rects[n++] = moves[j].rect;
+
+		err = host1x_gr2d_blit_rects(gr2d,
+				old_pages[moves[i].src_page].tex->pixbuf,
+				atlas->pages[moves[i].dst_page].tex->pixbuf,
+				rects, n);
+		if (err)
+			break;
+	}
+
+	free(rects);
+
+	return err;
+}
+
+static void atlas_free_pages(struct atlas_page *pages, unsigned num_pages)
+{
+	unsigned i;
+
+	for (i = 0; i < num_pages; i++) {
+		grate_texture_free(pages[i].tex);
+		free(pages[i].skyline);
+	}
+
+	free(pages);
+}
+
+int grate_atlas_compact(struct grate_atlas *atlas)
+{
+	struct atlas_page *old_pages = atlas->pages;
+	unsigned num_old_pages = atlas->num_pages;
+	struct grate_atlas_entry *entry, *old;
+	struct atlas_move *moves;
+	unsigned i, placed = 0;
+	int err = 0;
+
+	if (!atlas->num_entries)
+		return 0;
+
+	old = malloc(atlas->num_entries * sizeof(*old));
+	if (!old)
+		return -ENOMEM;
+
+	moves = malloc(atlas->num_entries * sizeof(*moves));
+	if (!moves) {
+		free(old);
+		return -ENOMEM;
+	}
+
+	atlas->pages = NULL;
+	atlas->num_pages = 0;
+
+	/* tallest first packs a skyline best */
+	qsort(atlas->entries, atlas->num_entries, sizeof(*atlas->entries),
+	      atlas_compare_height);
+
+	for (placed = 0; placed < atlas->num_entries; placed++) {
+		old[placed] = *atlas->entries[placed];
+
+		err = atlas_alloc_space(atlas, atlas->entries[placed]);
+		if (err)
+			goto restore;
+	}
+
+	/* the gutters move along with the entries */
+	for (i = 0; i < atlas->num_entries; i++) {
+		entry = atlas->entries[i];
+
+		moves[i].src_page = old[i].page;
+		moves[i].dst_page = entry->page;
+		moves[i].rect.sx = old[i].x - ATLAS_PADDING;
+		moves[i].rect.sy = old[i].y - ATLAS_PADDING;
+		moves[i].rect.dx = entry->x - ATLAS_PADDING;
+		moves[i].rect.dy = entry->y - ATLAS_PADDING;
+		moves[i].rect.width = entry->width + 2 * ATLAS_PADDING;
+		moves[i].rect.height = entry->height + 2 * ATLAS_PADDING;
+	}
+
+	err = atlas_move_entries(atlas, old_pages, moves, atlas->num_entries);
+	if (err)
+		goto restore;
+
+	grate_info("compacted %u entries from %u into %u pages\n",
+		   atlas->num_entries, num_old_pages, atlas->num_pages);
+
+	atlas_free_pages(old_pages, num_old_pages);
+	free(moves);
+	free(old);
+
+	return 0;
+
+restore:
+	grate_error("Atlas compaction failed: %d\n", err);
+
+	for (i = 0; i < placed; i++)
+		*atlas->entries[i] = old[i];
+
+	atlas_free_pages(atlas->pages, atlas->num_pages);
+	atlas->pages = old_pages;
+	atlas->num_pages = num_old_pages;
+	free(moves);
+	free(old);
+
+	return err;
+}
+
+void grate_atlas_free(struct grate_atlas *atlas)
+{
+	unsigned i;
+
+	if (!atlas)
+		return;
+
+	for (i = 0; i < atlas->num_entries; i++)
+		free(atlas->entries[i]);
+
+	atlas_free_pages(atlas->pages, atlas->num_pages);
+	free(atlas->entries);
+	free(atlas);
+}
@@ -0,0 +1,274 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdbool.h>
+
+#include "grate.h"
+
+#include "libgrate-private.h"
+
+/*
+ * Damage tracking for GRATE_DAMAGE_TRACKED framebuffers. The application
+ * reports which regions it redrew since the last swap, the regions are
+ * merged into a few rectangles and only those are presented and copied
+ * back into the new back buffer, so that both buffers stay identical.
+ *
+ * Every rectangle costs a GR2D operation and a separate upload on the
+ * display side, so rectangles are merged as long as that doesn't pull in
+ * more than GRATE_DAMAGE_MERGE_SLACK undamaged pixels.
+ */
+
+#define GRATE_DAMAGE_MERGE_SLACK	4096
+
+static unsigned long rect_area(const struct host1x_gr2d_rect *r)
+{
+	return (unsigned long)r->width * r->height;
+}
+
+static void rect_union(const struct host1x_gr2d_rect *a,
+		       const struct host1x_gr2d_rect *b,
+		       struct host1x_gr2d_rect *u)
+{
+	unsigned int x0 = a->x < b->x ? a->x : b->x;
+	unsigned int y0 = a->y < b->y ? a->y : b->y;
+	unsigned int x1 = a->x + a->width;
+	unsigned int y1 = a->y + a->height;
+
+	if (b->x + b->width > x1)
+		x1 = b->x + b->width;
+	if (b->y + b->height > y1)
+		y1 = b->y + b->height;
+
+	u->x = x0;
+	u->y = y0;
+	u->width = x1 - x0;
+	u->height = y1 - y0;
+}
+
+static unsigned long rect_overlap(const struct host1x_gr2d_rect *a,
+				  const struct host1x_gr2d_rect *b)
+{
+	unsigned int x0 = a->x > b->x ? a->x : b->x;
+	unsigned int y0 = a->y > b->y ? a->y : b->y;
+	unsigned int x1 = a->x + a->width;
+	unsigned int y1 = a->y + a->height;
+
+	if (b->x + b->width < x1)
+		x1 = b->x + b->width;
+	if (b->y + b->height < y1)
+		y1 = b->y + b->height;
+
+	if (x1 <= x0 || y1 <= y0)
+		return 0;
+
+	return (unsigned long)(x1 - x0) * (y1 - y0);
+}
+
+/* number of undamaged pixels that merging a and b would add */
+static unsigned long merge_cost(const struct host1x_gr2d_rect *a,
+				const struct host1x_gr2d_rect *b)
+{
+	struct host1x_gr2d_rect u;
+
+	rect_union(a, b, &u);
+
+	return rect_area(&u) - rect_area(a) - rect_area(b) +
+	       rect_overlap(a, b);
+}
+
+static void damage_add(struct grate_damage *damage,
+		       const struct host1x_gr2d_rect *rect)
+{
+	struct host1x_gr2d_rect r = *rect;
+	unsigned long cost, best = ~0ul;
+	unsigned int i, j, bi = 0, bj = 0;
+
+restart:
+	for (i = 0; i < damage->num_rects; i++) {
+		if (merge_cost(&damage->rects[i], &r) <=
+		    GRATE_DAMAGE_MERGE_SLACK) {
+			rect_union(&damage->rects[i], &r, &r);
+			damage->rects[i] = damage->rects[--damage->num_rects];
+			goto restart;
+		}
+	}
+
+	if (damage->num_rects < GRATE_DAMAGE_MAX_RECTS) {
+		damage->rects[damage->num_rects++] = r;
+		return;
+	}
+
+	/*
+	 * Out of slots, merge the cheapest pair. Index num_rects stands for
+	 * the new rectangle.
+	 */
+	for (i = 0; i < damage->num_rects; i++) {
+		for (j = i + 1; j <= damage->num_rects; j++) {
+			if (j == damage->num_rects)
+				cost = merge_cost(&damage->rects[i], &r);
+			else
+				cost = merge_cost(&damage->rects[i],
+						  &damage->rects[j]);
+
+			if (cost < best) {
+				best = cost;
+				bi = i;
+				bj = j;
+			}
+		}
+	}
+
+	if (bj == damage->num_rects) {
+		rect_union(&damage->rects[bi], &r, &damage->rects[bi]);
+	} else {
+		rect_union(&damage->rects[bi], &damage->rects[bj],
+			   &damage->rects[bi]);
+		damage->rects[bj] = r;
+	}
+}
+
+void grate_framebuffer_damage(struct grate_framebuffer *fb,
+			      unsigned int x, unsigned int y,
+			      unsigned int width, unsigned int height)
+{
+	struct host1x_pixelbuffer *pixbuf = fb->front->pixbuf;
+	struct grate_damage *damage = &fb->damage;
+	struct host1x_gr2d_rect r;
+	unsigned int i;
+
+	if (!(fb->flags & GRATE_DAMAGE_TRACKED) || damage->full)
+		return;
+
+	if (x >= pixbuf->width || y >= pixbuf->height || !width || !height)
+		return;
+
+	r.x = x;
+	r.y = y;
+	r.width = width < pixbuf->width - x ? width : pixbuf->width - x;
+	r.height = height < pixbuf->height - y ? height : pixbuf->height - y;
+
+	damage_add(damage, &r);
+
+	for (i = 0; i < damage->num_rects; i++) {
+		if (damage->rects[i].width == pixbuf->width &&
+		    damage->rects[i].height == pixbuf->height) {
+			grate_framebuffer_damage_all(fb);
+			break;
+		}
+	}
+}
+
+void grate_framebuffer_damage_all(struct grate_framebuffer *fb)
+{
+	fb->damage.num_rects = 0;
+	fb->damage.full = true;
+}
+
+bool grate_framebuffer_damaged(struct grate_framebuffer *fb)
+{
+	if (!(fb->flags & GRATE_DAMAGE_TRACKED))
+		return true;
+
+	return fb->damage.full || fb->damage.num_rects;
+}
+
+/* returns NULL if the whole framebuffer needs to be presented */
+const struct host1x_gr2d_rect *
+grate_framebuffer_get_damage(struct grate_framebuffer *fb,
+			     unsigned int *count)
+{
+	if (!(fb->flags & GRATE_DAMAGE_TRACKED) || fb->damage.full) {
+		*count = 0;
+		return NULL;
+	}
+
+	*count = fb->damage.num_rects;
+
+	return fb->damage.rects;
+}
+
+static unsigned int damage_blits(const struct grate_damage *damage,
+				 struct host1x_gr2d_blit_rect *blits)
+{
+	unsigned int i;
+
+	for (i = 0; i < damage->num_rects; i++) {
+		blits[i].sx = blits[i].dx = damage->rects[i].x;
+		blits[i].sy = blits[i].dy = damage->rects[i].y;
+		blits[i].width = damage->rects[i].width;
+		blits[i].height = damage->rects[i].height;
+	}
+
+	return i;
+}
+
+/*
+ * Called once the swapped framebuffer was presented: brings the new back
+ * buffer up to date with the front and starts a new damage frame. With
+ * triple buffering the new back buffer is two frames old, so the damage
+ * of the previous frame is copied as well.
+ */
+void grate_framebuffer_sync_damage(struct grate_framebuffer *fb)
+{
+	struct host1x_gr2d_blit_rect blits[2 * GRATE_DAMAGE_MAX_RECTS];
+	struct grate_damage *damage = &fb->damage;
+	struct grate_damage *prev = &fb->prev_damage;
+	struct host1x_pixelbuffer *src, *dst;
+	struct host1x_gr2d *gr2d;
+	unsigned int count = 0;
+	int err;
+
+	if (!(fb->flags & GRATE_DAMAGE_TRACKED))
+		return;
+
+	if (fb->back) {
+		gr2d = host1x_get_gr2d(fb->grate->host1x);
+		src = fb->front->pixbuf;
+		dst = fb->back->pixbuf;
+
+		if (damage->full || (fb->spare && prev->full)) {
+			blits[0].sx = blits[0].dx = 0;
+			blits[0].sy = blits[0].dy = 0;
+			blits[0].width = src->width;
+			blits[0].height = src->height;
+			count = 1;
+		} else {
+			count = damage_blits(damage, blits);
+
+			if (fb->spare)
+				count += damage_blits(prev, blits + count);
+		}
+
+		if (count) {
+			err = host1x_gr2d_blit_rects(gr2d, src, dst, blits,
+						     count);
+			if (err < 0)
+				grate_error("host1x_gr2d_blit_rects() failed: %d\n",
+					    err);
+		}
+	}
+
+	*prev = *damage;
+	damage->num_rects = 0;
+	damage->full = false;
+}
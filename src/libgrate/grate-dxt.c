@@ -0,0 +1,741 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DXT_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define DXT_SSE2 1
+#endif
+
+#include "libgrate-private.h"
+
+/*
+ * BC1/BC2/BC3 (DXT1/3/5) block encoder for RGBA8888 images.
+ *
+ * Endpoints start from the extremes of the block along its principal
+ * axis and are refined once by least squares. Pixels are matched against
+ * the decoded palette, the distances of all 16 pixels to a palette entry
+ * are computed at once with SSE2 / NEON. Block rows are spread across
+ * threads.
+ */
+
+#define DXT_MAX_THREADS	16
+
+struct dxt_block {
+	int16_t r[16];
+	int16_t g[16];
+	int16_t b[16];
+	uint8_t a[16];
+};
+
+struct dxt_job {
+	const uint8_t *src;
+	unsigned width;
+	unsigned height;
+	unsigned src_pitch;
+	enum pixel_format format;
+	uint8_t *dst;
+	unsigned dst_pitch;
+	unsigned next_row;
+};
+
+static inline int div255(int x)
+{
+	return (x + 128 + ((x + 128) >> 8)) >> 8;
+}
+
+static inline void put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static inline void put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v);
+	put_le16(p + 2, v >> 16);
+}
+
+static void dxt_load_block(const uint8_t *src, unsigned pitch,
+			   unsigned w, unsigned h, struct dxt_block *blk)
+{
+	unsigned x, y, i;
+
+	/* pixels past the edge replicate the last valid row / column */
+	for (y = 0, i = 0; y < 4; y++) {
+		const uint8_t *row = src + MIN(y, h - 1) * pitch;
+
+		for (x = 0; x < 4; x++, i++) {
+			const uint8_t *p = row + MIN(x, w - 1) * 4;
+
+			blk->r[i] = p[0];
+			blk->g[i] = p[1];
+			blk->b[i] = p[2];
+			blk->a[i] = p[3];
+		}
+	}
+}
+
+static uint16_t dxt_pack565(const int *c)
+{
+	return (div255(c[0] * 31) << 11) | (div255(c[1] * 63) << 5) |
+		div255(c[2] * 31);
+}
+
+static void dxt_unpack565(uint16_t v, int *c)
+{
+	int r = (v >> 11) & 0x1f, g = (v >> 5) & 0x3f, b = v & 0x1f;
+
+	c[0] = (r << 3) | (r >> 2);
+	c[1] = (g << 2) | (g >> 4);
+	c[2] = (b << 3) | (b >> 2);
+}
+
+static void dxt_palette(uint16_t c0, uint16_t c1, bool four, int pal[4][3])
+{
+	unsigned i;
+
+	dxt_unpack565(c0, pal[0]);
+	dxt_unpack565(c1, pal[1]);
+
+	for (i = 0; i < 3; i++) {
+		if (four) {
+			pal[2][i] = (2 * pal[0][i] + pal[1][i]) / 3;
+			pal[3][i] = (pal[0][i] + 2 * pal[1][i]) / 3;
+		} else {
+			pal[2][i] = (pal[0][i] + pal[1][i]) / 2;
+			pal[3][i] = 0;
+		}
+	}
+}
+
+/*
+ * Picks the nearest of num_colors palette entries for every pixel, ties
+ * go to the lowest index. Returns the summed squared error of the pixels
+ * in mask.
+ */
+static uint32_t dxt_match(const struct dxt_block *blk, int pal[4][3],
+			  unsigned num_colors, uint16_t mask,
+			  uint32_t *indices)
+{
+	uint32_t dist[16], idx[16];
+	uint32_t err = 0, bits = 0;
+	unsigned i, k;
+
+#if defined(DXT_SSE2)
+	__m128i zero = _mm_setzero_si128();
+	__m128i best[4], index[4];
+
+	for (i = 0; i < 4; i++) {
+		best[i] = _mm_set1_epi32(0x7fffffff);
+		index[i] = zero;
+	}
+
+	for (k = 0; k < num_colors; k++) {
+		__m128i pr = _mm_set1_epi16(pal[k][0]);
+		__m128i pg = _mm_set1_epi16(pal[k][1]);
+		__m128i pb = _mm_set1_epi16(pal[k][2]);
+		__m128i kk = _mm_set1_epi32(k);
+
+		for (i = 0; i < 2; i++) {
+			__m128i dr, dg, db, rg, bz, d, lt;
+			unsigned j;
+
+			dr = _mm_sub_epi16(_mm_loadu_si128((const void *)&blk->r[i * 8]), pr);
+			dg = _mm_sub_epi16(_mm_loadu_si128((const void *)&blk->g[i * 8]), pg);
+			db = _mm_sub_epi16(_mm_loadu_si128((const void *)&blk->b[i * 8]), pb);
+
+			for (j = 0; j < 2; j++) {
+				if (j == 0) {
+					rg = _mm_unpacklo_epi16(dr, dg);
+					bz = _mm_unpacklo_epi16(db, zero);
+				} else {
+					rg = _mm_unpackhi_epi16(dr, dg);
+					bz = _mm_unpackhi_epi16(db, zero);
+				}
+
+				d = _mm_add_epi32(_mm_madd_epi16(rg, rg),
+						  _mm_madd_epi16(bz, bz));
+				lt = _mm_cmplt_epi32(d, best[i * 2 + j]);
+
+				best[i * 2 + j] = _mm_or_si128(_mm_and_si128(lt, d),
+						_mm_andnot_si128(lt, best[i * 2 + j]));
+				index[i * 2 + j] = _mm_or_si128(_mm_and_si128(lt, kk),
+						_mm_andnot_si128(lt, index[i * 2 + j]));
+			}
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		_mm_storeu_si128((void *)&dist[i * 4], best[i]);
+		_mm_storeu_si128((void *)&idx[i * 4], index[i]);
+	}
+#elif defined(DXT_NEON)
+	uint32x4_t best[4], index[4];
+
+	for (i = 0; i < 4; i++) {
+		best[i] = vdupq_n_u32(0xffffffff);
+		index[i] = vdupq_n_u32(0);
+	}
+
+	for (k = 0; k < num_colors; k++) {
+		uint32x4_t kk = vdupq_n_u32(k);
+
+		for (i = 0; i < 2; i++) {
+			int16x8_t dr = vsubq_s16(vld1q_s16(&blk->r[i * 8]),
+						 vdupq_n_s16(pal[k][0]));
+			int16x8_t dg = vsubq_s16(vld1q_s16(&blk->g[i * 8]),
+						 vdupq_n_s16(pal[k][1]));
+			int16x8_t db = vsubq_s16(vld1q_s16(&blk->b[i * 8]),
+						 vdupq_n_s16(pal[k][2]));
+			int32x4_t d0, d1;
+			uint32x4_t lt0, lt1;
+
+			d0 = vmull_s16(vget_low_s16(dr), vget_low_s16(dr));
+			d1 = vmull_s16(vget_high_s16(dr), vget_high_s16(dr));
+			d0 = vmlal_s16(d0, vget_low_s16(dg), vget_low_s16(dg));
+			d1 = vmlal_s16(d1, vget_high_s16(dg), vget_high_s16(dg));
+			d0 = vmlal_s16(d0, vget_low_s16(db), vget_low_s16(db));
+			d1 = vmlal_s16(d1, vget_high_s16(db), vget_high_s16(db));
+
+			lt0 = vcltq_u32(vreinterpretq_u32_s32(d0), best[i * 2]);
+			lt1 = vcltq_u32(vreinterpretq_u32_s32(d1), best[i * 2 + 1]);
+
+			best[i * 2] = vbslq_u32(lt0, vreinterpretq_u32_s32(d0),
+						best[i * 2]);
+			best[i * 2 + 1] = vbslq_u32(lt1, vreinterpretq_u32_s32(d1),
+						    best[i * 2 + 1]);
+			index[i * 2] = vbslq_u32(lt0, kk, index[i * 2]);
+			index[i * 2 + 1] = vbslq_u32(lt1, kk, index[i * 2 + 1]);
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		vst1q_u32(&dist[i * 4], best[i]);
+		vst1q_u32(&idx[i * 4], index[i]);
+	}
+#else
+	for (i = 0; i < 16; i++) {
+		dist[i] = ~0u;
+		idx[i] = 0;
+
+		for (k = 0; k < num_colors; k++) {
+			int dr = blk->r[i] - pal[k][0];
+			int dg = blk->g[i] - pal[k][1];
+			int db = blk->b[i] - pal[k][2];
+			uint32_t d = dr * dr + dg * dg + db * db;
+
+			if (d < dist[i]) {
+				dist[i] = d;
+				idx[i] = k;
+			}
+		}
+	}
+#endif
+
+	for (i = 0; i < 16; i++) {
+		if (!(mask & (1u << i)))
+			continue;
+
+		err += dist[i];
+		bits |= idx[i] << (i * 2);
+	}
+
+	*indices = bits;
+
+	return err;
+}
+
+/* extremes of the pixels in mask along their principal axis */
+static void dxt_fit_endpoints(const struct dxt_block *blk, uint16_t mask,
+			      int e0[3], int e1[3])
+{
+	float mean[3] = { 0.0f }, cov[6] = { 0.0f }, axis[3];
+	float proj, min = 1e30f, max = -1e30f;
+	unsigned i, n = 0, imin = 0, imax = 0;
+	int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+
+	for (i = 0; i < 16; i++) {
+		if (!(mask & (1u << i)))
+			continue;
+
+		mean[0] += blk->r[i];
+		mean[1] += blk->g[i];
+		mean[2] += blk->b[i];
+
+		lo[0] = MIN(lo[0], blk->r[i]);
+		lo[1] = MIN(lo[1], blk->g[i]);
+		lo[2] = MIN(lo[2], blk->b[i]);
+		hi[0] = MAX(hi[0], blk->r[i]);
+		hi[1] = MAX(hi[1], blk->g[i]);
+		hi[2] = MAX(hi[2], blk->b[i]);
+		n++;
+	}
+
+	for (i = 0; i < 3; i++)
+		mean[i] /= n;
+
+	for (i = 0; i < 16; i++) {
+		float r, g, b;
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		r = blk->r[i] - mean[0];
+		g = blk->g[i] - mean[1];
+		b = blk->b[i] - mean[2];
+
+		cov[0] += r * r;
+		cov[1] += r * g;
+		cov[2] += r * b;
+		cov[3] += g * g;
+		cov[4] += g * b;
+		cov[5] += b * b;
+	}
+
+	/* power iteration, seeded with the bounding box diagonal */
+	axis[0] = hi[0] - lo[0];
+	axis[1] = hi[1] - lo[1];
+	axis[2] = hi[2] - lo[2];
+
+	for (i = 0; i < 4; i++) {
+		float x = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+		float y = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+		float z = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+		float m = MAX(MAX(x < 0 ? -x : x, y < 0 ? -y : y),
+			      z < 0 ? -z : z);
+
+		if (m < 1e-6f)
+			break;
+
+		axis[0] = x / m;
+		axis[1] = y / m;
+		axis[2] = z / m;
+	}
+
+	for (i = 0; i < 16; i++) {
+		if (!(mask & (1u << i)))
+			continue;
+
+		proj = blk->r[i] * axis[0] + blk->g[i] * axis[1] +
+		       blk->b[i] * axis[2];
+
+		if (proj < min) {
+			min = proj;
+			imin = i;
+		}
+
+		if (proj > max) {
+			max = proj;
+			imax = i;
+		}
+	}
+
+	e0[0] = blk->r[imax];
+	e0[1] = blk->g[imax];
+	e0[2] = blk->b[imax];
+	e1[0] = blk->r[imin];
+	e1[1] = blk->g[imin];
+	e1[2] = blk->b[imin];
+}
+
+/* least squares endpoints for the given indices, false if degenerate */
+static bool dxt_refine(const struct dxt_block *blk, uint16_t mask,
+		       uint32_t indices, bool four, int e0[3], int e1[3])
+{
+	static const float weights4[4] = { 1.0f, 0.0f, 2.0f / 3, 1.0f / 3 };
+	static const float weights3[4] = { 1.0f, 0.0f, 0.5f, 0.0f };
+	const float *weights = four ? weights4 : weights3;
+	float aa = 0, ab = 0, bb = 0, ap[3] = { 0 }, bp[3] = { 0 };
+	float det, v;
+	unsigned i, c;
+
+	for (i = 0; i < 16; i++) {
+		float a, b;
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		a = weights[(indices >> (i * 2)) & 3];
+		b = 1.0f - a;
+
+		aa += a * a;
+		ab += a * b;
+		bb += b * b;
+
+		ap[0] += a * blk->r[i];
+		ap[1] += a * blk->g[i];
+		ap[2] += a * blk->b[i];
+		bp[0] += b * blk->r[i];
+		bp[1] += b * blk->g[i];
+		bp[2] += b * blk->b[i];
+	}
+
+	det = aa * bb - ab * ab;
+	if (det < 1e-6f && det > -1e-6f)
+		return false;
+
+	for (c = 0; c < 3; c++) {
+		v = (ap[c] * bb - bp[c] * ab) / det + 0.5f;
+		e0[c] = v < 0 ? 0 : v > 255 ? 255 : (int)v;
+
+		v = (bp[c] * aa - ap[c] * ab) / det + 0.5f;
+		e1[c] = v < 0 ? 0 : v > 255 ? 255 : (int)v;
+	}
+
+	return true;
+}
+
+static uint32_t dxt_try_endpoints(const struct dxt_block *blk, uint16_t mask,
+				  bool four, const int e0[3], const int e1[3],
+				  uint16_t *c0, uint16_t *c1,
+				  uint32_t *indices)
+{
+	int pal[4][3];
+
+	*c0 = dxt_pack565(e0);
+	*c1 = dxt_pack565(e1);
+
+	dxt_palette(*c0, *c1, four, pal);
+
+	return dxt_match(blk, pal, four ? 4 : 3, mask, indices);
+}
+
+static void dxt_encode_color(const struct dxt_block *blk, bool punchthrough,
+			     uint8_t *out)
+{
+	uint16_t transparent = 0, mask, c0, c1, r0, r1, tmp;
+	uint32_t indices, refined, err, refined_err, swapped;
+	bool four;
+	int e0[3], e1[3];
+	unsigned i;
+
+	if (punchthrough) {
+		for (i = 0; i < 16; i++) {
+			if (blk->a[i] < 128)
+				transparent |= 1u << i;
+		}
+	}
+
+	if (transparent == 0xffff) {
+		put_le16(out + 0, 0);
+		put_le16(out + 2, 0);
+		put_le32(out + 4, 0xffffffff);
+		return;
+	}
+
+	mask = ~transparent;
+	four = !transparent;
+
+	dxt_fit_endpoints(blk, mask, e0, e1);
+	err = dxt_try_endpoints(blk, mask, four, e0, e1, &c0, &c1, &indices);
+
+	if (err && dxt_refine(blk, mask, indices, four, e0, e1)) {
+		refined_err = dxt_try_endpoints(blk, mask, four, e0, e1,
+						&r0, &r1, &refined);
+		if (refined_err < err) {
+			c0 = r0;
+			c1 = r1;
+			indices = refined;
+		}
+	}
+
+	/* four colour mode needs c0 > c1, three colour mode c0 <= c1 */
+	if ((four && c0 < c1) || (!four && c0 > c1)) {
+		tmp = c0;
+		c0 = c1;
+		c1 = tmp;
+
+		for (i = 0, swapped = 0; i < 16; i++) {
+			uint32_t idx = (indices >> (i * 2)) & 3;
+
+			if (idx < 2 || four)
+				idx ^= 1;
+
+			swapped |= idx << (i * 2);
+		}
+
+		indices = swapped;
+	}
+
+	if (four && c0 == c1)
+		indices = 0;
+
+	for (i = 0; i < 16; i++) {
+		if (transparent & (1u << i))
+			indices |= 3u << (i * 2);
+	}
+
+	put_le16(out + 0, c0);
+	put_le16(out + 2, c1);
+	put_le32(out + 4, indices);
+}
+
+static void dxt_encode_alpha_explicit(const struct dxt_block *blk,
+				      uint8_t *out)
+{
+	unsigned i;
+
+	for (i = 0; i < 16; i += 2)
+		out[i / 2] = div255(blk->a[i] * 15) |
+			     div255(blk->a[i + 1] * 15) << 4;
+}
+
+static void dxt_encode_alpha_interpolated(const struct dxt_block *blk,
+					  uint8_t *out)
+{
+	static const uint8_t remap[8] = { 0, 2, 3, 4, 5, 6, 7, 1 };
+	uint8_t min = 255, max = 0;
+	uint64_t bits = 0;
+	unsigned i, j;
+
+	for (i = 0; i < 16; i++) {
+		min = MIN(min, blk->a[i]);
+		max = MAX(max, blk->a[i]);
+	}
+
+	/* eight alpha mode, index 0 is max and 1 is min */
+	if (max > min) {
+		for (i = 0; i < 16; i++) {
+			j = ((max - blk->a[i]) * 7 + (max - min) / 2) /
+			    (max - min);
+			bits |= (uint64_t)remap[j] << (i * 3);
+		}
+	}
+
+	out[0] = max;
+	out[1] = min;
+
+	for (i = 0; i < 6; i++)
+		out[2 + i] = bits >> (i * 8);
+}
+
+static void dxt_encode_row(const struct dxt_job *job, unsigned y)
+{
+	unsigned block_size = job->format == PIX_BUF_FMT_DXT1 ? 8 : 16;
+	uint8_t *out = job->dst + (y / 4) * job->dst_pitch;
+	unsigned h = MIN(job->height - y, 4);
+	struct dxt_block blk;
+	unsigned x;
+
+	for (x = 0; x < job->width; x += 4, out += block_size) {
+		dxt_load_block(job->src + y * job->src_pitch + x * 4,
+			       job->src_pitch, MIN(job->width - x, 4), h,
+			       &blk);
+
+		switch (job->format) {
+		case PIX_BUF_FMT_DXT1:
+			dxt_encode_color(&blk, true, out);
+			break;
+		case PIX_BUF_FMT_DXT3:
+			dxt_encode_alpha_explicit(&blk, out);
+			dxt_encode_color(&blk, false, out + 8);
+			break;
+		default:
+			dxt_encode_alpha_interpolated(&blk, out);
+			dxt_encode_color(&blk, false, out + 8);
+			break;
+		}
+	}
+}
+
+static void *dxt_worker(void *arg)
+{
+	struct dxt_job *job = arg;
+	unsigned y;
+
+	while (true) {
+		y = __atomic_fetch_add(&job->next_row, 4, __ATOMIC_RELAXED);
+		if (y >= job->height)
+			break;
+
+		dxt_encode_row(job, y);
+	}
+
+	return NULL;
+}
+
+int grate_dxt_encode(const void *src, unsigned width, unsigned height,
+		     unsigned src_pitch, enum pixel_format format,
+		     void *dst, unsigned dst_pitch, unsigned num_threads)
+{
+	pthread_t threads[DXT_MAX_THREADS];
+	struct dxt_job job;
+	unsigned started = 0, i;
+
+	switch (format) {
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		break;
+	default:
+		grate_error("Invalid format 0x%08x\n", format);
+		return -1;
+	}
+
+	if (width == 0 || height == 0)
+		return 0;
+
+	job.src = src;
+	job.width = width;
+	job.height = height;
+	job.src_pitch = src_pitch;
+	job.format = format;
+	job.dst = dst;
+	job.dst_pitch = dst_pitch;
+	job.next_row = 0;
+
+	if (num_threads == 0)
+		num_threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+
+	num_threads = MIN(num_threads, DXT_MAX_THREADS);
+	num_threads = MIN(num_threads, (height + 3) / 4);
+
+	/* the calling thread encodes too */
+	while (started + 1 < num_threads) {
+		if (pthread_create(&threads[started], NULL, dxt_worker, &job))
+			break;
+
+		started++;
+	}
+
+	dxt_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	return 0;
+}
+
+static inline uint16_t get_le16(const uint8_t *p)
+{
+	return p[0] | p[1] << 8;
+}
+
+static void dxt_decode_color(const uint8_t *in, bool dxt1, uint8_t *out)
+{
+	uint16_t c0 = get_le16(in), c1 = get_le16(in + 2);
+	uint32_t bits = get_le16(in + 4) | (uint32_t)get_le16(in + 6) << 16;
+	bool four = !dxt1 || c0 > c1;
+	int pal[4][3];
+	unsigned i, j;
+
+	dxt_palette(c0, c1, four, pal);
+
+	for (i = 0; i < 16; i++, out += 4) {
+		j = (bits >> (i * 2)) & 3;
+
+		out[0] = pal[j][0];
+		out[1] = pal[j][1];
+		out[2] = pal[j][2];
+		out[3] = (!four && j == 3) ? 0 : 255;
+	}
+}
+
+static void dxt_decode_alpha_explicit(const uint8_t *in, uint8_t *out)
+{
+	unsigned i;
+
+	for (i = 0; i < 16; i++)
+		out[i * 4 + 3] = ((in[i / 2] >> ((i & 1) * 4)) & 0xf) * 17;
+}
+
+static void dxt_decode_alpha_interpolated(const uint8_t *in, uint8_t *out)
+{
+	uint64_t bits = 0;
+	uint8_t pal[8];
+	unsigned i;
+
+	pal[0] = in[0];
+	pal[1] = in[1];
+
+	if (in[0] > in[1]) {
+		for (i = 2; i < 8; i++)
+			pal[i] = ((8 - i) * in[0] + (i - 1) * in[1]) / 7;
+	} else {
+		for (i = 2; i < 6; i++)
+			pal[i] = ((6 - i) * in[0] + (i - 1) * in[1]) / 5;
+
+		pal[6] = 0;
+		pal[7] = 255;
+	}
+
+	for (i = 0; i < 6; i++)
+		bits |= (uint64_t)in[2 + i] << (i * 8);
+
+	for (i = 0; i < 16; i++)
+		out[i * 4 + 3] = pal[(bits >> (i * 3)) & 7];
+}
+
+/* the inverse of grate_dxt_encode(), producing RGBA8888 */
+int grate_dxt_decode(const void *src, unsigned width, unsigned height,
+		     unsigned src_pitch, enum pixel_format format,
+		     void *dst, unsigned dst_pitch)
+{
+	unsigned block_size = format == PIX_BUF_FMT_DXT1 ? 8 : 16;
+	uint8_t texels[16 * 4];
+	unsigned x, y, i;
+
+	switch (format) {
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		break;
+	default:
+		grate_error("Invalid format 0x%08x\n", format);
+		return -1;
+	}
+
+	for (y = 0; y < height; y += 4) {
+		const uint8_t *in = (const uint8_t *)src + (y / 4) * src_pitch;
+
+		for (x = 0; x < width; x += 4, in += block_size) {
+			switch (format) {
+			case PIX_BUF_FMT_DXT1:
+				dxt_decode_color(in, true, texels);
+				break;
+			case PIX_BUF_FMT_DXT3:
+				dxt_decode_color(in + 8, false, texels);
+				dxt_decode_alpha_explicit(in, texels);
+				break;
+			default:
+				dxt_decode_color(in + 8, false, texels);
+				dxt_decode_alpha_interpolated(in, texels);
+				break;
+			}
+
+			for (i = 0; i < MIN(height - y, 4); i++)
+				memcpy((uint8_t *)dst + (y + i) * dst_pitch +
+				       x * 4, &texels[i * 16],
+				       MIN(width - x, 4) * 4);
+		}
+	}
+
+	return 0;
+}
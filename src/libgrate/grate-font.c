@@ -22,6 +22,7 @@
 
 #define _GNU_SOURCE
 
+#include <errno.h>
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
@@ -54,6 +55,8 @@ struct grate_font {
 	struct host1x_bo *uv_bo;
 	float *vertices;
 	float *uv;
+	int position_loc;
+	int texcoord_loc;
 };
 
 static const char *vs_asm = "					\n\
@@ -172,6 +175,14 @@ struct grate_font *grate_create_font(struct grate *grate,
 	if (!texture)
 		return NULL;
 
+	/* the layout code reads the texture size at any time */
+	if (grate_texture_make_resident(texture)) {
+		grate_texture_free(texture);
+		return NULL;
+	}
+
+	texture->pinned = true;
+
 	font= calloc(1, sizeof(*font));
 	if (!font)
 		return NULL;
@@ -221,10 +232,49 @@ struct grate_font *grate_create_font(struct grate *grate,
 	font->uv = map + MAX_CHARS * 32;
 	font->texture = texture;
 	font->program = program;
+	font->position_loc = grate_get_attribute_location(program, "position");
+	font->texcoord_loc = grate_get_attribute_location(program, "texcoord");
 
 	return font;
 }
 
+static void font_bind_state(struct grate_3d_ctx *ctx,
+			    struct grate_font *font,
+			    unsigned render_target,
+			    struct host1x_pixelbuffer *fb_pixbuf,
+			    struct host1x_bo *vertices_bo,
+			    struct host1x_bo *uv_bo)
+{
+	unsigned i;
+
+	grate_3d_ctx_perform_depth_test(ctx, false);
+	grate_3d_ctx_perform_depth_write(ctx, false);
+	grate_3d_ctx_perform_stencil_test(ctx, false);
+	grate_3d_ctx_set_cull_face(ctx, GRATE_3D_CTX_CULL_FACE_NONE);
+	grate_3d_ctx_bind_program(ctx, font->program);
+
+	for (i = 0; i < 16; i++) {
+		grate_3d_ctx_disable_vertex_attrib_array(ctx, i);
+		grate_3d_ctx_disable_render_target(ctx, i);
+		grate_3d_ctx_bind_texture(ctx, i, NULL);
+	}
+
+	grate_3d_ctx_vertex_attrib_float_pointer(ctx, font->position_loc,
+						 2, vertices_bo);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, font->position_loc);
+
+	grate_3d_ctx_vertex_attrib_float_pointer(ctx, font->texcoord_loc,
+						 2, uv_bo);
+	grate_3d_ctx_enable_vertex_attrib_array(ctx, font->texcoord_loc);
+
+	grate_3d_ctx_bind_texture(ctx, 0, font->texture);
+	grate_texture_set_wrap_t(font->texture, GRATE_TEXTURE_MIRRORED_REPEAT);
+	grate_texture_set_mag_filter(font->texture, GRATE_TEXTURE_LINEAR);
+
+	grate_3d_ctx_bind_render_target(ctx, render_target, fb_pixbuf);
+	grate_3d_ctx_enable_render_target(ctx, render_target);
+}
+
 void grate_3d_printf(struct grate *grate,
 		     const struct grate_3d_ctx *ctx,
 		     struct grate_font *font,
@@ -234,10 +284,11 @@ void grate_3d_printf(struct grate *grate,
 {
 	struct host1x_pixelbuffer *fb_pixbuf;
 	struct host1x_pixelbuffer *tex_pixbuf;
+	struct grate_3d_uniforms uniforms;
 	struct grate_3d_ctx ctx_copy;
 	struct character *ch;
 	va_list ap;
-	unsigned code, chars_nb, chars_nb_to_draw = 0, location, i;
+	unsigned code, chars_nb, chars_nb_to_draw = 0, i;
 	float left, right, top, bottom, tex_w, tex_h, fb_w, fb_h, orig_x = x;
 	char *text = NULL;
 	int offt, ret;
@@ -262,35 +313,20 @@ void grate_3d_printf(struct grate *grate,
 		goto out;
 	}
 
+	/*
+	 * The caller's context stays untouched, the copy gets uniforms of
+	 * its own and no state layers. Binding the font program fills them.
+	 */
 	ctx_copy = *ctx;
-	grate_3d_ctx_perform_depth_test(&ctx_copy, false);
-	grate_3d_ctx_perform_depth_write(&ctx_copy, false);
-	grate_3d_ctx_perform_stencil_test(&ctx_copy, false);
-	grate_3d_ctx_set_cull_face(&ctx_copy, GRATE_3D_CTX_CULL_FACE_NONE);
-	grate_3d_ctx_bind_program(&ctx_copy, font->program);
-
-	for (i = 0; i < 16; i++) {
-		grate_3d_ctx_disable_vertex_attrib_array(&ctx_copy, i);
-		grate_3d_ctx_disable_render_target(&ctx_copy, i);
-		grate_3d_ctx_bind_texture(&ctx_copy, i, NULL);
-	}
-
-	location = grate_get_attribute_location(font->program, "position");
-	grate_3d_ctx_vertex_attrib_float_pointer(&ctx_copy, location,
-						 2, font->vertices_bo);
-	grate_3d_ctx_enable_vertex_attrib_array(&ctx_copy, location);
+	ctx_copy.uniforms = &uniforms;
+	ctx_copy.vs_uniforms = uniforms.vs;
+	ctx_copy.fs_uniforms = uniforms.fs;
+	ctx_copy.layers = NULL;
+	ctx_copy.num_layers = 0;
+	ctx_copy.max_layers = 0;
 
-	location = grate_get_attribute_location(font->program, "texcoord");
-	grate_3d_ctx_vertex_attrib_float_pointer(&ctx_copy, location,
-						 2, font->uv_bo);
-	grate_3d_ctx_enable_vertex_attrib_array(&ctx_copy, location);
-
-	grate_3d_ctx_bind_texture(&ctx_copy, 0, font->texture);
-	grate_texture_set_wrap_t(font->texture, GRATE_TEXTURE_MIRRORED_REPEAT);
-	grate_texture_set_mag_filter(font->texture, GRATE_TEXTURE_LINEAR);
-
-	grate_3d_ctx_bind_render_target(&ctx_copy, render_target, fb_pixbuf);
-	grate_3d_ctx_enable_render_target(&ctx_copy, render_target);
+	font_bind_state(&ctx_copy, font, render_target, fb_pixbuf,
+			font->vertices_bo, font->uv_bo);
 
 	fb_w = fb_pixbuf->width;
 	fb_h = fb_pixbuf->height;
@@ -379,6 +415,501 @@ void grate_3d_printf(struct grate *grate,
 
 		chars_nb_to_draw = 0;
 	}
+
 out:
 	free(text);
 }
+
+/*
+ * Text batches collect the glyphs of many strings per frame and draw them
+ * with a single job per font on flush. Glyph quads are laid out in font
+ * pixels relative to the pen origin and cached per (font, string), so that
+ * static labels only pay for the transform into NDC on subsequent frames.
+ */
+
+#define TEXT_CACHE_BUCKETS	256
+#define TEXT_CACHE_MAX_AGE	60
+#define TEXT_BATCH_MAX_GLYPHS	(65536 / 4)
+/* a draw takes at most 4096 indices, i.e. 682 whole glyphs */
+#define TEXT_BATCH_DRAW_INDICES	(4096 / 6 * 6)
+
+struct text_layout {
+	struct text_layout *next;
+	struct grate_font *font;
+	uint32_t hash;
+	char *text;
+	unsigned num_glyphs;
+	unsigned last_used;
+	float *vertices;
+	float *uv;
+};
+
+struct text_batch_font {
+	struct grate_font *font;
+	float *vertices;
+	float *uv;
+	unsigned num_glyphs;
+};
+
+struct grate_text_batch {
+	struct grate_stream_ring *ring;
+	struct host1x_bo *indices_bo;
+	unsigned max_glyphs;
+
+	struct grate_3d_ctx *ctx;
+	struct host1x_pixelbuffer *fb_pixbuf;
+	unsigned render_target;
+
+	struct text_batch_font *fonts;
+	unsigned num_fonts;
+
+	struct text_layout *cache[TEXT_CACHE_BUCKETS];
+	unsigned frame;
+};
+
+static uint32_t text_hash(const struct grate_font *font, const char *text)
+{
+	uint32_t hash = 2166136261u ^ (uint32_t)(uintptr_t)font;
+
+	while (*text) {
+		hash ^= (uint8_t)*text++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static unsigned text_count_glyphs(const char *text)
+{
+	unsigned count = 0;
+
+	for (; *text; text++) {
+		if (*text != '\n' && *text != ' ')
+			count++;
+	}
+
+	return count;
+}
+
+static struct text_layout *text_layout_create(struct grate_font *font,
+					      const char *text,
+					      uint32_t hash)
+{
+	struct host1x_pixelbuffer *tex_pixbuf = font->texture->pixbuf;
+	float tex_w = tex_pixbuf->width, tex_h = tex_pixbuf->height;
+	float left, right, top, bottom;
+	struct text_layout *layout;
+	struct character *ch;
+	float *vtx, *uv;
+	int pen_x = 0, pen_y = 0;
+	unsigned code;
+
+	layout = calloc(1, sizeof(*layout));
+	if (!layout)
+		return NULL;
+
+	layout->num_glyphs = text_count_glyphs(text);
+	layout->text = strdup(text);
+	layout->vertices = malloc(layout->num_glyphs * 8 * sizeof(float));
+	layout->uv = malloc(layout->num_glyphs * 8 * sizeof(float));
+
+	if (!layout->text || (layout->num_glyphs &&
+			      (!layout->vertices || !layout->uv))) {
+		free(layout->vertices);
+		free(layout->uv);
+		free(layout->text);
+		free(layout);
+		return NULL;
+	}
+
+	layout->font = font;
+	layout->hash = hash;
+
+	vtx = layout->vertices;
+	uv = layout->uv;
+
+	for (; *text; text++) {
+		code = (uint8_t)*text;
+
+		if (code == '\n') {
+			pen_y -= font->ch[' '].orig_height;
+			pen_x = 0;
+			continue;
+		}
+
+		if (code == ' ') {
+			pen_x += font->ch[' '].orig_width;
+			continue;
+		}
+
+		ch = &font->ch[code > 127 ? '?' : code];
+
+		left   = ch->pos_x / tex_w;
+		right  = ch->width / tex_w + left;
+		top    = ch->pos_y / tex_h;
+		bottom = ch->height / tex_h + top;
+
+		uv[0] = left;
+		uv[1] = 1.0f - top;
+		uv[2] = right;
+		uv[3] = 1.0f - top;
+		uv[4] = right;
+		uv[5] = 1.0f - bottom;
+		uv[6] = left;
+		uv[7] = 1.0f - bottom;
+		uv += 8;
+
+		left   = pen_x + ch->off_x;
+		right  = left + ch->width;
+		top    = pen_y + (int)(ch->orig_height - ch->off_y - ch->height);
+		bottom = top + ch->height;
+
+		vtx[0] = left;
+		vtx[1] = bottom;
+		vtx[2] = right;
+		vtx[3] = bottom;
+		vtx[4] = right;
+		vtx[5] = top;
+		vtx[6] = left;
+		vtx[7] = top;
+		vtx += 8;
+
+		pen_x += ch->orig_width;
+	}
+
+	return layout;
+}
+
+static void text_layout_free(struct text_layout *layout)
+{
+	free(layout->vertices);
+	free(layout->uv);
+	free(layout->text);
+	free(layout);
+}
+
+static struct text_layout *text_batch_lookup(struct grate_text_batch *batch,
+					     struct grate_font *font,
+					     const char *text)
+{
+	uint32_t hash = text_hash(font, text);
+	struct text_layout **bucket = &batch->cache[hash % TEXT_CACHE_BUCKETS];
+	struct text_layout *layout;
+
+	for (layout = *bucket; layout; layout = layout->next) {
+		if (layout->hash == hash && layout->font == font &&
+		    !strcmp(layout->text, text))
+			goto out;
+	}
+
+	layout = text_layout_create(font, text, hash);
+	if (!layout)
+		return NULL;
+
+	layout->next = *bucket;
+	*bucket = layout;
+out:
+	layout->last_used = batch->frame;
+
+	return layout;
+}
+
+static void text_batch_expire(struct grate_text_batch *batch)
+{
+	struct text_layout **link, *layout;
+	unsigned i;
+
+	for (i = 0; i < TEXT_CACHE_BUCKETS; i++) {
+		link = &batch->cache[i];
+
+		while ((layout = *link)) {
+			if (batch->frame - layout->last_used < TEXT_CACHE_MAX_AGE) {
+				link = &layout->next;
+				continue;
+			}
+
+			*link = layout->next;
+			text_layout_free(layout);
+		}
+	}
+}
+
+static struct text_batch_font *text_batch_get_font(struct grate_text_batch *batch,
+						   struct grate_font *font)
+{
+	struct text_batch_font *fonts;
+	unsigned i;
+
+	for (i = 0; i < batch->num_fonts; i++) {
+		if (batch->fonts[i].font == font)
+			return &batch->fonts[i];
+	}
+
+	fonts = realloc(batch->fonts, (batch->num_fonts + 1) * sizeof(*fonts));
+	if (!fonts)
+		return NULL;
+
+	batch->fonts = fonts;
+	fonts = &fonts[batch->num_fonts];
+
+	fonts->vertices = malloc(batch->max_glyphs * 8 * sizeof(float));
+	fonts->uv = malloc(batch->max_glyphs * 8 * sizeof(float));
+	if (!fonts->vertices || !fonts->uv) {
+		free(fonts->vertices);
+		free(fonts->uv);
+		return NULL;
+	}
+
+	fonts->font = font;
+	fonts->num_glyphs = 0;
+	batch->num_fonts++;
+
+	return fonts;
+}
+
+struct grate_text_batch *grate_text_batch_create(struct grate *grate,
+						 unsigned max_glyphs)
+{
+	struct grate_text_batch *batch;
+	uint16_t *indices;
+	void *map;
+	unsigned i;
+
+	if (max_glyphs == 0 || max_glyphs > TEXT_BATCH_MAX_GLYPHS) {
+		grate_error("Invalid number of glyphs %u\n", max_glyphs);
+		return NULL;
+	}
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return NULL;
+
+	batch->max_glyphs = max_glyphs;
+
+	/* vertices and texcoords of a few frames in flight */
+	batch->ring = grate_stream_ring_create(grate, max_glyphs * 64 * 3,
+					       NVHOST_BO_FLAG_ATTRIBUTES);
+	if (!batch->ring)
+		goto err_free;
+
+	batch->indices_bo = grate_bo_create_and_map(grate,
+						    NVHOST_BO_FLAG_ATTRIBUTES,
+						    max_glyphs * 12, &map);
+	if (!batch->indices_bo)
+		goto err_free_ring;
+
+	indices = map;
+
+	for (i = 0; i < max_glyphs; i++) {
+		indices[0 + i * 6] = 0 + i * 4;
+		indices[1 + i * 6] = 1 + i * 4;
+		indices[2 + i * 6] = 2 + i * 4;
+		indices[3 + i * 6] = 0 + i * 4;
+		indices[4 + i * 6] = 2 + i * 4;
+		indices[5 + i * 6] = 3 + i * 4;
+	}
+
+	HOST1X_BO_FLUSH(batch->indices_bo, batch->indices_bo->offset,
+			max_glyphs * 12);
+
+	return batch;
+
+err_free_ring:
+	grate_stream_ring_free(batch->ring);
+err_free:
+	free(batch);
+
+	return NULL;
+}
+
+void grate_text_batch_begin(struct grate_text_batch *batch,
+			    struct grate_3d_ctx *ctx,
+			    unsigned render_target)
+{
+	unsigned i;
+
+	batch->ctx = ctx;
+	batch->render_target = render_target;
+	batch->fb_pixbuf = NULL;
+
+	if (render_target < 16)
+		batch->fb_pixbuf = ctx->render_targets[render_target].pixbuf;
+
+	for (i = 0; i < batch->num_fonts; i++)
+		batch->fonts[i].num_glyphs = 0;
+}
+
+int grate_text_batch_add(struct grate_text_batch *batch,
+			 struct grate_font *font,
+			 float x, float y, float scale,
+			 const char *text)
+{
+	struct text_batch_font *bf;
+	struct text_layout *layout;
+	const float *src;
+	float sx, sy, *dst;
+	unsigned i;
+
+	if (!batch->fb_pixbuf) {
+		grate_error("Invalid render target %u\n", batch->render_target);
+		return -EINVAL;
+	}
+
+	layout = text_batch_lookup(batch, font, text);
+	if (!layout)
+		return -ENOMEM;
+
+	if (layout->num_glyphs == 0)
+		return 0;
+
+	bf = text_batch_get_font(batch, font);
+	if (!bf)
+		return -ENOMEM;
+
+	if (bf->num_glyphs + layout->num_glyphs > batch->max_glyphs)
+		return -ENOSPC;
+
+	sx = scale / batch->fb_pixbuf->width;
+	sy = scale / batch->fb_pixbuf->height;
+
+	src = layout->vertices;
+	dst = bf->vertices + bf->num_glyphs * 8;
+
+	for (i = 0; i < layout->num_glyphs * 4; i++) {
+		dst[i * 2 + 0] = x + src[i * 2 + 0] * sx;
+		dst[i * 2 + 1] = y + src[i * 2 + 1] * sy;
+	}
+
+	memcpy(bf->uv + bf->num_glyphs * 8, layout->uv,
+	       layout->num_glyphs * 8 * sizeof(float));
+
+	bf->num_glyphs += layout->num_glyphs;
+
+	return 0;
+}
+
+int grate_text_batch_printf(struct grate_text_batch *batch,
+			    struct grate_font *font,
+			    float x, float y, float scale,
+			    const char *fmt, ...)
+{
+	char buf[256], *text = buf;
+	va_list ap;
+	int ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (ret < 0)
+		return ret;
+
+	if (ret >= (int)sizeof(buf)) {
+		va_start(ap, fmt);
+		ret = vasprintf(&text, fmt, ap);
+		va_end(ap);
+
+		if (ret < 0)
+			return -ENOMEM;
+	}
+
+	ret = grate_text_batch_add(batch, font, x, y, scale, text);
+
+	if (text != buf)
+		free(text);
+
+	return ret;
+}
+
+int grate_text_batch_flush(struct grate_text_batch *batch)
+{
+	struct grate_3d_ctx *ctx = batch->ctx;
+	struct host1x_bo *vertices_bo, *uv_bo;
+	struct text_batch_font *bf;
+	unsigned first, count;
+	size_t size;
+	void *map;
+	unsigned i;
+	int err = 0;
+
+	for (i = 0; i < batch->num_fonts; i++) {
+		bf = &batch->fonts[i];
+
+		if (bf->num_glyphs == 0)
+			continue;
+
+		size = bf->num_glyphs * 8 * sizeof(float);
+
+		vertices_bo = grate_stream_ring_alloc(batch->ring, size, 32, &map);
+		if (!vertices_bo) {
+			err = -ENOMEM;
+			break;
+		}
+
+		memcpy(map, bf->vertices, size);
+		grate_stream_ring_commit(batch->ring, vertices_bo, size);
+
+		uv_bo = grate_stream_ring_alloc(batch->ring, size, 32, &map);
+		if (!uv_bo) {
+			err = -ENOMEM;
+			break;
+		}
+
+		memcpy(map, bf->uv, size);
+		grate_stream_ring_commit(batch->ring, uv_bo, size);
+
+		if (grate_3d_ctx_push_state(ctx)) {
+			err = -ENOMEM;
+			break;
+		}
+
+		font_bind_state(ctx, bf->font, batch->render_target,
+				batch->fb_pixbuf, vertices_bo, uv_bo);
+
+		count = bf->num_glyphs * 6;
+
+		for (first = 0; first < count; first += TEXT_BATCH_DRAW_INDICES)
+			grate_3d_draw_elements_range(ctx,
+					TGR3D_PRIMITIVE_TYPE_TRIANGLES,
+					batch->indices_bo,
+					TGR3D_INDEX_MODE_UINT16, first,
+					MIN(count - first,
+					    TEXT_BATCH_DRAW_INDICES), 0);
+
+		grate_3d_ctx_pop_state(ctx);
+		grate_stream_ring_fence(batch->ring, ctx);
+
+		bf->num_glyphs = 0;
+	}
+
+	batch->frame++;
+	text_batch_expire(batch);
+
+	return err;
+}
+
+void grate_text_batch_free(struct grate_text_batch *batch)
+{
+	struct text_layout *layout;
+	unsigned i;
+
+	if (!batch)
+		return;
+
+	for (i = 0; i < TEXT_CACHE_BUCKETS; i++) {
+		while ((layout = batch->cache[i])) {
+			batch->cache[i] = layout->next;
+			text_layout_free(layout);
+		}
+	}
+
+	for (i = 0; i < batch->num_fonts; i++) {
+		free(batch->fonts[i].vertices);
+		free(batch->fonts[i].uv);
+	}
+
+	grate_stream_ring_free(batch->ring);
+	host1x_bo_free(batch->indices_bo);
+	free(batch->fonts);
+	free(batch);
+}
@@ -0,0 +1,549 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+
+#include "libgrate-private.h"
+#include "tgr_3d.xml.h"
+
+/*
+ * Linear-speed vertex cache optimisation, see Tom Forsyth's
+ * "Linear-Speed Vertex Cache Optimisation". The modelled LRU cache is
+ * larger than the actual post-transform cache, that is intended.
+ */
+#define VCACHE_SIZE		32
+#define VCACHE_DECAY_POWER	1.5f
+#define VCACHE_LAST_TRI_SCORE	0.75f
+#define VALENCE_BOOST_SCALE	2.0f
+#define VALENCE_BOOST_POWER	0.5f
+
+struct vcache_vertex {
+	unsigned first_tri;
+	unsigned num_tris;
+	unsigned active_tris;
+	int cache_pos;
+	float score;
+};
+
+static float vcache_vertex_score(const struct vcache_vertex *v)
+{
+	float score = 0.0f;
+
+	if (v->active_tris == 0)
+		return -1.0f;
+
+	if (v->cache_pos >= 0) {
+		if (v->cache_pos < 3) {
+			score = VCACHE_LAST_TRI_SCORE;
+		} else {
+			score = 1.0f - (v->cache_pos - 3) *
+					(1.0f / (VCACHE_SIZE - 3));
+			score = powf(score, VCACHE_DECAY_POWER);
+		}
+	}
+
+	score += VALENCE_BOOST_SCALE *
+		 powf(v->active_tris, -VALENCE_BOOST_POWER);
+
+	return score;
+}
+
+int grate_optimize_indices(uint16_t *indices, unsigned num_indices,
+			   unsigned num_vertices)
+{
+	unsigned num_triangles = num_indices / 3;
+	struct vcache_vertex *verts = NULL;
+	unsigned *vtx_tris = NULL;
+	uint16_t *output = NULL;
+	float *tri_scores = NULL;
+	bool *tri_emitted = NULL;
+	int cache[VCACHE_SIZE + 3];
+	int new_cache[VCACHE_SIZE + 3];
+	unsigned emitted, scan = 0;
+	int best_tri = -1;
+	unsigned i, k;
+	int err = -ENOMEM;
+
+	if (num_indices % 3) {
+		grate_error("Invalid number of indices %u\n", num_indices);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num_indices; i++) {
+		if (indices[i] >= num_vertices) {
+			grate_error("Index %u out of range: %u >= %u\n",
+				    i, indices[i], num_vertices);
+			return -EINVAL;
+		}
+	}
+
+	verts = calloc(num_vertices, sizeof(*verts));
+	vtx_tris = malloc(num_indices * sizeof(*vtx_tris));
+	output = malloc(num_indices * sizeof(*output));
+	tri_scores = malloc(num_triangles * sizeof(*tri_scores));
+	tri_emitted = calloc(num_triangles, sizeof(*tri_emitted));
+
+	if (!verts || !vtx_tris || !output || !tri_scores || !tri_emitted)
+		goto out;
+
+	for (i = 0; i < num_indices; i++)
+		verts[indices[i]].num_tris++;
+
+	for (i = 0, k = 0; i < num_vertices; i++) {
+		verts[i].first_tri = k;
+		verts[i].cache_pos = -1;
+		k += verts[i].num_tris;
+	}
+
+	for (i = 0; i < num_indices; i++) {
+		struct vcache_vertex *v = &verts[indices[i]];
+
+		vtx_tris[v->first_tri + v->active_tris++] = i / 3;
+	}
+
+	for (i = 0; i < num_vertices; i++)
+		verts[i].score = vcache_vertex_score(&verts[i]);
+
+	for (i = 0; i < num_triangles; i++) {
+		tri_scores[i] = verts[indices[i * 3 + 0]].score +
+				verts[indices[i * 3 + 1]].score +
+				verts[indices[i * 3 + 2]].score;
+
+		if (best_tri < 0 || tri_scores[i] > tri_scores[best_tri])
+			best_tri = i;
+	}
+
+	for (i = 0; i < VCACHE_SIZE + 3; i++)
+		cache[i] = -1;
+
+	for (emitted = 0; emitted < num_triangles; emitted++) {
+		unsigned n = 0;
+
+		if (best_tri < 0) {
+			/* nothing in the cache is connected, take next one */
+			while (tri_emitted[scan])
+				scan++;
+
+			best_tri = scan;
+		}
+
+		tri_emitted[best_tri] = true;
+
+		/* emit, move the triangle vertices to the cache front */
+		for (k = 0; k < 3; k++) {
+			unsigned idx = indices[best_tri * 3 + k];
+			struct vcache_vertex *v = &verts[idx];
+			unsigned j;
+
+			output[emitted * 3 + k] = idx;
+
+			for (j = v->first_tri;
+			     j < v->first_tri + v->active_tris; j++) {
+				if (vtx_tris[j] == (unsigned)best_tri) {
+					vtx_tris[j] = vtx_tris[v->first_tri +
+							       v->active_tris - 1];
+					break;
+				}
+			}
+
+			v->active_tris--;
+
+			if (n == 0 || new_cache[n - 1] != (int)idx)
+				if (n < 2 || new_cache[n - 2] != (int)idx)
+					new_cache[n++] = idx;
+		}
+
+		for (i = 0; i < VCACHE_SIZE + 3 && cache[i] >= 0; i++) {
+			int idx = cache[i];
+
+			if (idx == new_cache[0] ||
+			    (n > 1 && idx == new_cache[1]) ||
+			    (n > 2 && idx == new_cache[2]))
+				continue;
+
+			if (n < VCACHE_SIZE + 3) {
+				new_cache[n++] = idx;
+			} else {
+				verts[idx].cache_pos = -1;
+				verts[idx].score = vcache_vertex_score(&verts[idx]);
+			}
+		}
+
+		/* rescore everything that is still cached */
+		best_tri = -1;
+
+		for (i = 0; i < VCACHE_SIZE + 3; i++) {
+			cache[i] = i < n ? new_cache[i] : -1;
+
+			if (cache[i] < 0)
+				continue;
+
+			verts[cache[i]].cache_pos = i < VCACHE_SIZE ? (int)i : -1;
+			verts[cache[i]].score = vcache_vertex_score(&verts[cache[i]]);
+		}
+
+		for (i = 0; i < n; i++) {
+			struct vcache_vertex *v = &verts[cache[i]];
+			unsigned j;
+
+			for (j = v->first_tri;
+			     j < v->first_tri + v->active_tris; j++) {
+				unsigned t = vtx_tris[j];
+
+				tri_scores[t] = verts[indices[t * 3 + 0]].score +
+						verts[indices[t * 3 + 1]].score +
+						verts[indices[t * 3 + 2]].score;
+
+				if (best_tri < 0 ||
+				    tri_scores[t] > tri_scores[best_tri])
+					best_tri = t;
+			}
+		}
+
+		/* vertices pushed out of the cache */
+		for (i = VCACHE_SIZE; i < n; i++)
+			cache[i] = -1;
+	}
+
+	memcpy(indices, output, num_indices * sizeof(*indices));
+	err = 0;
+out:
+	free(tri_emitted);
+	free(tri_scores);
+	free(output);
+	free(vtx_tris);
+	free(verts);
+
+	return err;
+}
+
+/*
+ * Directed edge lookup for the stripifier, the neighbour across the edge
+ * (a, b) of a consistently wound triangle owns the directed edge (b, a).
+ */
+struct strip_edge {
+	uint32_t key;
+	unsigned tri;
+};
+
+/* every key is valid, no triangle has this index */
+#define STRIP_EDGE_EMPTY	~0u
+
+static uint32_t strip_edge_key(uint16_t a, uint16_t b)
+{
+	return (uint32_t)a << 16 | b;
+}
+
+static unsigned strip_edge_hash(uint32_t key, unsigned mask)
+{
+	return (key * 2654435761u) & mask;
+}
+
+static int strip_edge_find(const struct strip_edge *edges, unsigned mask,
+			   const bool *used, uint16_t a, uint16_t b)
+{
+	uint32_t key = strip_edge_key(a, b);
+	unsigned h = strip_edge_hash(key, mask);
+
+	for (; edges[h].tri != STRIP_EDGE_EMPTY; h = (h + 1) & mask) {
+		if (edges[h].key == key && !used[edges[h].tri])
+			return edges[h].tri;
+	}
+
+	return -1;
+}
+
+static int strip_push(uint16_t **strip, unsigned *len, unsigned *size,
+		      uint16_t idx)
+{
+	uint16_t *tmp;
+
+	if (*len == *size) {
+		*size = *size ? *size * 2 : 64;
+
+		tmp = realloc(*strip, *size * sizeof(*tmp));
+		if (!tmp)
+			return -ENOMEM;
+
+		*strip = tmp;
+	}
+
+	(*strip)[(*len)++] = idx;
+
+	return 0;
+}
+
+static uint16_t strip_third(const uint16_t *tri, uint16_t a, uint16_t b)
+{
+	unsigned k;
+
+	for (k = 0; k < 3; k++) {
+		if (tri[k] != a && tri[k] != b)
+			return tri[k];
+	}
+
+	return tri[0];
+}
+
+/*
+ * GR3D has no primitive restart, strips are joined with degenerate
+ * triangles instead. Triangle order of the input is preserved as much as
+ * possible, so running grate_optimize_indices() first is worthwhile.
+ */
+int grate_indices_to_strip(const uint16_t *indices, unsigned num_indices,
+			   uint16_t **stripp)
+{
+	unsigned num_triangles = num_indices / 3;
+	struct strip_edge *edges;
+	uint16_t *strip = NULL;
+	unsigned len = 0, size = 0;
+	unsigned mask, i, k;
+	bool *used;
+	int err = -ENOMEM;
+
+	if (num_indices == 0 || num_indices % 3) {
+		grate_error("Invalid number of indices %u\n", num_indices);
+		return -EINVAL;
+	}
+
+	for (mask = 1; mask < num_indices * 2; mask <<= 1)
+		;
+
+	edges = malloc(mask * sizeof(*edges));
+	used = calloc(num_triangles, sizeof(*used));
+	if (!edges || !used)
+		goto out;
+
+	for (i = 0; i < mask; i++)
+		edges[i].tri = STRIP_EDGE_EMPTY;
+
+	mask -= 1;
+
+	for (i = 0; i < num_triangles; i++) {
+		const uint16_t *tri = &indices[i * 3];
+
+		for (k = 0; k < 3; k++) {
+			uint32_t key = strip_edge_key(tri[k], tri[(k + 1) % 3]);
+			unsigned h = strip_edge_hash(key, mask);
+
+			while (edges[h].tri != STRIP_EDGE_EMPTY)
+				h = (h + 1) & mask;
+
+			edges[h].key = key;
+			edges[h].tri = i;
+		}
+	}
+
+	for (i = 0; i < num_triangles; i++) {
+		const uint16_t *tri = &indices[i * 3];
+		unsigned start = len, rot = 0;
+		uint16_t a, b, c;
+		int next;
+
+		if (used[i])
+			continue;
+
+		used[i] = true;
+
+		/* start rotated such that the strip can be continued */
+		for (k = 0; k < 3; k++) {
+			if (strip_edge_find(edges, mask, used,
+					    tri[(k + 2) % 3],
+					    tri[(k + 1) % 3]) >= 0) {
+				rot = k;
+				break;
+			}
+		}
+
+		a = tri[rot];
+		b = tri[(rot + 1) % 3];
+		c = tri[(rot + 2) % 3];
+
+		if (len) {
+			/* stitch and keep the winding of even triangles */
+			err  = strip_push(&strip, &len, &size, strip[len - 1]);
+			err |= strip_push(&strip, &len, &size, a);
+			if (len & 1)
+				err |= strip_push(&strip, &len, &size, a);
+			if (err)
+				goto out;
+
+			start = len;
+		}
+
+		err  = strip_push(&strip, &len, &size, a);
+		err |= strip_push(&strip, &len, &size, b);
+		err |= strip_push(&strip, &len, &size, c);
+		if (err)
+			goto out;
+
+		for (;;) {
+			a = strip[len - 2];
+			b = strip[len - 1];
+
+			/* odd triangles are wound backwards */
+			if ((len - start) & 1)
+				next = strip_edge_find(edges, mask, used, b, a);
+			else
+				next = strip_edge_find(edges, mask, used, a, b);
+
+			if (next < 0)
+				break;
+
+			used[next] = true;
+
+			err = strip_push(&strip, &len, &size,
+					 strip_third(&indices[next * 3], a, b));
+			if (err)
+				goto out;
+		}
+	}
+
+	*stripp = strip;
+	strip = NULL;
+	err = len;
+out:
+	free(strip);
+	free(used);
+	free(edges);
+
+	return err;
+}
+
+unsigned grate_indices_count_transforms(const uint16_t *indices,
+					unsigned num_indices,
+					unsigned cache_size)
+{
+	int cache[VCACHE_SIZE];
+	unsigned misses = 0;
+	unsigned head = 0;
+	unsigned i, k;
+
+	cache_size = MIN(cache_size, VCACHE_SIZE);
+
+	for (i = 0; i < cache_size; i++)
+		cache[i] = -1;
+
+	/* FIFO post-transform cache model */
+	for (i = 0; i < num_indices; i++) {
+		for (k = 0; k < cache_size; k++) {
+			if (cache[k] == indices[i])
+				break;
+		}
+
+		if (k < cache_size)
+			continue;
+
+		cache[head] = indices[i];
+		head = (head + 1) % cache_size;
+		misses++;
+	}
+
+	return misses;
+}
+
+int grate_optimize_index_bo(struct host1x_bo *bo, unsigned index_mode,
+			    unsigned num_indices, unsigned num_vertices,
+			    bool strip)
+{
+	unsigned bytes = index_mode == TGR3D_INDEX_MODE_UINT8 ? 1 : 2;
+	uint16_t *indices, *strip_indices = NULL;
+	unsigned count = num_indices;
+	void *map;
+	unsigned i;
+	int err;
+
+	switch (index_mode) {
+	case TGR3D_INDEX_MODE_UINT8:
+	case TGR3D_INDEX_MODE_UINT16:
+		break;
+	default:
+		grate_error("Invalid index buffer mode: %u\n", index_mode);
+		return -EINVAL;
+	}
+
+	if (num_indices * bytes > bo->size) {
+		grate_error("Indices don't fit BO: %u > %zu\n",
+			    num_indices * bytes, bo->size);
+		return -EINVAL;
+	}
+
+	err = HOST1X_BO_MMAP(bo, &map);
+	if (err)
+		return err;
+
+	err = HOST1X_BO_INVALIDATE(bo, bo->offset, num_indices * bytes);
+	if (err)
+		return err;
+
+	map += bo->offset;
+
+	indices = malloc(num_indices * sizeof(*indices));
+	if (!indices)
+		return -ENOMEM;
+
+	for (i = 0; i < num_indices; i++)
+		indices[i] = bytes == 1 ? ((uint8_t *)map)[i] :
+					  ((uint16_t *)map)[i];
+
+	err = grate_optimize_indices(indices, num_indices, num_vertices);
+	if (err)
+		goto out;
+
+	if (strip) {
+		err = grate_indices_to_strip(indices, num_indices,
+					     &strip_indices);
+		if (err < 0)
+			goto out;
+
+		count = err;
+
+		if (count * bytes > bo->size) {
+			grate_error("Strip doesn't fit BO: %u > %zu\n",
+				    count * bytes, bo->size);
+			err = -ENOSPC;
+			goto out;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		uint16_t idx = strip ? strip_indices[i] : indices[i];
+
+		if (bytes == 1)
+			((uint8_t *)map)[i] = idx;
+		else
+			((uint16_t *)map)[i] = idx;
+	}
+
+	err = HOST1X_BO_FLUSH(bo, bo->offset, count * bytes);
+	if (err)
+		goto out;
+
+	err = count;
+out:
+	free(strip_indices);
+	free(indices);
+
+	return err;
+}
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Asynchronous texture loading. Decoding, format conversion and
+ * compression run on a pool of worker threads shared by all requests of
+ * a grate instance. The upload touches host1x and hence happens on the
+ * thread that waits for the request.
+ */
+
+#define LOADER_MAX_THREADS	8
+
+static pthread_mutex_t grate_loader_create_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct grate_texture_request {
+	struct grate_texture_request *next;
+	struct grate *grate;
+	char *path;
+	enum pixel_format format;
+	enum layout_format layout;
+	struct grate_image image;
+	bool cancelled;
+	bool done;
+	int err;
+};
+
+struct grate_loader {
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+
+	struct grate_texture_request *head;
+	struct grate_texture_request *tail;
+
+	pthread_t threads[LOADER_MAX_THREADS];
+	unsigned num_threads;
+	bool quit;
+};
+
+static int grate_loader_process(struct grate_texture_request *req)
+{
+	struct grate_texture_key key;
+	bool cacheable;
+	int err;
+
+	cacheable = !grate_texture_cache_key(req->grate, req->path,
+					     req->format, req->layout, 0,
+					     0, 0, &key);
+	if (cacheable && !grate_texture_cache_load(req->grate, &key,
+						   &req->image))
+		return 0;
+
+	err = grate_image_decode(req->path, req->format, 0, 0, &req->image);
+	if (err)
+		return err;
+
+	/* the pool is parallel already, don't fan out per request */
+	err = grate_image_compress(&req->image, req->format, 1);
+	if (err)
+		return err;
+
+	if (cacheable)
+		grate_texture_cache_store(req->grate, &key, &req->image);
+
+	return 0;
+}
+
+static void grate_texture_request_release(struct grate_texture_request *req)
+{
+	grate_image_free(&req->image);
+	free(req->path);
+	free(req);
+}
+
+static void *grate_loader_worker(void *arg)
+{
+	struct grate_loader *loader = arg;
+	struct grate_texture_request *req;
+	int err;
+
+	pthread_mutex_lock(&loader->lock);
+
+	while (true) {
+		while (!loader->head && !loader->quit)
+			pthread_cond_wait(&loader->work_cond, &loader->lock);
+
+		req = loader->head;
+		if (!req)
+			break;
+
+		loader->head = req->next;
+		if (!loader->head)
+			loader->tail = NULL;
+
+		pthread_mutex_unlock(&loader->lock);
+
+		err = grate_loader_process(req);
+
+		pthread_mutex_lock(&loader->lock);
+
+		if (req->cancelled) {
+			grate_texture_request_release(req);
+			continue;
+		}
+
+		req->err = err;
+		req->done = true;
+		pthread_cond_broadcast(&loader->done_cond);
+	}
+
+	pthread_mutex_unlock(&loader->lock);
+
+	return NULL;
+}
+
+static struct grate_loader *grate_loader_create(void)
+{
+	struct grate_loader *loader;
+	long num_cpus;
+	unsigned i;
+
+	loader = calloc(1, sizeof(*loader));
+	if (!loader)
+		return NULL;
+
+	pthread_mutex_init(&loader->lock, NULL);
+	pthread_cond_init(&loader->work_cond, NULL);
+	pthread_cond_init(&loader->done_cond, NULL);
+
+	num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	num_cpus = MAX(num_cpus, 1);
+	num_cpus = MIN(num_cpus, LOADER_MAX_THREADS);
+
+	for (i = 0; i < num_cpus; i++) {
+		if (pthread_create(&loader->threads[i], NULL,
+				   grate_loader_worker, loader))
+			break;
+	}
+
+	loader->num_threads = i;
+
+	if (loader->num_threads == 0) {
+		grate_error("failed to start loader threads\n");
+		grate_loader_destroy(loader);
+		return NULL;
+	}
+
+	return loader;
+}
+
+void grate_loader_destroy(struct grate_loader *loader)
+{
+	unsigned i;
+
+	if (!loader)
+		return;
+
+	/* queued requests are still processed, their owners wait on them */
+	pthread_mutex_lock(&loader->lock);
+	loader->quit = true;
+	pthread_cond_broadcast(&loader->work_cond);
+	pthread_mutex_unlock(&loader->lock);
+
+	for (i = 0; i < loader->num_threads; i++)
+		pthread_join(loader->threads[i], NULL);
+
+	pthread_cond_destroy(&loader->done_cond);
+	pthread_cond_destroy(&loader->work_cond);
+	pthread_mutex_destroy(&loader->lock);
+	free(loader);
+}
+
+struct grate_texture_request *
+grate_texture_load_async(struct grate *grate, const char *path,
+			 enum pixel_format format, enum layout_format layout)
+{
+	struct grate_loader *loader;
+	struct grate_texture_request *req;
+
+	pthread_mutex_lock(&grate_loader_create_lock);
+
+	if (!grate->loader)
+		grate->loader = grate_loader_create();
+
+	loader = grate->loader;
+
+	pthread_mutex_unlock(&grate_loader_create_lock);
+
+	if (!loader)
+		return NULL;
+
+	req = calloc(1, sizeof(*req));
+	if (!req)
+		return NULL;
+
+	req->path = strdup(path);
+	if (!req->path) {
+		free(req);
+		return NULL;
+	}
+
+	req->grate = grate;
+	req->format = format;
+	req->layout = layout;
+
+	pthread_mutex_lock(&loader->lock);
+
+	if (loader->tail)
+		loader->tail->next = req;
+	else
+		loader->head = req;
+
+	loader->tail = req;
+
+	pthread_cond_signal(&loader->work_cond);
+	pthread_mutex_unlock(&loader->lock);
+
+	return req;
+}
+
+int grate_texture_request_poll(struct grate_texture_request *req)
+{
+	struct grate_loader *loader = req->grate->loader;
+	int err;
+
+	pthread_mutex_lock(&loader->lock);
+	err = req->done ? req->err : -EBUSY;
+	pthread_mutex_unlock(&loader->lock);
+
+	return err;
+}
+
+struct grate_texture *
+grate_texture_request_wait(struct grate_texture_request *req)
+{
+	struct grate_loader *loader = req->grate->loader;
+	struct grate_texture *tex = NULL;
+	int err;
+
+	pthread_mutex_lock(&loader->lock);
+
+	while (!req->done)
+		pthread_cond_wait(&loader->done_cond, &loader->lock);
+
+	pthread_mutex_unlock(&loader->lock);
+
+	err = req->err;
+	if (!err)
+		err = grate_image_upload(req->grate, &tex, &req->image, true,
+					 req->format, req->layout);
+
+	if (err) {
+		grate_error("failed to load \"%s\"\n", req->path);
+
+		if (tex)
+			grate_texture_free(tex);
+
+		tex = NULL;
+	} else
+		grate_info("loaded \"%s\"\n", req->path);
+
+	grate_texture_request_release(req);
+
+	return tex;
+}
+
+/*
+ * Drops a request that isn't going to be waited for. A queued request is
+ * unlinked, one that a worker is processing gets freed by the worker.
+ */
+void grate_texture_request_free(struct grate_texture_request *req)
+{
+	struct grate_loader *loader;
+	struct grate_texture_request **link, *prev = NULL;
+
+	if (!req)
+		return;
+
+	loader = req->grate->loader;
+
+	pthread_mutex_lock(&loader->lock);
+
+	for (link = &loader->head; *link; prev = *link, link = &(*link)->next) {
+		if (*link != req)
+			continue;
+
+		*link = req->next;
+		if (loader->tail == req)
+			loader->tail = prev;
+
+		pthread_mutex_unlock(&loader->lock);
+		grate_texture_request_release(req);
+		return;
+	}
+
+	if (!req->done) {
+		req->cancelled = true;
+		pthread_mutex_unlock(&loader->lock);
+		return;
+	}
+
+	pthread_mutex_unlock(&loader->lock);
+
+	grate_texture_request_release(req);
+}
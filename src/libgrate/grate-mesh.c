@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "libgrate-private.h"
+
+/*
+ * GR3D only fetches 8 or 16 bit indices, hence meshes referencing more
+ * than 65536 vertices are partitioned into clusters. Each cluster owns a
+ * contiguous range of the remapped vertex stream and is drawn with the
+ * attribute pointers rebased to the start of that range.
+ *
+ * Clusters are grown over the vertex-triangle adjacency starting from the
+ * first unassigned triangle, so that triangles sharing vertices end up in
+ * the same cluster. This keeps vertex duplication low and preserves the
+ * locality of the source order (which is what the post-transform cache
+ * cares about).
+ */
+
+enum mesh_triangle_state {
+	TRIANGLE_FREE,
+	TRIANGLE_QUEUED,
+	TRIANGLE_DONE,
+};
+
+struct mesh_adjacency {
+	unsigned *offsets;
+	unsigned *triangles;
+};
+
+static int mesh_build_adjacency(struct mesh_adjacency *adj,
+				const uint32_t *indices,
+				unsigned num_triangles,
+				unsigned num_vertices)
+{
+	unsigned *fill;
+	unsigned i;
+
+	adj->offsets = calloc(num_vertices + 1, sizeof(*adj->offsets));
+	adj->triangles = malloc(num_triangles * 3 * sizeof(*adj->triangles));
+	fill = calloc(num_vertices, sizeof(*fill));
+
+	if (!adj->offsets || !adj->triangles || !fill) {
+		free(adj->offsets);
+		free(adj->triangles);
+		free(fill);
+		return -1;
+	}
+
+	for (i = 0; i < num_triangles * 3; i++)
+		adj->offsets[indices[i] + 1]++;
+
+	for (i = 0; i < num_vertices; i++)
+		adj->offsets[i + 1] += adj->offsets[i];
+
+	for (i = 0; i < num_triangles * 3; i++) {
+		unsigned v = indices[i];
+
+		adj->triangles[adj->offsets[v] + fill[v]++] = i / 3;
+	}
+
+	free(fill);
+
+	return 0;
+}
+
+static void mesh_free_adjacency(struct mesh_adjacency *adj)
+{
+	free(adj->offsets);
+	free(adj->triangles);
+}
+
+static int mesh_add_cluster(struct grate_mesh *mesh)
+{
+	struct grate_mesh_cluster *clusters;
+	size_t size;
+
+	size = (mesh->num_clusters + 1) * sizeof(*clusters);
+
+	clusters = realloc(mesh->clusters, size);
+	if (!clusters)
+		return -1;
+
+	mesh->clusters = clusters;
+	memset(&clusters[mesh->num_clusters], 0, sizeof(*clusters));
+	clusters[mesh->num_clusters].first_vertex = mesh->num_vertices;
+	clusters[mesh->num_clusters].first_index = mesh->num_indices;
+	mesh->num_clusters++;
+
+	return 0;
+}
+
+struct grate_mesh *grate_mesh_split(const uint32_t *indices,
+				    unsigned num_indices,
+				    unsigned num_vertices,
+				    unsigned max_cluster_vertices)
+{
+	struct grate_mesh_cluster *cluster;
+	struct mesh_adjacency adj;
+	struct grate_mesh *mesh;
+	unsigned num_triangles = num_indices / 3;
+	unsigned *queue = NULL;
+	uint32_t *stamp = NULL;
+	uint16_t *local = NULL;
+	uint8_t *state = NULL;
+	unsigned next_seed = 0;
+	unsigned head, tail;
+	unsigned i, k;
+
+	if (num_indices == 0 || num_indices % 3) {
+		grate_error("Invalid number of indices %u\n", num_indices);
+		return NULL;
+	}
+
+	if (max_cluster_vertices < 3 || max_cluster_vertices > 65536) {
+		grate_error("Invalid cluster size %u\n", max_cluster_vertices);
+		return NULL;
+	}
+
+	for (i = 0; i < num_indices; i++) {
+		if (indices[i] >= num_vertices) {
+			grate_error("Index %u out of range: %u >= %u\n",
+				    i, indices[i], num_vertices);
+			return NULL;
+		}
+	}
+
+	mesh = calloc(1, sizeof(*mesh));
+	if (!mesh)
+		return NULL;
+
+	/* worst case every triangle gets its own three vertices */
+	mesh->indices = malloc(num_indices * sizeof(*mesh->indices));
+	mesh->remap = malloc(num_indices * sizeof(*mesh->remap));
+	stamp = malloc(num_vertices * sizeof(*stamp));
+	local = malloc(num_vertices * sizeof(*local));
+	state = calloc(num_triangles, sizeof(*state));
+	queue = malloc(num_triangles * sizeof(*queue));
+
+	if (!mesh->indices || !mesh->remap || !stamp || !local ||
+	    !state || !queue)
+		goto err_free;
+
+	if (mesh_build_adjacency(&adj, indices, num_triangles, num_vertices))
+		goto err_free;
+
+	memset(stamp, 0xff, num_vertices * sizeof(*stamp));
+
+	while (next_seed < num_triangles) {
+		if (state[next_seed] == TRIANGLE_DONE) {
+			next_seed++;
+			continue;
+		}
+
+		if (mesh_add_cluster(mesh))
+			goto err_adj;
+
+		cluster = &mesh->clusters[mesh->num_clusters - 1];
+
+		head = tail = 0;
+		queue[tail++] = next_seed;
+		state[next_seed] = TRIANGLE_QUEUED;
+
+		while (head < tail) {
+			unsigned tri = queue[head++];
+			const uint32_t *v = &indices[tri * 3];
+			unsigned new_vertices = 0;
+
+			for (k = 0; k < 3; k++) {
+				if (stamp[v[k]] != mesh->num_clusters - 1 &&
+				    (k < 1 || v[k] != v[0]) &&
+				    (k < 2 || v[k] != v[1]))
+					new_vertices++;
+			}
+
+			if (cluster->num_vertices + new_vertices >
+							max_cluster_vertices) {
+				/* stays queued, released below */
+				continue;
+			}
+
+			for (k = 0; k < 3; k++) {
+				unsigned t, j;
+
+				if (stamp[v[k]] != mesh->num_clusters - 1) {
+					stamp[v[k]] = mesh->num_clusters - 1;
+					local[v[k]] = cluster->num_vertices++;
+					mesh->remap[mesh->num_vertices++] = v[k];
+				}
+
+				mesh->indices[mesh->num_indices++] = local[v[k]];
+
+				for (j = adj.offsets[v[k]];
+				     j < adj.offsets[v[k] + 1]; j++) {
+					t = adj.triangles[j];
+
+					if (state[t] != TRIANGLE_FREE)
+						continue;
+
+					state[t] = TRIANGLE_QUEUED;
+					queue[tail++] = t;
+				}
+			}
+
+			cluster->num_indices += 3;
+			state[tri] = TRIANGLE_DONE;
+		}
+
+		/* release triangles that didn't fit for the next cluster */
+		for (i = 0; i < tail; i++) {
+			if (state[queue[i]] == TRIANGLE_QUEUED)
+				state[queue[i]] = TRIANGLE_FREE;
+		}
+	}
+
+	mesh_free_adjacency(&adj);
+	free(queue);
+	free(state);
+	free(local);
+	free(stamp);
+
+	grate_info("split %u triangles / %u vertices into %u clusters, "
+		   "%u vertices after remapping\n",
+		   num_triangles, num_vertices, mesh->num_clusters,
+		   mesh->num_vertices);
+
+	return mesh;
+
+err_adj:
+	mesh_free_adjacency(&adj);
+err_free:
+	free(queue);
+	free(state);
+	free(local);
+	free(stamp);
+	grate_mesh_free(mesh);
+
+	return NULL;
+}
+
+void grate_mesh_remap_vertices(const struct grate_mesh *mesh,
+			       void *dst, const void *src, unsigned stride)
+{
+	unsigned i;
+
+	for (i = 0; i < mesh->num_vertices; i++)
+		memcpy(dst + i * stride, src + mesh->remap[i] * stride,
+		       stride);
+}
+
+void grate_mesh_free(struct grate_mesh *mesh)
+{
+	if (mesh) {
+		free(mesh->clusters);
+		free(mesh->indices);
+		free(mesh->remap);
+	}
+
+	free(mesh);
+}
@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define MIPMAP_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define MIPMAP_SSE2 1
+#endif
+
+#include "etc1.h"
+#include "grate.h"
+#include "grate-3d.h"
+
+#include "libgrate-private.h"
+
+/*
+ * CPU mip chain generation for the formats GR2D can't scale. The base
+ * level is expanded into a working image of 8 or 16 bit channels, every
+ * level is box filtered from the previous one and stored back in the
+ * texture's format, compressed formats are re-encoded level by level.
+ * Rows of a level are filtered by several threads. Tiled surfaces are
+ * converted from and to linear on the way.
+ */
+
+#define MIPMAP_MAX_THREADS	16
+#define MIPMAP_ROWS_PER_JOB	16
+
+struct mipmap_image {
+	void *data;
+	unsigned width;
+	unsigned height;
+	unsigned channels;
+	bool wide;	/* 16 bit channels */
+};
+
+struct mipmap_packed {
+	unsigned num_fields;
+	unsigned shift[4];
+	unsigned bits[4];
+};
+
+struct mipmap_job {
+	const struct mipmap_image *src;
+	const struct mipmap_image *dst;
+	unsigned next_row;
+};
+
+static const struct mipmap_packed packed_rgb565 = {
+	3, { 11, 5, 0 }, { 5, 6, 5 },
+};
+
+static const struct mipmap_packed packed_rgba5551 = {
+	4, { 11, 6, 1, 0 }, { 5, 5, 5, 1 },
+};
+
+static const struct mipmap_packed packed_rgba4444 = {
+	4, { 12, 8, 4, 0 }, { 4, 4, 4, 4 },
+};
+
+static unsigned long image_pitch(const struct mipmap_image *img)
+{
+	return img->width * img->channels * (img->wide ? 2 : 1);
+}
+
+static unsigned sample_value(const struct mipmap_image *img,
+			     unsigned long offset)
+{
+	if (img->wide)
+		return ((const uint16_t *)img->data)[offset];
+
+	return ((const uint8_t *)img->data)[offset];
+}
+
+/* 2:1 in both directions, four channels of 8 bits, 2 pixels per step */
+static unsigned box_2x2_rgba8(const uint8_t *row0, const uint8_t *row1,
+			      uint8_t *dst, unsigned width)
+{
+	unsigned x = 0;
+
+#if defined(MIPMAP_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i two = _mm_set1_epi16(2);
+
+	for (; x + 2 <= width; x += 2, row0 += 16, row1 += 16, dst += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)row0);
+		__m128i b = _mm_loadu_si128((const __m128i *)row1);
+		__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+					   _mm_unpacklo_epi8(b, zero));
+		__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+					   _mm_unpackhi_epi8(b, zero));
+		__m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi),
+					    _mm_unpackhi_epi64(lo, hi));
+
+		sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+		_mm_storel_epi64((__m128i *)dst, _mm_packus_epi16(sum, sum));
+	}
+#elif defined(MIPMAP_NEON)
+	for (; x + 2 <= width; x += 2, row0 += 16, row1 += 16, dst += 8) {
+		uint8x16_t a = vld1q_u8(row0);
+		uint8x16_t b = vld1q_u8(row1);
+		uint16x8_t lo = vaddl_u8(vget_low_u8(a), vget_low_u8(b));
+		uint16x8_t hi = vaddl_u8(vget_high_u8(a), vget_high_u8(b));
+		uint16x8_t sum = vcombine_u16(
+			vadd_u16(vget_low_u16(lo), vget_high_u16(lo)),
+			vadd_u16(vget_low_u16(hi), vget_high_u16(hi)));
+
+		vst1_u8(dst, vrshrn_n_u16(sum, 2));
+	}
+#endif
+
+	return x;
+}
+
+static void box_filter_row(const struct mipmap_image *src,
+			   const struct mipmap_image *dst, unsigned y)
+{
+	unsigned ch = src->channels;
+	unsigned y0 = y * src->height / dst->height;
+	unsigned y1 = MAX((y + 1) * src->height / dst->height, y0 + 1);
+	unsigned x = 0, x0, x1, sx, sy, c;
+	unsigned long sum, count;
+
+	if (!src->wide && ch == 4 && src->width == dst->width * 2 &&
+	    src->height == dst->height * 2) {
+		const uint8_t *row0 = src->data + y0 * image_pitch(src);
+
+		x = box_2x2_rgba8(row0, row0 + image_pitch(src),
+				  dst->data + y * image_pitch(dst),
+				  dst->width);
+	}
+
+	for (; x < dst->width; x++) {
+		x0 = x * src->width / dst->width;
+		x1 = MAX((x + 1) * src->width / dst->width, x0 + 1);
+		count = (x1 - x0) * (y1 - y0);
+
+		for (c = 0; c < ch; c++) {
+			for (sum = 0, sy = y0; sy < y1; sy++) {
+				unsigned long row = sy * src->width;
+
+				for (sx = x0; sx < x1; sx++)
+					sum += sample_value(src,
+							    (row + sx) * ch + c);
+			}
+
+			sum = (sum + count / 2) / count;
+
+			if (dst->wide)
+				((uint16_t *)dst->data)
+					[(y * dst->width + x) * ch + c] = sum;
+			else
+				((uint8_t *)dst->data)
+					[(y * dst->width + x) * ch + c] = sum;
+		}
+	}
+}
+
+static void *mipmap_worker(void *arg)
+{
+	struct mipmap_job *job = arg;
+	unsigned y, end;
+
+	while (true) {
+		y = __atomic_fetch_add(&job->next_row, MIPMAP_ROWS_PER_JOB,
+				       __ATOMIC_RELAXED);
+		if (y >= job->dst->height)
+			break;
+
+		end = MIN(y + MIPMAP_ROWS_PER_JOB, job->dst->height);
+
+		for (; y < end; y++)
+			box_filter_row(job->src, job->dst, y);
+	}
+
+	return NULL;
+}
+
+static void mipmap_downsample(const struct mipmap_image *src,
+			      const struct mipmap_image *dst)
+{
+	pthread_t threads[MIPMAP_MAX_THREADS];
+	struct mipmap_job job = { src, dst, 0 };
+	unsigned num_threads, started = 0, i;
+
+	num_threads = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+	num_threads = MIN(num_threads, MIPMAP_MAX_THREADS);
+	num_threads = MIN(num_threads, (dst->height + MIPMAP_ROWS_PER_JOB - 1) /
+				       MIPMAP_ROWS_PER_JOB);
+
+	/* the calling thread filters too */
+	while (started + 1 < num_threads) {
+		if (pthread_create(&threads[started], NULL, mipmap_worker,
+				   &job))
+			break;
+
+		started++;
+	}
+
+	mipmap_worker(&job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+}
+
+static void unpack_row(const struct mipmap_packed *packed,
+		       const uint16_t *src, uint8_t *dst, unsigned width)
+{
+	unsigned x, i, v, max;
+
+	for (x = 0; x < width; x++) {
+		for (i = 0; i < packed->num_fields; i++) {
+			max = (1 << packed->bits[i]) - 1;
+			v = (src[x] >> packed->shift[i]) & max;
+			*dst++ = (v * 255 + max / 2) / max;
+		}
+	}
+}
+
+static void pack_row(const struct mipmap_packed *packed,
+		     const uint8_t *src, uint16_t *dst, unsigned width)
+{
+	unsigned x, i, max;
+	uint16_t v;
+
+	for (x = 0; x < width; x++) {
+		for (v = 0, i = 0; i < packed->num_fields; i++) {
+			max = (1 << packed->bits[i]) - 1;
+			v |= ((*src++ * max + 127) / 255) << packed->shift[i];
+		}
+
+		dst[x] = v;
+	}
+}
+
+static unsigned pixbuf_rows(const struct host1x_pixelbuffer *pixbuf)
+{
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+	unsigned rows = ALIGN(pixbuf->height, th) / th;
+
+	if (pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16)
+		rows = ALIGN(rows, 16);
+
+	return rows;
+}
+
+static int mipmap_load_base(struct host1x_pixelbuffer *pixbuf,
+			    const void *map, const struct mipmap_packed *packed,
+			    struct mipmap_image *img)
+{
+	unsigned long pitch = image_pitch(img);
+	unsigned y;
+
+	switch (pixbuf->format) {
+	case PIX_BUF_FMT_ETC1: {
+		unsigned long size = etc1_get_encoded_data_size(img->width,
+								img->height);
+		unsigned row_size = (img->width + 3) / 4 * 8;
+		uint64_t *blocks = malloc(size);
+		unsigned long i;
+		uint64_t word;
+		int err;
+
+		if (!blocks)
+			return -ENOMEM;
+
+		for (i = 0; i < size / 8; i++) {
+			memcpy(&word, map + (i * 8 / row_size) * pixbuf->pitch +
+			       i * 8 % row_size, 8);
+			blocks[i] = grate_etc1_swap_block(word);
+		}
+
+		err = etc1_decode_image((const etc1_byte *)blocks, img->data,
+					img->width, img->height, 3, pitch);
+		free(blocks);
+
+		return err;
+	}
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		return grate_dxt_decode(map, img->width, img->height,
+					pixbuf->pitch, pixbuf->format,
+					img->data, pitch);
+	default:
+		break;
+	}
+
+	for (y = 0; y < img->height; y++) {
+		const void *row = map + y * pixbuf->pitch;
+
+		if (packed)
+			unpack_row(packed, row, img->data + y * pitch,
+				   img->width);
+		else
+			memcpy(img->data + y * pitch, row, pitch);
+	}
+
+	return 0;
+}
+
+static int mipmap_store_level(struct host1x_pixelbuffer *level, void *map,
+			      const struct mipmap_packed *packed,
+			      const struct mipmap_image *img)
+{
+	unsigned long pitch = image_pitch(img);
+	unsigned y;
+
+	switch (level->format) {
+	case PIX_BUF_FMT_ETC1: {
+		unsigned long size = etc1_get_encoded_data_size(img->width,
+								img->height);
+		unsigned row_size = (img->width + 3) / 4 * 8;
+		uint64_t *blocks = malloc(size);
+		unsigned long i;
+		int err;
+
+		if (!blocks)
+			return -ENOMEM;
+
+		err = etc1_encode_image_quality(img->data, img->width,
+						img->height, 3, pitch,
+						(etc1_byte *)blocks,
+						ETC1_QUALITY_MEDIUM, 1);
+		if (err) {
+			free(blocks);
+			return err;
+		}
+
+		for (i = 0; i < size / 8; i++) {
+			uint64_t word = grate_etc1_swap_block(blocks[i]);
+
+			memcpy(map + (i * 8 / row_size) * level->pitch +
+			       i * 8 % row_size, &word, 8);
+		}
+
+		free(blocks);
+
+		return 0;
+	}
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		return grate_dxt_encode(img->data, img->width, img->height,
+					pitch, level->format, map,
+					level->pitch, 0);
+	default:
+		break;
+	}
+
+	for (y = 0; y < img->height; y++) {
+		void *row = map + y * level->pitch;
+
+		if (packed)
+			pack_row(packed, img->data + y * pitch, row,
+				 img->width);
+		else
+			memcpy(row, img->data + y * pitch, pitch);
+	}
+
+	return 0;
+}
+
+int grate_mipmap_generate_cpu(struct grate *grate, struct grate_texture *tex)
+{
+	struct host1x_pixelbuffer *pixbuf = tex->pixbuf;
+	struct host1x_pixelbuffer *mipmap = tex->mipmap_pixbuf;
+	const struct mipmap_packed *packed = NULL;
+	struct mipmap_image img[2] = { 0 };
+	struct host1x_pixelbuffer level;
+	unsigned long offset, size;
+	unsigned channels, lod;
+	void *base_linear = NULL, *level_linear = NULL;
+	void *base_map, *mip_map;
+	bool wide = false;
+	int err;
+
+	switch (pixbuf->format) {
+	case PIX_BUF_FMT_A8:
+	case PIX_BUF_FMT_L8:
+	case PIX_BUF_FMT_S8:
+	case PIX_BUF_FMT_LA88:
+	case PIX_BUF_FMT_RGBA8888:
+	case PIX_BUF_FMT_BGRA8888:
+		channels = PIX_BUF_FORMAT_BYTES(pixbuf->format);
+		break;
+	case PIX_BUF_FMT_D16_LINEAR:
+	case PIX_BUF_FMT_D16_NONLINEAR:
+		channels = 1;
+		wide = true;
+		break;
+	case PIX_BUF_FMT_RGB565:
+		packed = &packed_rgb565;
+		channels = 3;
+		break;
+	case PIX_BUF_FMT_RGBA5551:
+		packed = &packed_rgba5551;
+		channels = 4;
+		break;
+	case PIX_BUF_FMT_RGBA4444:
+		packed = &packed_rgba4444;
+		channels = 4;
+		break;
+	case PIX_BUF_FMT_ETC1:
+		channels = 3;
+		break;
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		channels = 4;
+		break;
+	default:
+		grate_error("Unsupported mipmap format 0x%08x\n",
+			    pixbuf->format);
+		return -EINVAL;
+	}
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &base_map);
+	if (err)
+		return err;
+
+	err = HOST1X_BO_MMAP(mipmap->bo, &mip_map);
+	if (err)
+		return err;
+
+	base_map += pixbuf->bo->offset;
+	mip_map += mipmap->bo->offset;
+
+	img[0].width = pixbuf->width;
+	img[0].height = pixbuf->height;
+	img[0].channels = img[1].channels = channels;
+	img[0].wide = img[1].wide = wide;
+
+	/* every level is at most as large as the base */
+	img[0].data = malloc(image_pitch(&img[0]) * img[0].height);
+	img[1].data = malloc(image_pitch(&img[0]) * img[0].height);
+	if (!img[0].data || !img[1].data) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	/* tiled surfaces go through a linear copy */
+	if (pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16) {
+		size = pixbuf->pitch * pixbuf_rows(pixbuf);
+
+		base_linear = malloc(size);
+		if (!base_linear) {
+			err = -ENOMEM;
+			goto out;
+		}
+
+		host1x_pixelbuffer_untile_16x16(base_linear, pixbuf->pitch,
+						base_map, pixbuf->pitch,
+						pixbuf->pitch,
+						pixbuf_rows(pixbuf));
+		base_map = base_linear;
+	}
+
+	if (mipmap->layout == PIX_BUF_LAYOUT_TILED_16x16) {
+		grate_texture_lod_layout(mipmap, &level, 0);
+
+		level_linear = malloc(level.pitch * pixbuf_rows(&level));
+		if (!level_linear) {
+			err = -ENOMEM;
+			goto out;
+		}
+	}
+
+	err = mipmap_load_base(pixbuf, base_map, packed, &img[0]);
+	if (err)
+		goto out;
+
+	for (lod = 0; lod <= tex->max_lod; lod++) {
+		struct mipmap_image *src = &img[lod & 1];
+		struct mipmap_image *dst = &img[(lod + 1) & 1];
+
+		offset = grate_texture_lod_layout(mipmap, &level, lod);
+		size = level.pitch * pixbuf_rows(&level);
+
+		dst->width = level.width;
+		dst->height = level.height;
+
+		mipmap_downsample(src, dst);
+
+		err = mipmap_store_level(&level,
+					 level_linear ?: mip_map + offset,
+					 packed, dst);
+		if (err)
+			goto out;
+
+		if (level_linear)
+			host1x_pixelbuffer_tile_16x16(mip_map + offset,
+						      level.pitch,
+						      level_linear,
+						      level.pitch, level.pitch,
+						      pixbuf_rows(&level));
+
+		err = HOST1X_BO_FLUSH(mipmap->bo, mipmap->bo->offset + offset,
+				      size);
+		if (err)
+			goto out;
+	}
+
+out:
+	free(level_linear);
+	free(base_linear);
+	free(img[0].data);
+	free(img[1].data);
+
+	if (err)
+		grate_error("Mipmap generation failed\n");
+
+	return err;
+}
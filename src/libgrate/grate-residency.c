@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <string.h>
+
+#include "grate.h"
+#include "grate-3d.h"
+
+#include "libgrate-private.h"
+
+/*
+ * Accounts the BO memory of textures, mipmaps and framebuffers and keeps
+ * it within an optional budget by evicting the least recently bound
+ * textures. Textures that were loaded from an image file only remember
+ * the path and are reloaded (usually from the texture cache), others
+ * have their texel data spilled into system memory. Evicted textures are
+ * restored when they're bound or drawn with. Textures whose pixbuf was
+ * handed out to the user are pinned.
+ *
+ * The clock ticks once per operation, textures used by the current one
+ * carry the current clock value and are never picked for eviction.
+ */
+
+void grate_residency_init(struct grate *grate)
+{
+	INIT_LIST_HEAD(&grate->residency.textures);
+}
+
+static size_t pixbuf_data_size(struct host1x_pixelbuffer *pixbuf)
+{
+	/* the BO's offset skips the leading guard, if any */
+	return pixbuf->bo->size - 2 * pixbuf->bo->offset;
+}
+
+static size_t residency_total(struct grate_residency *res)
+{
+	size_t total = 0;
+	unsigned i;
+
+	for (i = 0; i < GRATE_MEMORY_TYPES; i++)
+		total += res->allocated[i];
+
+	return total;
+}
+
+void grate_residency_account(struct grate *grate,
+			     enum grate_memory_type type, ssize_t delta)
+{
+	grate->residency.allocated[type] += delta;
+}
+
+static void *spill_pixbuf(struct host1x_pixelbuffer *pixbuf, size_t *size)
+{
+	void *map, *spill;
+
+	*size = pixbuf_data_size(pixbuf);
+
+	if (HOST1X_BO_MMAP(pixbuf->bo, &map))
+		return NULL;
+
+	spill = malloc(*size);
+	if (spill)
+		memcpy(spill, map + pixbuf->bo->offset, *size);
+
+	return spill;
+}
+
+static int unspill_pixbuf(struct host1x_pixelbuffer *pixbuf,
+			  const void *spill, size_t size)
+{
+	void *map;
+	int err;
+
+	if (size > pixbuf_data_size(pixbuf))
+		return -EINVAL;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &map);
+	if (err)
+		return err;
+
+	memcpy(map + pixbuf->bo->offset, spill, size);
+
+	return HOST1X_BO_FLUSH(pixbuf->bo, pixbuf->bo->offset, size);
+}
+
+static int residency_evict(struct grate *grate, struct grate_texture *tex)
+{
+	struct grate_residency *res = &grate->residency;
+	size_t size, freed = 0;
+
+	if (!tex->source_path) {
+		tex->spill = spill_pixbuf(tex->pixbuf, &tex->spill_size);
+		if (!tex->spill)
+			return -ENOMEM;
+	}
+
+	if (tex->mipmap_pixbuf) {
+		tex->mipmap_spill = spill_pixbuf(tex->mipmap_pixbuf,
+						 &tex->mipmap_spill_size);
+		if (!tex->mipmap_spill) {
+			free(tex->spill);
+			tex->spill = NULL;
+			return -ENOMEM;
+		}
+
+		size = tex->mipmap_pixbuf->bo->size;
+		grate_residency_account(grate, GRATE_MEMORY_MIPMAP, -size);
+		freed += size;
+
+		tex->evicted_max_lod = tex->max_lod;
+		host1x_pixelbuffer_free(tex->mipmap_pixbuf);
+		tex->mipmap_pixbuf = NULL;
+	}
+
+	size = tex->pixbuf->bo->size;
+	grate_residency_account(grate, GRATE_MEMORY_TEXTURE, -size);
+	freed += size;
+
+	tex->desc = *tex->pixbuf;
+	tex->desc.bo = NULL;
+	host1x_pixelbuffer_free(tex->pixbuf);
+	tex->pixbuf = NULL;
+	tex->evicted = true;
+
+	res->stats.evictions++;
+	res->stats.evicted_bytes += freed;
+	res->stats.evicted_textures++;
+
+	grate_info("evicted %ux%u texture, %zu bytes\n",
+		   tex->desc.width, tex->desc.height, freed);
+
+	return 0;
+}
+
+static void residency_enforce(struct grate *grate)
+{
+	struct grate_residency *res = &grate->residency;
+	struct grate_texture *tex, *victim;
+
+	while (res->budget && residency_total(res) > res->budget) {
+		victim = NULL;
+
+		list_for_each_entry(tex, &res->textures, residency) {
+			if (tex->evicted || tex->pinned ||
+			    tex->last_use == res->clock)
+				continue;
+
+			if (!victim || tex->last_use < victim->last_use)
+				victim = tex;
+		}
+
+		if (!victim || residency_evict(grate, victim) < 0) {
+			grate_info("over budget: %zu > %zu bytes\n",
+				   residency_total(res), res->budget);
+			break;
+		}
+	}
+}
+
+void grate_residency_add_texture(struct grate *grate,
+				 struct grate_texture *tex)
+{
+	struct grate_residency *res = &grate->residency;
+
+	tex->grate = grate;
+	tex->last_use = ++res->clock;
+	list_add_tail(&tex->residency, &res->textures);
+
+	grate_residency_account(grate, GRATE_MEMORY_TEXTURE,
+				tex->pixbuf->bo->size);
+	residency_enforce(grate);
+}
+
+void grate_residency_add_mipmap(struct grate_texture *tex)
+{
+	grate_residency_account(tex->grate, GRATE_MEMORY_MIPMAP,
+				tex->mipmap_pixbuf->bo->size);
+	residency_enforce(tex->grate);
+}
+
+void grate_residency_remove_texture(struct grate_texture *tex)
+{
+	struct grate_residency *res = &tex->grate->residency;
+
+	if (tex->evicted) {
+		res->stats.evicted_textures--;
+	} else {
+		grate_residency_account(tex->grate, GRATE_MEMORY_TEXTURE,
+					-(ssize_t)tex->pixbuf->bo->size);
+
+		if (tex->mipmap_pixbuf)
+			grate_residency_account(tex->grate,
+				GRATE_MEMORY_MIPMAP,
+				-(ssize_t)tex->mipmap_pixbuf->bo->size);
+	}
+
+	list_del(&tex->residency);
+	free(tex->mipmap_spill);
+	free(tex->spill);
+	free(tex->source_path);
+}
+
+void grate_residency_tick(struct grate *grate)
+{
+	grate->residency.clock++;
+}
+
+/*
+ * The spilled data is only dropped and the texture only counted as
+ * resident once everything was restored, a failed restore leaves the
+ * texture evicted.
+ */
+static int residency_restore(struct grate *grate, struct grate_texture *tex)
+{
+	struct grate_residency *res = &grate->residency;
+	struct host1x_pixelbuffer *pixbuf;
+	size_t restored, size;
+	int err;
+
+	pixbuf = host1x_pixelbuffer_create(grate->host1x, tex->desc.width,
+					   tex->desc.height, tex->desc.pitch,
+					   tex->desc.format, tex->desc.layout);
+	if (!pixbuf)
+		return -ENOMEM;
+
+	tex->pixbuf = pixbuf;
+	restored = pixbuf->bo->size;
+
+	grate_residency_account(grate, GRATE_MEMORY_TEXTURE, restored);
+
+	if (tex->source_path)
+		err = grate_texture_reload(grate, tex);
+	else
+		err = unspill_pixbuf(pixbuf, tex->spill, tex->spill_size);
+
+	if (err)
+		goto free_pixbuf;
+
+	if (tex->mipmap_spill) {
+		err = grate_texture_alloc_mipmap(grate, tex);
+		if (err)
+			goto free_pixbuf;
+
+		err = unspill_pixbuf(tex->mipmap_pixbuf, tex->mipmap_spill,
+				     tex->mipmap_spill_size);
+		if (err)
+			goto free_mipmap;
+
+		tex->max_lod = tex->evicted_max_lod;
+		restored += tex->mipmap_pixbuf->bo->size;
+	}
+
+	free(tex->mipmap_spill);
+	tex->mipmap_spill = NULL;
+	free(tex->spill);
+	tex->spill = NULL;
+
+	tex->evicted = false;
+	res->stats.evicted_textures--;
+	res->stats.restores++;
+	res->stats.restored_bytes += restored;
+
+	grate_info("restored %ux%u texture, %zu bytes\n",
+		   pixbuf->width, pixbuf->height, restored);
+
+	residency_enforce(grate);
+
+	return 0;
+
+free_mipmap:
+	size = tex->mipmap_pixbuf->bo->size;
+	grate_residency_account(grate, GRATE_MEMORY_MIPMAP, -size);
+	host1x_pixelbuffer_free(tex->mipmap_pixbuf);
+	tex->mipmap_pixbuf = NULL;
+	tex->max_lod = tex->evicted_max_lod;
+free_pixbuf:
+	grate_residency_account(grate, GRATE_MEMORY_TEXTURE,
+				-(ssize_t)pixbuf->bo->size);
+	host1x_pixelbuffer_free(pixbuf);
+	tex->pixbuf = NULL;
+
+	grate_error("failed to restore %ux%u texture: %d\n",
+		    tex->desc.width, tex->desc.height, err);
+
+	return err;
+}
+
+void grate_texture_touch(struct grate_texture *tex)
+{
+	if (tex->grate)
+		tex->last_use = tex->grate->residency.clock;
+}
+
+/* the texture needs to be touched already */
+int grate_texture_restore(struct grate_texture *tex)
+{
+	if (!tex->evicted)
+		return 0;
+
+	return residency_restore(tex->grate, tex);
+}
+
+int grate_texture_make_resident(struct grate_texture *tex)
+{
+	if (!tex->grate)
+		return 0;
+
+	grate_residency_tick(tex->grate);
+	grate_texture_touch(tex);
+
+	return grate_texture_restore(tex);
+}
+
+/* GR2D or the CPU wrote to the texture, its source file is stale now */
+void grate_texture_modified(struct grate_texture *tex)
+{
+	free(tex->source_path);
+	tex->source_path = NULL;
+}
+
+void grate_set_memory_budget(struct grate *grate, size_t budget)
+{
+	grate->residency.budget = budget;
+	residency_enforce(grate);
+}
+
+void grate_get_memory_stats(struct grate *grate,
+			    struct grate_memory_stats *stats)
+{
+	struct grate_residency *res = &grate->residency;
+
+	*stats = res->stats;
+	memcpy(stats->allocated, res->allocated, sizeof(stats->allocated));
+	stats->budget = res->budget;
+}
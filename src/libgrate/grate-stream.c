@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "../libhost1x/host1x-private.h"
+#include "libgrate-private.h"
+
+#include "grate-3d.h"
+
+/*
+ * Streaming allocator for per-frame vertex and index data. Allocations are
+ * carved linearly out of a single BO and handed out as wrapped BOs, which
+ * can be passed to grate_3d_ctx_vertex_attrib_pointer() and the draw
+ * functions like any other BO.
+ *
+ * grate_stream_ring_fence() tags all allocations made since the previous
+ * call with the fence of the last job submitted by the context. Space is
+ * reclaimed in allocation order once the fence is reached, the allocator
+ * blocks on the oldest fence only if the ring is full.
+ */
+
+struct grate_stream_range {
+	struct host1x_bo *bo;
+	unsigned long start;
+	unsigned long end;
+	uint32_t fence;
+	bool fenced;
+};
+
+struct grate_stream_ring {
+	struct host1x_client *client;
+	struct host1x_bo *bo;
+	void *map;
+	size_t size;
+
+	/* FIFO of live allocations, oldest at tail */
+	struct grate_stream_range *ranges;
+	unsigned num_ranges;
+	unsigned max_ranges;
+	unsigned tail;
+
+	unsigned long head;
+};
+
+#define RING_RANGE(ring, i) \
+	(&(ring)->ranges[((ring)->tail + (i)) % (ring)->max_ranges])
+
+struct grate_stream_ring *grate_stream_ring_create(struct grate *grate,
+						   size_t size,
+						   unsigned long flags)
+{
+	struct host1x_gr3d *gr3d = host1x_get_gr3d(grate->host1x);
+	struct grate_stream_ring *ring;
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring)
+		return NULL;
+
+	ring->bo = grate_bo_create_and_map(grate, flags, size, &ring->map);
+	if (!ring->bo) {
+		free(ring);
+		return NULL;
+	}
+
+	ring->client = gr3d->client;
+	ring->size = size;
+
+	return ring;
+}
+
+static void grate_stream_ring_retire(struct grate_stream_ring *ring)
+{
+	struct grate_stream_range *range = RING_RANGE(ring, 0);
+
+	host1x_bo_free(range->bo);
+
+	ring->tail = (ring->tail + 1) % ring->max_ranges;
+	ring->num_ranges--;
+
+	if (ring->num_ranges == 0) {
+		ring->tail = 0;
+		ring->head = 0;
+	}
+}
+
+static int grate_stream_ring_wait_oldest(struct grate_stream_ring *ring)
+{
+	struct grate_stream_range *range = RING_RANGE(ring, 0);
+	int err;
+
+	if (!range->fenced) {
+		grate_error("stream ring is full of unsubmitted data\n");
+		return -EBUSY;
+	}
+
+	err = HOST1X_CLIENT_WAIT(ring->client, range->fence, ~0u);
+	if (err < 0)
+		return err;
+
+	grate_stream_ring_retire(ring);
+
+	return 0;
+}
+
+/* drop everything the GPU is done with, without blocking */
+static void grate_stream_ring_reclaim(struct grate_stream_ring *ring)
+{
+	while (ring->num_ranges) {
+		struct grate_stream_range *range = RING_RANGE(ring, 0);
+
+		if (!range->fenced)
+			break;
+
+		if (host1x_client_wait(ring->client, range->fence, 0) < 0)
+			break;
+
+		grate_stream_ring_retire(ring);
+	}
+}
+
+static bool grate_stream_ring_fit(struct grate_stream_ring *ring,
+				  size_t size, size_t align,
+				  unsigned long *offset)
+{
+	unsigned long tail, start;
+
+	if (ring->num_ranges == 0) {
+		*offset = 0;
+		return size <= ring->size;
+	}
+
+	tail = RING_RANGE(ring, 0)->start;
+	start = ALIGN(ring->head, align);
+
+	/* the newest allocation lies in front of the oldest one once wrapped */
+	if (RING_RANGE(ring, ring->num_ranges - 1)->start >= tail) {
+		if (start + size <= ring->size) {
+			*offset = start;
+			return true;
+		}
+
+		/* wrap around */
+		if (size <= tail) {
+			*offset = 0;
+			return true;
+		}
+
+		return false;
+	}
+
+	if (start + size <= tail) {
+		*offset = start;
+		return true;
+	}
+
+	return false;
+}
+
+static int grate_stream_ring_grow(struct grate_stream_ring *ring)
+{
+	struct grate_stream_range *ranges;
+	unsigned max_ranges = ring->max_ranges ? ring->max_ranges * 2 : 64;
+	unsigned i;
+
+	ranges = malloc(max_ranges * sizeof(*ranges));
+	if (!ranges)
+		return -ENOMEM;
+
+	for (i = 0; i < ring->num_ranges; i++)
+		ranges[i] = *RING_RANGE(ring, i);
+
+	free(ring->ranges);
+	ring->ranges = ranges;
+	ring->max_ranges = max_ranges;
+	ring->tail = 0;
+
+	return 0;
+}
+
+struct host1x_bo *grate_stream_ring_alloc(struct grate_stream_ring *ring,
+					  size_t size, size_t align,
+					  void **map)
+{
+	struct grate_stream_range *range;
+	unsigned long offset;
+	int err;
+
+	if (size == 0 || size > ring->size) {
+		grate_error("Invalid allocation size %zu\n", size);
+		return NULL;
+	}
+
+	if (align == 0 || (align & (align - 1))) {
+		grate_error("Invalid alignment %zu\n", align);
+		return NULL;
+	}
+
+	grate_stream_ring_reclaim(ring);
+
+	while (!grate_stream_ring_fit(ring, size, align, &offset)) {
+		err = grate_stream_ring_wait_oldest(ring);
+		if (err < 0)
+			return NULL;
+	}
+
+	if (ring->num_ranges == ring->max_ranges) {
+		err = grate_stream_ring_grow(ring);
+		if (err < 0)
+			return NULL;
+	}
+
+	range = RING_RANGE(ring, ring->num_ranges);
+	range->bo = host1x_bo_wrap(ring->bo, offset, size);
+	if (!range->bo)
+		return NULL;
+
+	range->start = offset;
+	range->end = offset + size;
+	range->fenced = false;
+
+	ring->num_ranges++;
+	ring->head = range->end;
+
+	if (map)
+		*map = ring->map + offset;
+
+	return range->bo;
+}
+
+int grate_stream_ring_commit(struct grate_stream_ring *ring,
+			     struct host1x_bo *bo, size_t written)
+{
+	struct grate_stream_range *range;
+
+	if (ring->num_ranges == 0)
+		return -EINVAL;
+
+	range = RING_RANGE(ring, ring->num_ranges - 1);
+
+	if (written > bo->size)
+		return -EINVAL;
+
+	/* the latest allocation gives back its unused tail */
+	if (range->bo == bo && written) {
+		range->end = range->start + written;
+		ring->head = range->end;
+	}
+
+	return HOST1X_BO_FLUSH(bo, bo->offset, written);
+}
+
+void grate_stream_ring_fence(struct grate_stream_ring *ring,
+			     struct grate_3d_ctx *ctx)
+{
+	unsigned i;
+
+	for (i = ring->num_ranges; i > 0; i--) {
+		struct grate_stream_range *range = RING_RANGE(ring, i - 1);
+
+		if (range->fenced)
+			break;
+
+		range->fence = ctx->fence;
+		range->fenced = true;
+	}
+}
+
+void grate_stream_ring_free(struct grate_stream_ring *ring)
+{
+	if (!ring)
+		return;
+
+	/* the GPU may still be reading */
+	while (ring->num_ranges) {
+		if (RING_RANGE(ring, 0)->fenced)
+			HOST1X_CLIENT_WAIT(ring->client,
+					   RING_RANGE(ring, 0)->fence, ~0u);
+
+		grate_stream_ring_retire(ring);
+	}
+
+	host1x_bo_free(ring->bo);
+	free(ring->ranges);
+	free(ring);
+}
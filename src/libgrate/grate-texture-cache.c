@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "libgrate-private.h"
+
+/*
+ * Persistent cache of GPU-ready texture data. Entries are keyed by the
+ * content hash of the source file plus everything that affects the
+ * output: pixel format, layout, mip level and target size. A hit maps
+ * the entry and hands it to the upload as is, skipping decode and
+ * compression.
+ *
+ * Bump the version whenever the output of the decoders or encoders
+ * changes, stale entries are ignored then.
+ */
+
+#define TEXTURE_CACHE_MAGIC	0x43545247	/* "GRTC" */
+#define TEXTURE_CACHE_VERSION	1
+
+struct texture_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t hash;
+	uint32_t format;
+	uint32_t layout;
+	uint32_t level;
+	uint32_t width;
+	uint32_t height;
+	uint32_t pitch;
+	uint64_t size;
+};
+
+static uint64_t texture_cache_hash(const void *data, size_t size)
+{
+	uint64_t hash = 0xcbf29ce484222325ull ^ size;
+	const uint8_t *p = data;
+	uint64_t word;
+
+	for (; size >= 8; size -= 8, p += 8) {
+		memcpy(&word, p, 8);
+		hash = (hash ^ word) * 0x100000001b3ull;
+		hash ^= hash >> 29;
+	}
+
+	while (size--)
+		hash = (hash ^ *p++) * 0x100000001b3ull;
+
+	return hash;
+}
+
+static int texture_cache_mkdir(const char *dir)
+{
+	char path[PATH_MAX];
+	char *p;
+
+	if (strlen(dir) >= sizeof(path))
+		return -ENAMETOOLONG;
+
+	strcpy(path, dir);
+
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+
+		*p = '\0';
+		if (mkdir(path, 0755) && errno != EEXIST)
+			return -errno;
+		*p = '/';
+	}
+
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -errno;
+
+	return 0;
+}
+
+int grate_texture_cache_set_dir(struct grate *grate, const char *dir)
+{
+	char *copy = NULL;
+
+	if (dir && *dir) {
+		copy = strdup(dir);
+		if (!copy)
+			return -ENOMEM;
+	}
+
+	free(grate->texture_cache_dir);
+	grate->texture_cache_dir = copy;
+
+	return 0;
+}
+
+void grate_texture_cache_init(struct grate *grate)
+{
+	char dir[PATH_MAX];
+	const char *env;
+
+	/* an empty GRATE_TEXTURE_CACHE_DIR disables the cache */
+	env = getenv("GRATE_TEXTURE_CACHE_DIR");
+	if (env) {
+		grate_texture_cache_set_dir(grate, env);
+		return;
+	}
+
+	env = getenv("XDG_CACHE_HOME");
+	if (env && *env) {
+		snprintf(dir, sizeof(dir), "%s/grate/textures", env);
+	} else {
+		env = getenv("HOME");
+		if (!env || !*env)
+			return;
+
+		snprintf(dir, sizeof(dir), "%s/.cache/grate/textures", env);
+	}
+
+	grate_texture_cache_set_dir(grate, dir);
+}
+
+int grate_texture_cache_key(struct grate *grate, const char *path,
+			    enum pixel_format format,
+			    enum layout_format layout, unsigned level,
+			    unsigned width, unsigned height,
+			    struct grate_texture_key *key)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	if (!grate->texture_cache_dir)
+		return -ENOENT;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) || st.st_size == 0) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (data == MAP_FAILED)
+		return -errno;
+
+	key->hash = texture_cache_hash(data, st.st_size);
+	key->format = format;
+	key->layout = layout;
+	key->level = level;
+	key->width = width;
+	key->height = height;
+
+	munmap(data, st.st_size);
+
+	return 0;
+}
+
+static void texture_cache_path(struct grate *grate,
+			       const struct grate_texture_key *key,
+			       char *path, size_t size)
+{
+	snprintf(path, size, "%s/%016llx-%08x-%u-%u-%ux%u",
+		 grate->texture_cache_dir, (unsigned long long)key->hash,
+		 key->format, key->layout, key->level,
+		 key->width, key->height);
+}
+
+int grate_texture_cache_load(struct grate *grate,
+			     const struct grate_texture_key *key,
+			     struct grate_image *img)
+{
+	const struct texture_cache_header *hdr;
+	char path[PATH_MAX];
+	struct stat st;
+	void *map;
+	int fd;
+
+	texture_cache_path(grate, key, path, sizeof(path));
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -ENOENT;
+
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(*hdr)) {
+		close(fd);
+		return -EINVAL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+		return -errno;
+
+	hdr = map;
+
+	if (hdr->magic != TEXTURE_CACHE_MAGIC ||
+	    hdr->version != TEXTURE_CACHE_VERSION ||
+	    hdr->hash != key->hash || hdr->format != key->format ||
+	    hdr->layout != key->layout || hdr->level != key->level ||
+	    hdr->size != st.st_size - sizeof(*hdr)) {
+		munmap(map, st.st_size);
+		return -EINVAL;
+	}
+
+	img->data = (void *)(hdr + 1);
+	img->width = hdr->width;
+	img->height = hdr->height;
+	img->bpp = 0;
+	img->pitch = hdr->pitch;
+	img->size = hdr->size;
+	img->map = map;
+	img->map_size = st.st_size;
+
+	grate_info("texture cache hit %s\n", path);
+
+	return 0;
+}
+
+void grate_texture_cache_store(struct grate *grate,
+			       const struct grate_texture_key *key,
+			       const struct grate_image *img)
+{
+	struct texture_cache_header hdr;
+	char path[PATH_MAX], tmp[PATH_MAX + 32];
+	FILE *fp;
+	int err;
+
+	err = texture_cache_mkdir(grate->texture_cache_dir);
+	if (err) {
+		grate_error("failed to create %s: %d\n",
+			    grate->texture_cache_dir, err);
+		return;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TEXTURE_CACHE_MAGIC;
+	hdr.version = TEXTURE_CACHE_VERSION;
+	hdr.hash = key->hash;
+	hdr.format = key->format;
+	hdr.layout = key->layout;
+	hdr.level = key->level;
+	hdr.width = img->width;
+	hdr.height = img->height;
+	hdr.pitch = img->pitch;
+	hdr.size = img->size;
+
+	texture_cache_path(grate, key, path, sizeof(path));
+
+	/* readers never see a partial entry */
+	snprintf(tmp, sizeof(tmp), "%s.%d.%ld", path, getpid(),
+		 (long)syscall(SYS_gettid));
+
+	fp = fopen(tmp, "wb");
+	if (!fp)
+		return;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+	    fwrite(img->data, img->size, 1, fp) != 1) {
+		fclose(fp);
+		unlink(tmp);
+		return;
+	}
+
+	if (fclose(fp) || rename(tmp, path))
+		unlink(tmp);
+}
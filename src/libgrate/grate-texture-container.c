@@ -0,0 +1,649 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "etc1.h"
+#include "grate.h"
+#include "grate-3d.h"
+
+#include "libgrate-private.h"
+
+/*
+ * Loaders for pre-compressed KTX, PKM and DDS files. The file is mapped
+ * and every level is copied to the base texture or to its place in the
+ * mipmap BO, only the ETC1 blocks get their words swapped the way GR3D
+ * wants them.
+ *
+ * The files store the top row first, while images decoded from PNG etc.
+ * are flipped to GR3D's bottom-left origin. Levels are therefore flipped
+ * while copying, by reversing the block rows and the pixel rows within
+ * every block, which needs no re-encoding except for the odd ETC1 block.
+ * KTX files whose KTXorientation says "T=u" are bottom-up already. Top-down
+ * compressed levels that span several block rows without being a whole
+ * number of them high are rejected.
+ */
+
+#define CONTAINER_MAX_LEVELS	16
+
+#define KTX_HEADER_SIZE		64
+#define KTX_ENDIANNESS		0x04030201
+#define KTX_ORIENTATION_KEY	"KTXorientation"
+
+#define GL_UNSIGNED_BYTE			0x1401
+#define GL_RGBA					0x1908
+#define GL_RGBA8				0x8058
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT		0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT	0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT	0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT	0x83F3
+#define GL_ETC1_RGB8_OES			0x8D64
+
+#define DDS_MAGIC		0x20534444
+#define DDS_HEADER_SIZE		124
+#define DDS_PIXELFORMAT_SIZE	32
+#define DDSD_MIPMAPCOUNT	0x20000
+#define DDPF_FOURCC		0x4
+#define DDPF_RGB		0x40
+#define DDPF_ALPHAPIXELS	0x1
+
+#define FOURCC(a, b, c, d) \
+	((uint32_t)(a) | (uint32_t)(b) << 8 | \
+	 (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+struct container_level {
+	const void *data;
+	unsigned long size;
+};
+
+struct container {
+	enum pixel_format format;
+	bool bottom_up;
+	unsigned width;
+	unsigned height;
+	unsigned num_levels;
+	struct container_level levels[CONTAINER_MAX_LEVELS];
+};
+
+static const uint8_t ktx_identifier[12] = {
+	0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n',
+};
+
+static uint32_t read_u32(const void *ptr)
+{
+	uint32_t value;
+
+	memcpy(&value, ptr, sizeof(value));
+
+	return value;
+}
+
+static unsigned long level_size(enum pixel_format format,
+				unsigned width, unsigned height)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(format);
+
+	return (unsigned long)(ALIGN(width, tw) / tw) *
+	       (ALIGN(height, th) / th) * PIX_BUF_FORMAT_BYTES(format);
+}
+
+static int container_add_level(struct container *c, const void *data,
+			       unsigned long size)
+{
+	unsigned level = c->num_levels;
+	unsigned long expected;
+
+	expected = level_size(c->format, MAX(c->width >> level, 1),
+			      MAX(c->height >> level, 1));
+	if (size < expected) {
+		grate_error("level %u is truncated: %lu < %lu\n",
+			    level, size, expected);
+		return -EINVAL;
+	}
+
+	c->levels[level].data = data;
+	c->levels[level].size = expected;
+	c->num_levels++;
+
+	return 0;
+}
+
+static int container_parse_pkm(struct container *c, const void *map,
+			       size_t size)
+{
+	if (size < ETC_PKM_HEADER_SIZE || !etc1_pkm_is_valid(map))
+		return -EINVAL;
+
+	c->format = PIX_BUF_FMT_ETC1;
+	c->width = etc1_pkm_get_width(map);
+	c->height = etc1_pkm_get_height(map);
+
+	if (!c->width || !c->height)
+		return -EINVAL;
+
+	return container_add_level(c, map + ETC_PKM_HEADER_SIZE,
+				   size - ETC_PKM_HEADER_SIZE);
+}
+
+/* looks for a KTXorientation key saying that T points up */
+static bool ktx_bottom_up(const char *kv, unsigned long size)
+{
+	unsigned long offset = 0, len;
+	size_t key_len = sizeof(KTX_ORIENTATION_KEY);
+	unsigned long i;
+
+	while (offset + 4 <= size) {
+		len = read_u32(kv + offset);
+		offset += 4;
+
+		if (len > size - offset)
+			break;
+
+		if (len > key_len &&
+		    !memcmp(kv + offset, KTX_ORIENTATION_KEY, key_len)) {
+			for (i = offset + key_len; i + 3 <= offset + len; i++)
+				if (!memcmp(kv + i, "T=u", 3))
+					return true;
+
+			return false;
+		}
+
+		offset += ALIGN(len, 4);
+	}
+
+	return false;
+}
+
+static int container_parse_ktx(struct container *c, const void *map,
+			       size_t size)
+{
+	const uint32_t *hdr = map + sizeof(ktx_identifier);
+	uint32_t gl_type, gl_format, gl_internal_format;
+	unsigned long offset;
+	unsigned i, levels;
+	int err;
+
+	if (size < KTX_HEADER_SIZE)
+		return -EINVAL;
+
+	if (read_u32(&hdr[0]) != KTX_ENDIANNESS) {
+		grate_error("big endian KTX files are not supported\n");
+		return -EINVAL;
+	}
+
+	gl_type = read_u32(&hdr[1]);
+	gl_format = read_u32(&hdr[3]);
+	gl_internal_format = read_u32(&hdr[4]);
+
+	switch (gl_internal_format) {
+	case GL_ETC1_RGB8_OES:
+		c->format = PIX_BUF_FMT_ETC1;
+		break;
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		c->format = PIX_BUF_FMT_DXT1;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+		c->format = PIX_BUF_FMT_DXT3;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		c->format = PIX_BUF_FMT_DXT5;
+		break;
+	case GL_RGBA:
+	case GL_RGBA8:
+		if (gl_type == GL_UNSIGNED_BYTE && gl_format == GL_RGBA) {
+			c->format = PIX_BUF_FMT_RGBA8888;
+			break;
+		}
+		/* fall through */
+	default:
+		grate_error("unsupported KTX format 0x%04X\n",
+			    gl_internal_format);
+		return -EINVAL;
+	}
+
+	c->width = read_u32(&hdr[6]);
+	c->height = read_u32(&hdr[7]);
+
+	if (!c->width || !c->height || read_u32(&hdr[8]) ||
+	    read_u32(&hdr[9]) || read_u32(&hdr[10]) != 1) {
+		grate_error("only plain 2D KTX textures are supported\n");
+		return -EINVAL;
+	}
+
+	levels = MAX(read_u32(&hdr[11]), 1);
+	levels = MIN(levels, CONTAINER_MAX_LEVELS);
+	offset = KTX_HEADER_SIZE + (unsigned long)read_u32(&hdr[12]);
+
+	if (offset > size)
+		return -EINVAL;
+
+	c->bottom_up = ktx_bottom_up(map + KTX_HEADER_SIZE,
+				     offset - KTX_HEADER_SIZE);
+
+	for (i = 0; i < levels; i++) {
+		uint32_t image_size;
+
+		if (offset + 4 > size)
+			return -EINVAL;
+
+		image_size = read_u32(map + offset);
+		offset += 4;
+
+		if (image_size > size - offset)
+			return -EINVAL;
+
+		err = container_add_level(c, map + offset, image_size);
+		if (err)
+			return err;
+
+		offset += ALIGN(image_size, 4);
+	}
+
+	return 0;
+}
+
+static int container_parse_dds(struct container *c, const void *map,
+			       size_t size)
+{
+	const uint32_t *hdr = map + 4;
+	const uint32_t *pf = &hdr[18];
+	unsigned long offset = 4 + DDS_HEADER_SIZE;
+	unsigned i, levels = 1;
+	unsigned long level;
+	uint32_t flags;
+	int err;
+
+	if (size < offset || read_u32(&hdr[0]) != DDS_HEADER_SIZE ||
+	    read_u32(&pf[0]) != DDS_PIXELFORMAT_SIZE)
+		return -EINVAL;
+
+	flags = read_u32(&pf[1]);
+
+	if (flags & DDPF_FOURCC) {
+		switch (read_u32(&pf[2])) {
+		case FOURCC('D', 'X', 'T', '1'):
+			c->format = PIX_BUF_FMT_DXT1;
+			break;
+		case FOURCC('D', 'X', 'T', '3'):
+			c->format = PIX_BUF_FMT_DXT3;
+			break;
+		case FOURCC('D', 'X', 'T', '5'):
+			c->format = PIX_BUF_FMT_DXT5;
+			break;
+		default:
+			grate_error("unsupported DDS FourCC 0x%08X\n",
+				    read_u32(&pf[2]));
+			return -EINVAL;
+		}
+	} else if ((flags & (DDPF_RGB | DDPF_ALPHAPIXELS)) ==
+					(DDPF_RGB | DDPF_ALPHAPIXELS) &&
+		   read_u32(&pf[3]) == 32 &&
+		   read_u32(&pf[4]) == 0x000000ff &&
+		   read_u32(&pf[5]) == 0x0000ff00 &&
+		   read_u32(&pf[6]) == 0x00ff0000 &&
+		   read_u32(&pf[7]) == 0xff000000) {
+		c->format = PIX_BUF_FMT_RGBA8888;
+	} else {
+		grate_error("unsupported DDS pixel format\n");
+		return -EINVAL;
+	}
+
+	c->height = read_u32(&hdr[2]);
+	c->width = read_u32(&hdr[3]);
+
+	if (!c->width || !c->height)
+		return -EINVAL;
+
+	if (read_u32(&hdr[1]) & DDSD_MIPMAPCOUNT)
+		levels = MAX(read_u32(&hdr[6]), 1);
+
+	levels = MIN(levels, CONTAINER_MAX_LEVELS);
+
+	for (i = 0; i < levels; i++) {
+		level = level_size(c->format, MAX(c->width >> i, 1),
+				   MAX(c->height >> i, 1));
+
+		if (offset > size)
+			return -EINVAL;
+
+		err = container_add_level(c, map + offset, size - offset);
+		if (err)
+			return err;
+
+		offset += level;
+	}
+
+	return 0;
+}
+
+static void swap_bytes(uint8_t *a, uint8_t *b)
+{
+	uint8_t tmp = *a;
+
+	*a = *b;
+	*b = tmp;
+}
+
+/* reverses the order of n rows of one byte, or of n rows of size bytes */
+static void flip_rows(uint8_t *rows, unsigned size, unsigned n)
+{
+	unsigned r, i;
+
+	for (r = 0; r < n / 2; r++)
+		for (i = 0; i < size; i++)
+			swap_bytes(&rows[r * size + i],
+				   &rows[(n - 1 - r) * size + i]);
+}
+
+/* DXT5 alpha indices are 4 rows of 12 bits in a 48-bit little endian word */
+static void flip_dxt5_alpha(uint8_t *bits, unsigned n)
+{
+	uint64_t word = 0, flipped = 0;
+	unsigned r, i;
+
+	for (i = 0; i < 6; i++)
+		word |= (uint64_t)bits[i] << (i * 8);
+
+	for (r = 0; r < 4; r++) {
+		unsigned from = r < n ? n - 1 - r : r;
+
+		flipped |= ((word >> (from * 12)) & 0xfff) << (r * 12);
+	}
+
+	for (i = 0; i < 6; i++)
+		bits[i] = flipped >> (i * 8);
+}
+
+static void etc1_reencode_flipped(uint8_t *block, unsigned n)
+{
+	etc1_byte pixels[ETC1_DECODED_BLOCK_SIZE];
+
+	etc1_decode_block(block, pixels);
+	flip_rows(pixels, 4 * 3, n);
+	etc1_encode_block(pixels, 0xffff, block);
+}
+
+/*
+ * Flipping a block whose sub-blocks are stacked vertically swaps the
+ * sub-blocks. In differential mode that negates the colour delta, which
+ * doesn't fit if it was -4 and the block has to be re-encoded.
+ */
+static void flip_etc1(uint8_t *block, unsigned n)
+{
+	bool diff = block[3] & 0x2;
+	bool stacked = block[3] & 0x1;
+	unsigned i, x, r;
+
+	if (stacked && n > 2) {
+		if (n != 4) {
+			etc1_reencode_flipped(block, n);
+			return;
+		}
+
+		for (i = 0; i < 3; i++) {
+			int delta = (int8_t)(block[i] << 5) >> 5;
+
+			if (diff && delta == -4) {
+				etc1_reencode_flipped(block, n);
+				return;
+			}
+		}
+
+		for (i = 0; i < 3; i++) {
+			if (diff) {
+				int base = block[i] >> 3;
+				int delta = (int8_t)(block[i] << 5) >> 5;
+
+				block[i] = (base + delta) << 3 | (-delta & 0x7);
+			} else {
+				block[i] = block[i] << 4 | block[i] >> 4;
+			}
+		}
+
+		block[3] = (block[3] & 0xe0) >> 3 | (block[3] & 0x1c) << 3 |
+			   (block[3] & 0x03);
+	}
+
+	/* index bit x * 4 + y of the MSB and LSB planes */
+	for (i = 4; i < 8; i += 2) {
+		uint16_t plane = block[i] << 8 | block[i + 1];
+		uint16_t flipped = 0;
+
+		for (x = 0; x < 4; x++) {
+			for (r = 0; r < 4; r++) {
+				unsigned from = r < n ? n - 1 - r : r;
+
+				if (plane & (1 << (x * 4 + from)))
+					flipped |= 1 << (x * 4 + r);
+			}
+		}
+
+		block[i] = flipped >> 8;
+		block[i + 1] = flipped;
+	}
+}
+
+/* reverses the first n pixel rows of a 4x4 block */
+static void flip_block(enum pixel_format format, uint8_t *block, unsigned n)
+{
+	switch (format) {
+	case PIX_BUF_FMT_DXT1:
+		flip_rows(block + 4, 1, n);
+		break;
+	case PIX_BUF_FMT_DXT3:
+		flip_rows(block, 2, n);
+		flip_rows(block + 12, 1, n);
+		break;
+	case PIX_BUF_FMT_DXT5:
+		flip_dxt5_alpha(block + 2, n);
+		flip_rows(block + 12, 1, n);
+		break;
+	case PIX_BUF_FMT_ETC1:
+		flip_etc1(block, n);
+		break;
+	default:
+		break;
+	}
+}
+
+static int container_copy_level(struct host1x_pixelbuffer *pixbuf,
+				const struct container_level *level,
+				bool flip)
+{
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+	unsigned bytes = PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	unsigned rows = ALIGN(pixbuf->height, th) / th;
+	unsigned src_pitch = level->size / rows;
+	unsigned block_rows = th;
+	const uint8_t *src;
+	uint8_t block[16];
+	uint8_t *map, *dst;
+	unsigned y, i;
+	int err;
+
+	/*
+	 * Rows can't be moved across blocks, so only levels that are a
+	 * whole number of blocks high or fit into a single one are flipped.
+	 */
+	if (flip && th > 1 && pixbuf->height % th) {
+		if (rows > 1) {
+			grate_error("can't flip %u rows high compressed level\n",
+				    pixbuf->height);
+			return -EINVAL;
+		}
+
+		block_rows = pixbuf->height;
+	}
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, (void **)&map);
+	if (err)
+		return err;
+
+	dst = map + pixbuf->bo->offset;
+
+	for (y = 0; y < rows; y++) {
+		src = level->data;
+		src += (flip ? rows - 1 - y : y) * src_pitch;
+
+		if (th == 1) {
+			memcpy(dst, src, src_pitch);
+			dst += pixbuf->pitch;
+			continue;
+		}
+
+		for (i = 0; i + bytes <= src_pitch; i += bytes) {
+			memcpy(block, src + i, bytes);
+
+			if (flip)
+				flip_block(pixbuf->format, block, block_rows);
+
+			if (pixbuf->format == PIX_BUF_FMT_ETC1) {
+				uint64_t word;
+
+				memcpy(&word, block, 8);
+				word = grate_etc1_swap_block(word);
+				memcpy(block, &word, 8);
+			}
+
+			memcpy(dst + i, block, bytes);
+		}
+
+		dst += pixbuf->pitch;
+	}
+
+	return HOST1X_BO_FLUSH(pixbuf->bo, pixbuf->bo->offset,
+			       pixbuf->pitch * rows);
+}
+
+static int container_upload(struct grate *grate, struct grate_texture *tex,
+			    const struct container *c)
+{
+	struct host1x_pixelbuffer dst_pixbuf;
+	unsigned lod, max_lod;
+	int err;
+
+	err = container_copy_level(tex->pixbuf, &c->levels[0], !c->bottom_up);
+	if (err || c->num_levels == 1)
+		return err;
+
+	if ((c->width & (c->width - 1)) || (c->height & (c->height - 1))) {
+		grate_info("NPOT texture %ux%u, ignoring its mip levels\n",
+			   c->width, c->height);
+		return 0;
+	}
+
+	err = grate_texture_alloc_mipmap(grate, tex);
+	if (err)
+		return err;
+
+	max_lod = MIN(c->num_levels - 1, tex->max_lod);
+
+	for (lod = 0; lod <= max_lod; lod++) {
+		grate_texture_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf, lod);
+		err = container_copy_level(&dst_pixbuf, &c->levels[lod],
+					   !c->bottom_up);
+		host1x_bo_free(dst_pixbuf.bo);
+
+		if (err)
+			return err;
+	}
+
+	tex->max_lod = max_lod;
+
+	return 0;
+}
+
+struct grate_texture *grate_texture_load_container(struct grate *grate,
+						   const char *path)
+{
+	struct grate_texture *tex = NULL;
+	struct container c = { 0 };
+	struct stat st;
+	void *map;
+	int fd, err;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		grate_error("failed to open \"%s\": %s\n", path,
+			    strerror(errno));
+		return NULL;
+	}
+
+	if (fstat(fd, &st) < 0 || st.st_size < 4) {
+		grate_error("invalid file \"%s\"\n", path);
+		close(fd);
+		return NULL;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) {
+		grate_error("failed to map \"%s\": %s\n", path,
+			    strerror(errno));
+		return NULL;
+	}
+
+	if (st.st_size >= (off_t)sizeof(ktx_identifier) &&
+	    !memcmp(map, ktx_identifier, sizeof(ktx_identifier)))
+		err = container_parse_ktx(&c, map, st.st_size);
+	else if (read_u32(map) == DDS_MAGIC)
+		err = container_parse_dds(&c, map, st.st_size);
+	else
+		err = container_parse_pkm(&c, map, st.st_size);
+
+	if (err)
+		goto out;
+
+	grate_info("\"%s\": %ux%u format 0x%08X, %u level(s)\n",
+		   path, c.width, c.height, c.format, c.num_levels);
+
+	tex = grate_create_texture(grate, c.width, c.height, c.format,
+				   PIX_BUF_LAYOUT_LINEAR);
+	if (!tex) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	err = container_upload(grate, tex, &c);
+	if (err) {
+		grate_texture_free(tex);
+		tex = NULL;
+	}
+
+out:
+	munmap(map, st.st_size);
+
+	if (err)
+		grate_error("failed to load \"%s\": %d\n", path, err);
+
+	return tex;
+}
@@ -22,9 +22,12 @@
  */
 
 #include <assert.h>
-#include <byteswap.h>
+#include <errno.h>
+#include <pthread.h>
 #include <string.h>
 
+#include <sys/mman.h>
+
 #include <IL/il.h>
 #include <IL/ilu.h>
 
@@ -83,34 +86,44 @@ struct grate_texture *grate_create_texture(struct grate *grate,
 		return NULL;
 	}
 
+	grate_residency_add_texture(grate, tex);
+
 	return tex;
 }
 
-static int grate_texture_load_internal(struct grate *grate,
-				       struct grate_texture **tex,
-				       const char *path, bool create,
-				       enum pixel_format format,
-				       enum layout_format layout)
+/*
+ * DevIL keeps the bound image in global state, everything touching it
+ * is serialised so that the asynchronous loader can decode from several
+ * threads.
+ */
+static pthread_once_t il_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t il_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void grate_il_init(void)
 {
-	unsigned tex_pitch;
-	unsigned tex_bpp;
-	unsigned tw, bpp;
-	void *tex_data;
-	ILuint tex_size;
+	ilInit();
+}
+
+int grate_image_decode(const char *path, enum pixel_format format,
+		       unsigned width, unsigned height,
+		       struct grate_image *img)
+{
+	unsigned bpp, pitch, y;
 	ILuint ImageTex;
 	ILenum il_fmt;
-	unsigned i;
+	void *data;
 	int err;
 
-	grate_info("loading \"%s\" pixbuf format 0x%08x layout %u\n",
-		   path, format, layout);
+	grate_info("loading \"%s\" pixbuf format 0x%08x\n", path, format);
 
 	if (format == PIX_BUF_FMT_ETC1)
 		il_fmt = IL_RGB;
 	else
 		il_fmt = IL_RGBA;
 
-	ilInit();
+	pthread_once(&il_once, grate_il_init);
+	pthread_mutex_lock(&il_lock);
+
 	ilGenImages(1, &ImageTex);
 	ilBindImage(ImageTex);
 	ilLoadImage(path);
@@ -122,140 +135,321 @@ static int grate_texture_load_internal(struct grate *grate,
 		goto out;
 	}
 
-	if (create) {
-		*tex = grate_create_texture(grate,
-					    ilGetInteger(IL_IMAGE_WIDTH),
-					    ilGetInteger(IL_IMAGE_HEIGHT),
-					    format, layout);
-		if (!(*tex)) {
-			err = -12;
+	if (width && height) {
+		iluScale(width, height, 0);
+
+		err = ilGetError();
+		if (err != IL_NO_ERROR) {
+			grate_error("\"%s\" scale failed 0x%04X\n", path, err);
 			goto out;
 		}
-	} else {
-		iluScale((*tex)->pixbuf->width, (*tex)->pixbuf->height, 0);
 	}
 
-	/*
-	 * ilOriginFunc() doesn't work properly in conjunction with
-	 * ilCompressDXT(), image isn't rotated and colors are shifted.
-	 *
-	 * Note that iluRotate(180) only flips vertically! It's a DevIL's
-	 * oddity that comes handy here.
-	 */
-	iluRotate(180.0f);
+	img->width  = ilGetInteger(IL_IMAGE_WIDTH);
+	img->height = ilGetInteger(IL_IMAGE_HEIGHT);
+	bpp         = ilGetInteger(IL_IMAGE_BYTES_PER_PIXEL);
+	pitch       = img->width * bpp;
 
-	err = ilGetError();
-	if (err != IL_NO_ERROR) {
-		grate_error("\"%s\" load failed 0x%04X\n", path, err);
+	img->data = malloc(pitch * img->height);
+	if (!img->data) {
+		err = -ENOMEM;
 		goto out;
 	}
 
-	tex_data  = ilGetData();
-	tex_size  = ilGetInteger(IL_IMAGE_SIZE_OF_DATA);
-	tex_bpp   = ilGetInteger(IL_IMAGE_BYTES_PER_PIXEL);
-	tex_pitch = ilGetInteger(IL_IMAGE_WIDTH) * tex_bpp;
+	/* flip vertically to GR3D's origin while copying out of DevIL */
+	data = ilGetData();
 
-	if (PIX_BUF_FORMAT_COMPRESSED(format)) {
-		etc1_byte *etc1_data;
-		ILenum DXTCFormat;
-		ILuint dxtSize;
+	for (y = 0; y < img->height; y++)
+		memcpy(img->data + y * pitch,
+		       data + (img->height - 1 - y) * pitch, pitch);
 
-		switch (format) {
-		case PIX_BUF_FMT_DXT1:
-			grate_info("compressing data to DXT1\n");
-			DXTCFormat = IL_DXT1;
-			break;
-		case PIX_BUF_FMT_DXT3:
-			grate_info("compressing data to DXT3\n");
-			DXTCFormat = IL_DXT3;
-			break;
-		case PIX_BUF_FMT_DXT5:
-			grate_info("compressing data to DXT5\n");
-			DXTCFormat = IL_DXT5;
-			break;
-		case PIX_BUF_FMT_ETC1:
-			grate_info("compressing data to ETC1\n");
-			dxtSize = etc1_get_encoded_data_size(
-						ilGetInteger(IL_IMAGE_WIDTH),
-						ilGetInteger(IL_IMAGE_HEIGHT));
-
-			etc1_data = malloc(dxtSize);
-			if (!etc1_data) {
-				err = -1;
-				goto out;
-			}
-
-			err = etc1_encode_image(tex_data,
-						ilGetInteger(IL_IMAGE_WIDTH),
-						ilGetInteger(IL_IMAGE_HEIGHT),
-						tex_bpp, tex_pitch, etc1_data);
-			if (err)
-				goto err_compression;
-
-			/* Tegra's GR3D uses a different layout for ETC1 data */
-			for (i = 0; i < dxtSize / 8; i++) {
-				uint64_t *etc1_word64 = (uint64_t*) etc1_data;
-				uint64_t a = bswap_32(etc1_word64[i] >> 32);
-				uint64_t b = bswap_32(etc1_word64[i]);
-
-				etc1_word64[i] = (b << 32) | a;
-			}
-
-			tex_data = etc1_data;
-
-			goto done_compression;
-		default:
-			grate_error("\"%s\" unsupported compression format %u\n",
-				    path, format);
-			err = -1;
-			goto out;
-		}
+	img->bpp = bpp;
+	img->pitch = pitch;
+	img->size = pitch * img->height;
+out:
+	ilDeleteImage(ImageTex);
+	pthread_mutex_unlock(&il_lock);
 
-		ilEnable(IL_SQUISH_COMPRESS);
+	return err;
+}
 
-		tex_data = ilCompressDXT(tex_data,
-					 ilGetInteger(IL_IMAGE_WIDTH),
-					 ilGetInteger(IL_IMAGE_HEIGHT), 1,
-					 DXTCFormat, &dxtSize);
-		err = ilGetError();
-err_compression:
-		if (err != IL_NO_ERROR) {
-			grate_error("\"%s\" compression failed 0x%04X\n",
-				    path, err);
+static int grate_image_compress_etc1(struct grate_image *img,
+				     unsigned num_threads)
+{
+	uint64_t *etc1_word64;
+	etc1_byte *etc1_data;
+	unsigned long size;
+	unsigned long i;
+	int err;
+
+	size = etc1_get_encoded_data_size(img->width, img->height);
+
+	etc1_data = malloc(size);
+	if (!etc1_data)
+		return -ENOMEM;
+
+	err = etc1_encode_image_quality(img->data, img->width, img->height,
+					img->bpp, img->pitch, etc1_data,
+					ETC1_QUALITY_HIGH, num_threads);
+	if (err) {
+		free(etc1_data);
+		return err;
+	}
+
+	etc1_word64 = (uint64_t *)etc1_data;
+
+	for (i = 0; i < size / 8; i++)
+		etc1_word64[i] = grate_etc1_swap_block(etc1_word64[i]);
+
+	free(img->data);
+	img->data = etc1_data;
+	img->size = size;
+
+	return 0;
+}
+
+static int grate_image_compress_dxt(struct grate_image *img,
+				    enum pixel_format format,
+				    unsigned num_threads)
+{
+	unsigned pitch = ALIGN(img->width, 4) / 4 *
+			 PIX_BUF_FORMAT_BYTES(format);
+	unsigned long size = pitch * (ALIGN(img->height, 4) / 4);
+	void *dxt_data;
+	int err;
+
+	dxt_data = malloc(size);
+	if (!dxt_data)
+		return -ENOMEM;
+
+	err = grate_dxt_encode(img->data, img->width, img->height,
+			       img->pitch, format, dxt_data, pitch,
+			       num_threads);
+	if (err) {
+		free(dxt_data);
+		return err;
+	}
+
+	free(img->data);
+	img->data = dxt_data;
+	img->size = size;
+
+	return 0;
+}
+
+int grate_image_compress(struct grate_image *img, enum pixel_format format,
+			 unsigned num_threads)
+{
+	unsigned long size = img->size;
+	unsigned tw, bpp;
+	int err;
+
+	switch (format) {
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		grate_info("compressing data to DXT%u\n",
+			   format == PIX_BUF_FMT_DXT1 ? 1 :
+			   format == PIX_BUF_FMT_DXT3 ? 3 : 5);
+		err = grate_image_compress_dxt(img, format, num_threads);
+		break;
+	case PIX_BUF_FMT_ETC1:
+		grate_info("compressing data to ETC1\n");
+		err = grate_image_compress_etc1(img, num_threads);
+		break;
+	default:
+		if (!PIX_BUF_FORMAT_COMPRESSED(format))
+			return 0;
+
+		grate_error("unsupported compression format %u\n", format);
+		return -1;
+	}
+
+	if (err) {
+		grate_error("compression failed 0x%04X\n", err);
+		return err;
+	}
+
+	grate_info("compressed size %lu -> %lu\n", size, img->size);
+
+	tw         = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+	bpp        = PIX_BUF_FORMAT_BYTES(format);
+	img->pitch = ALIGN(img->width, tw) / tw * bpp;
+
+	return 0;
+}
+
+int grate_image_upload(struct grate *grate, struct grate_texture **tex,
+		       const struct grate_image *img, bool create,
+		       enum pixel_format format, enum layout_format layout)
+{
+	if (create) {
+		*tex = grate_create_texture(grate, img->width, img->height,
+					    format, layout);
+		if (!(*tex))
+			return -ENOMEM;
+	}
+
+	return host1x_pixelbuffer_load_data(grate->host1x, (*tex)->pixbuf,
+					    img->data, img->pitch, img->size,
+					    format, PIX_BUF_LAYOUT_LINEAR);
+}
+
+void grate_image_free(struct grate_image *img)
+{
+	if (img->map)
+		munmap(img->map, img->map_size);
+	else
+		free(img->data);
+
+	img->data = NULL;
+	img->map = NULL;
+}
+
+/*
+ * Linear DXT textures are encoded straight into the mapped BO, which
+ * saves the staging buffer and the copy into the BO.
+ */
+static int grate_texture_encode_dxt(struct grate *grate,
+				    struct grate_texture **tex,
+				    const struct grate_image *img, bool create,
+				    enum pixel_format format,
+				    enum layout_format layout,
+				    const struct grate_texture_key *key)
+{
+	struct host1x_pixelbuffer *pixbuf;
+	void *map;
+	int err;
+
+	if (create) {
+		*tex = grate_create_texture(grate, img->width, img->height,
+					    format, layout);
+		if (!(*tex))
+			return -ENOMEM;
+	}
+
+	pixbuf = (*tex)->pixbuf;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &map);
+	if (err)
+		return err;
+
+	err = grate_dxt_encode(img->data, img->width, img->height,
+			       img->pitch, format, map + pixbuf->bo->offset,
+			       pixbuf->pitch, 0);
+	if (err)
+		return err;
+
+	if (key) {
+		struct grate_image encoded = {
+			.data = map + pixbuf->bo->offset,
+			.width = img->width,
+			.height = img->height,
+			.pitch = pixbuf->pitch,
+			.size = pixbuf->pitch * (ALIGN(img->height, 4) / 4),
+		};
+
+		grate_texture_cache_store(grate, key, &encoded);
+	}
+
+	return HOST1X_BO_FLUSH(pixbuf->bo, pixbuf->bo->offset,
+			       pixbuf->pitch * (ALIGN(img->height, 4) / 4));
+}
+
+static int grate_texture_load_internal(struct grate *grate,
+				       struct grate_texture **tex,
+				       const char *path, bool create,
+				       enum pixel_format format,
+				       enum layout_format layout)
+{
+	struct grate_texture_key key, *cache_key = NULL;
+	struct grate_image img = { 0 };
+	unsigned width = 0, height = 0;
+	int err;
+
+	if (!create) {
+		width = (*tex)->pixbuf->width;
+		height = (*tex)->pixbuf->height;
+	}
+
+	if (!grate_texture_cache_key(grate, path, format, layout, 0,
+				     width, height, &key)) {
+		cache_key = &key;
+
+		if (!grate_texture_cache_load(grate, &key, &img)) {
+			err = grate_image_upload(grate, tex, &img, create,
+						 format, layout);
 			goto out;
 		}
-done_compression:
-		grate_info("compressed \"%s\" size tex_size %u -> %u\n",
-			   path, tex_size, dxtSize);
-
-		tw        = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
-		bpp       = PIX_BUF_FORMAT_BYTES(format);
-		tex_pitch = ALIGN(ilGetInteger(IL_IMAGE_WIDTH), tw) / tw * bpp;
-		tex_size  = dxtSize;
 	}
 
-	err = host1x_pixelbuffer_load_data(grate->host1x, (*tex)->pixbuf,
-					   tex_data, tex_pitch, tex_size,
-					   format, PIX_BUF_LAYOUT_LINEAR);
-out:
-	ilDeleteImage(ImageTex);
+	err = grate_image_decode(path, format, width, height, &img);
+	if (err)
+		goto out;
 
+	switch (format) {
+	case PIX_BUF_FMT_DXT1:
+	case PIX_BUF_FMT_DXT3:
+	case PIX_BUF_FMT_DXT5:
+		if (layout != PIX_BUF_LAYOUT_LINEAR)
+			break;
+
+		err = grate_texture_encode_dxt(grate, tex, &img, create,
+					       format, layout, cache_key);
+		goto out;
+	default:
+		break;
+	}
+
+	err = grate_image_compress(&img, format, 0);
 	if (err)
+		goto out;
+
+	if (cache_key)
+		grate_texture_cache_store(grate, cache_key, &img);
+
+	err = grate_image_upload(grate, tex, &img, create, format, layout);
+out:
+	grate_image_free(&img);
+
+	if (err) {
 		grate_error("failed to load \"%s\"\n", path);
-	else
-		grate_info("loaded \"%s\"\n", path);
+		return err;
+	}
 
-	return err;
+	grate_info("loaded \"%s\"\n", path);
+
+	/* an unmodified texture is reloaded rather than spilled on eviction */
+	if ((*tex)->source_path != path) {
+		free((*tex)->source_path);
+		(*tex)->source_path = strdup(path);
+	}
+
+	return 0;
 }
 
 int grate_texture_load(struct grate *grate, struct grate_texture *tex,
 		       const char *path)
 {
+	int err;
+
+	err = grate_texture_make_resident(tex);
+	if (err)
+		return err;
+
 	return grate_texture_load_internal(grate, &tex, path, false,
 					   tex->pixbuf->format,
 					   tex->pixbuf->layout);
 }
 
+/* used to restore an evicted texture, doesn't touch residency state */
+int grate_texture_reload(struct grate *grate, struct grate_texture *tex)
+{
+	return grate_texture_load_internal(grate, &tex, tex->source_path,
+					   false, tex->pixbuf->format,
+					   tex->pixbuf->layout);
+}
+
 struct grate_texture *grate_create_texture2(struct grate *grate,
 					    const char *path,
 					    enum pixel_format format,
@@ -274,11 +468,23 @@ struct grate_texture *grate_create_texture2(struct grate *grate,
 
 struct host1x_pixelbuffer *grate_texture_pixbuf(struct grate_texture *tex)
 {
+	if (grate_texture_make_resident(tex))
+		return NULL;
+
+	/* the caller holds on to the pixbuf, it has to stay put */
+	tex->pinned = true;
+
 	return tex->pixbuf;
 }
 
 void grate_texture_free(struct grate_texture *tex)
 {
+	if (tex->grate)
+		grate_residency_remove_texture(tex);
+
+	if (tex->mipmap_pixbuf)
+		host1x_pixelbuffer_free(tex->mipmap_pixbuf);
+
 	host1x_pixelbuffer_free(tex->pixbuf);
 	free(tex);
 }
@@ -384,6 +590,11 @@ void grate_texture_clear(struct grate *grate, struct grate_texture *tex,
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
 	int err;
 
+	if (grate_texture_make_resident(tex))
+		return;
+
+	grate_texture_modified(tex);
+
 	err = host1x_gr2d_clear(gr2d, tex->pixbuf, color);
 	if (err < 0)
 		grate_error("host1x_gr2d_clear() failed: %d\n", err);
@@ -396,19 +607,67 @@ void grate_texture_clear_rect(struct grate *grate, struct grate_texture *tex,
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
 	int err;
 
+	if (grate_texture_make_resident(tex))
+		return;
+
+	grate_texture_modified(tex);
+
 	err = host1x_gr2d_clear_rect(gr2d, tex->pixbuf, color,
 				     x, y, width, height);
 	if (err < 0)
 		grate_error("host1x_gr2d_clear() failed: %d\n", err);
 }
 
-static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
+/* mip levels aren't updated, regenerate them if needed */
+int grate_texture_update_rect(struct grate *grate, struct grate_texture *tex,
+			      unsigned x, unsigned y,
+			      unsigned width, unsigned height,
+			      const void *data, unsigned pitch)
+{
+	int err;
+
+	err = grate_texture_make_resident(tex);
+	if (err)
+		return err;
+
+	grate_texture_modified(tex);
+
+	err = host1x_pixelbuffer_update_rect(tex->pixbuf, x, y, width, height,
+					     data, pitch);
+	if (err < 0)
+		grate_error("host1x_pixelbuffer_update_rect() failed: %d\n",
+			    err);
+
+	return err;
+}
+
+/* mip levels are 16 bytes aligned rows of texels or of compressed blocks */
+static unsigned lod_pitch(enum pixel_format format, unsigned width)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(format);
+
+	return ALIGN(ALIGN(width, tw) / tw * PIX_BUF_FORMAT_BYTES(format), 16);
+}
+
+static unsigned lod_rows(struct host1x_pixelbuffer *mipmap, unsigned height)
+{
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(mipmap->format);
+	unsigned rows = ALIGN(height, th) / th;
+
+	/* tiled levels are made of whole 16x16 byte tiles */
+	if (mipmap->layout == PIX_BUF_LAYOUT_TILED_16x16)
+		rows = ALIGN(rows, 16);
+
+	return rows;
+}
+
+int grate_texture_alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 {
 	struct host1x_pixelbuffer *pixbuf = tex->pixbuf;
 	struct host1x_bo *bo;
 	unsigned log2_width, log2_height;
 	unsigned lod, lod_levels, size;
-	unsigned w, h, bpp;
+	unsigned w, h, tw;
 
 	if (!tex->pixbuf)
 		return -1;
@@ -424,8 +683,6 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 	grate_info("Texture size w: %u h: %u max LOD %u\n",
 		   pixbuf->width, pixbuf->height, lod_levels);
 
-	bpp = PIX_BUF_FORMAT_BYTES(pixbuf->format);
-
 	for (size = 0, lod = 0; lod <= lod_levels; lod++) {
 		w = MAX(1 << log2_width >> lod, 1);
 		h = MAX(1 << log2_height >> lod, 1);
@@ -433,7 +690,7 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 		grate_info("LOD %u w: %u h: %u\toffset 0x%08X\n",
 			   lod, w, h, size);
 
-		size += ALIGN(w * bpp, 16) * h;
+		size += lod_pitch(pixbuf->format, w) * lod_rows(pixbuf, h);
 	}
 
 	if (!host1x_pixelbuffer_bo_guard_disabled())
@@ -450,10 +707,13 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 	if (!tex->mipmap_pixbuf)
 		return -1;
 
+	tw = PIX_BUF_FORMAT_TEXEL_WIDTH(pixbuf->format);
+
 	tex->mipmap_pixbuf->bo     = bo;
 	tex->mipmap_pixbuf->width  = 1 << log2_width;
 	tex->mipmap_pixbuf->height = 1 << log2_height;
-	tex->mipmap_pixbuf->pitch  = tex->mipmap_pixbuf->width * bpp;
+	tex->mipmap_pixbuf->pitch  = ALIGN(tex->mipmap_pixbuf->width, tw) / tw *
+				     PIX_BUF_FORMAT_BYTES(pixbuf->format);
 	tex->mipmap_pixbuf->format = pixbuf->format;
 	tex->mipmap_pixbuf->layout = pixbuf->layout;
 
@@ -461,35 +721,49 @@ static int alloc_mipmap(struct grate *grate, struct grate_texture *tex)
 
 	host1x_pixelbuffer_setup_guard(tex->mipmap_pixbuf);
 
+	if (tex->grate)
+		grate_residency_add_mipmap(tex);
+
 	return 0;
 }
 
-static void setup_lod_pixbuf(struct host1x_pixelbuffer *mipmap,
-			     struct host1x_pixelbuffer *dst,
-			     unsigned level)
+/* describes a level in place, dst shares the BO of the mipmap */
+unsigned long grate_texture_lod_layout(struct host1x_pixelbuffer *mipmap,
+				       struct host1x_pixelbuffer *dst,
+				       unsigned level)
 {
 	unsigned long offset = 0;
-	unsigned long size = 0;
-	unsigned w, h, bpp;
+	unsigned w, h;
 	unsigned i;
 
-	memset(dst, 0, sizeof(*dst));
-
-	bpp = PIX_BUF_FORMAT_BYTES(mipmap->format);
-
-	for (i = 0; i <= level; i++) {
+	for (i = 0; i < level; i++) {
 		w = MAX(mipmap->width >> i, 1);
 		h = MAX(mipmap->height >> i, 1);
-		size = ALIGN(w * bpp, 16) * h;
-		offset += size;
+		offset += lod_pitch(mipmap->format, w) * lod_rows(mipmap, h);
 	}
 
-	dst->bo     = HOST1X_BO_WRAP(mipmap->bo, offset - size, size);
+	memset(dst, 0, sizeof(*dst));
+
+	dst->bo     = mipmap->bo;
 	dst->format = mipmap->format;
 	dst->layout = mipmap->layout;
 	dst->width  = MAX(mipmap->width >> level, 1);
 	dst->height = MAX(mipmap->height >> level, 1);
-	dst->pitch  = ALIGN(dst->width * bpp, 16);
+	dst->pitch  = lod_pitch(dst->format, dst->width);
+
+	return offset;
+}
+
+void grate_texture_lod_pixbuf(struct host1x_pixelbuffer *mipmap,
+			      struct host1x_pixelbuffer *dst,
+			      unsigned level)
+{
+	unsigned long offset, size;
+
+	offset = grate_texture_lod_layout(mipmap, dst, level);
+	size = dst->pitch * lod_rows(mipmap, dst->height);
+
+	dst->bo = HOST1X_BO_WRAP(mipmap->bo, offset, size);
 
 	assert(dst->bo != NULL);
 }
@@ -498,51 +772,35 @@ int grate_texture_generate_mipmap(struct grate *grate,
 				  struct grate_texture *tex)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
-	struct host1x_pixelbuffer *pixbuf = tex->pixbuf;
-	struct host1x_pixelbuffer src_pixbuf, dst_pixbuf;
-	int lod;
+	struct host1x_pixelbuffer levels[32];
+	unsigned long offsets[32];
+	unsigned lod;
 	int err;
 
-	err = alloc_mipmap(grate, tex);
+	err = grate_texture_make_resident(tex);
 	if (err)
 		return err;
 
-	/* Setup base level. */
-	setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf, 0);
-
-	/* XXX: GR2D can't handle all possible scale ratios? */
-	err = host1x_gr2d_surface_blit(gr2d, pixbuf, &dst_pixbuf,
-				       0, 0,
-				       pixbuf->width,
-				       pixbuf->height,
-				       0, 0,
-				       dst_pixbuf.width,
-				       dst_pixbuf.height);
-	host1x_bo_free(dst_pixbuf.bo);
+	err = grate_texture_alloc_mipmap(grate, tex);
+	if (err)
+		return err;
 
-	/* Setup mip levels. */
-	for (lod = 1; err == 0 && lod <= tex->max_lod; lod++) {
-		setup_lod_pixbuf(tex->mipmap_pixbuf, &src_pixbuf, lod - 1);
-		setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf, lod);
-
-		grate_info("LOD %u w: %u h: %u\toffset 0x%08lX -> 0x%08lX\n",
-			   lod,
-			   dst_pixbuf.width,
-			   dst_pixbuf.height,
-			   src_pixbuf.bo->offset,
-			   dst_pixbuf.bo->offset);
-
-		err = host1x_gr2d_surface_blit(gr2d, &src_pixbuf, &dst_pixbuf,
-					       0, 0,
-					       src_pixbuf.width,
-					       src_pixbuf.height,
-					       0, 0,
-					       dst_pixbuf.width,
-					       dst_pixbuf.height);
-		host1x_bo_free(src_pixbuf.bo);
-		host1x_bo_free(dst_pixbuf.bo);
+	switch (tex->pixbuf->format) {
+	case PIX_BUF_FMT_RGBA8888:
+	case PIX_BUF_FMT_BGRA8888:
+		break;
+	default:
+		/* GR2D can only scale 32bpp surfaces */
+		return grate_mipmap_generate_cpu(grate, tex);
 	}
 
+	for (lod = 0; lod <= tex->max_lod; lod++)
+		offsets[lod] = grate_texture_lod_layout(tex->mipmap_pixbuf,
+							&levels[lod], lod);
+
+	/* XXX: GR2D can't handle all possible scale ratios? */
+	err = host1x_gr2d_surface_blit_chain(gr2d, tex->pixbuf, levels,
+					     offsets, tex->max_lod + 1);
 	if (err)
 		grate_error("Mipmap generation failed\n");
 
@@ -553,33 +811,39 @@ int grate_texture_load_miplevel(struct grate *grate,
 				struct grate_texture *tex,
 				unsigned level, const char *path)
 {
+	struct grate_texture_key key, *cache_key = NULL;
 	struct host1x_pixelbuffer dst_pixbuf;
-	ILuint ImageTex;
+	struct grate_image img = { 0 };
 	int err;
 
-	err = alloc_mipmap(grate, tex);
+	err = grate_texture_make_resident(tex);
 	if (err)
 		return err;
 
-	setup_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf,
-			 MIN(level, tex->max_lod));
-	ilInit();
-	ilGenImages(1, &ImageTex);
-	ilBindImage(ImageTex);
-	ilLoadImage(path);
-	ilConvertImage(IL_RGBA, IL_UNSIGNED_BYTE);
-	iluScale(dst_pixbuf.width, dst_pixbuf.height, 0);
+	err = grate_texture_alloc_mipmap(grate, tex);
+	if (err)
+		return err;
 
-	/*
-	 * ilOriginFunc() doesn't work properly in conjunction with
-	 * ilCompressDXT().
-	 */
-	iluRotate(180.0f);
+	grate_texture_lod_pixbuf(tex->mipmap_pixbuf, &dst_pixbuf,
+				 MIN(level, tex->max_lod));
 
-	err = ilGetError();
-	if (err != IL_NO_ERROR) {
-		grate_error("\"%s\" load failed 0x%04X\n", path, err);
-		goto out;
+	if (!grate_texture_cache_key(grate, path, PIX_BUF_FMT_RGBA8888,
+				     dst_pixbuf.layout, level,
+				     dst_pixbuf.width, dst_pixbuf.height,
+				     &key)) {
+		cache_key = &key;
+		err = grate_texture_cache_load(grate, &key, &img);
+	}
+
+	if (!img.data) {
+		err = grate_image_decode(path, PIX_BUF_FMT_RGBA8888,
+					 dst_pixbuf.width, dst_pixbuf.height,
+					 &img);
+		if (err)
+			goto out;
+
+		if (cache_key)
+			grate_texture_cache_store(grate, cache_key, &img);
 	}
 
 	grate_info("Loading texture w: %u h: %u to LOD %u\toffset 0x%08lX\n",
@@ -587,14 +851,12 @@ int grate_texture_load_miplevel(struct grate *grate,
 		   dst_pixbuf.bo->offset);
 
 	err = host1x_pixelbuffer_load_data(grate->host1x, &dst_pixbuf,
-					   ilGetData(),
-					   ilGetInteger(IL_IMAGE_WIDTH) * 4,
-					   ilGetInteger(IL_IMAGE_SIZE_OF_DATA),
+					   img.data, img.pitch, img.size,
 					   dst_pixbuf.format,
 					   dst_pixbuf.layout);
 out:
 	host1x_bo_free(dst_pixbuf.bo);
-	ilDeleteImage(ImageTex);
+	grate_image_free(&img);
 
 	return err;
 }
@@ -606,10 +868,25 @@ int grate_texture_blit(struct grate *grate,
 		       unsigned dx, unsigned dy, unsigned dw, signed dh)
 {
 	struct host1x_gr2d *gr2d = host1x_get_gr2d(grate->host1x);
-	struct host1x_pixelbuffer *src_pixbuf = src_tex->pixbuf;
-	struct host1x_pixelbuffer *dst_pixbuf = dst_tex->pixbuf;
+	struct host1x_pixelbuffer *src_pixbuf, *dst_pixbuf;
 	int err;
 
+	/* neither may be evicted while restoring the other */
+	grate_residency_tick(grate);
+	grate_texture_touch(src_tex);
+	grate_texture_touch(dst_tex);
+
+	err = grate_texture_restore(dst_tex);
+	if (!err)
+		err = grate_texture_restore(src_tex);
+	if (err)
+		return err;
+
+	grate_texture_modified(dst_tex);
+
+	src_pixbuf = src_tex->pixbuf;
+	dst_pixbuf = dst_tex->pixbuf;
+
 	if (sw == dw && sh == dh)
 		err = host1x_gr2d_blit(gr2d, src_pixbuf, dst_pixbuf,
 				       sx, sy, dx, dy, dw, dh);
@@ -0,0 +1,637 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define VERTEX_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define VERTEX_SSE2 1
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+#endif
+
+#include "libgrate-private.h"
+#include "tgr_3d.xml.h"
+
+/* vertices converted per batch, sized to keep the scratch on the stack */
+#define VERTEX_BATCH	64
+
+union float_bits {
+	float f;
+	uint32_t u;
+};
+
+/* IEEE round-to-nearest-even, same result as F16C / VFP conversion */
+static uint16_t float_to_half(float f)
+{
+	union float_bits bits = { .f = f };
+	uint32_t sign = (bits.u >> 16) & 0x8000;
+	uint32_t abs = bits.u & 0x7fffffff;
+
+	if (abs >= 0x7f800000)
+		return sign | 0x7c00 | (abs > 0x7f800000 ? 0x200 : 0);
+
+	/* everything from 65520 up rounds to infinity */
+	if (abs >= 0x477ff000)
+		return sign | 0x7c00;
+
+	/* half denormal, let the FPU do the rounding */
+	if (abs < 0x38800000) {
+		bits.u = abs;
+		bits.f += 0.5f;
+
+		return sign | (bits.u - 0x3f000000);
+	}
+
+	abs += 0xc8000fff + ((abs >> 13) & 1);
+
+	return sign | (abs >> 13);
+}
+
+static float half_to_float(uint16_t h)
+{
+	union float_bits bits;
+	uint32_t exponent = (h >> 10) & 0x1f;
+	uint32_t mantissa = h & 0x3ff;
+	float value;
+
+	if (exponent == 0x1f) {
+		bits.u = (h & 0x8000) << 16 | 0x7f800000 | mantissa << 13;
+		return bits.f;
+	}
+
+	if (exponent == 0)
+		value = ldexpf(mantissa, -24);
+	else
+		value = ldexpf(mantissa | 0x400, exponent - 25);
+
+	return (h & 0x8000) ? -value : value;
+}
+
+/*
+ * Normalised conversions round half away from zero via truncation of
+ * (v +- 0.5), which every SIMD flavour below reproduces bit-exactly.
+ */
+static int32_t float_to_unorm(float v, float max)
+{
+	v = v < 0.0f ? 0.0f : (v > 1.0f ? 1.0f : v);
+
+	return (int32_t)(v * max + 0.5f);
+}
+
+static int32_t float_to_snorm(float v, float max)
+{
+	v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+	v *= max;
+
+	return (int32_t)(v + (v < 0.0f ? -0.5f : 0.5f));
+}
+
+#if defined(VERTEX_SSE2)
+static inline __m128i sse_unorm(const float *src, __m128 max)
+{
+	__m128 v = _mm_loadu_ps(src);
+
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	v = _mm_add_ps(_mm_mul_ps(v, max), _mm_set1_ps(0.5f));
+
+	return _mm_cvttps_epi32(v);
+}
+
+static inline __m128i sse_snorm(const float *src, __m128 max)
+{
+	__m128 sign = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+	__m128 v = _mm_loadu_ps(src);
+
+	v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+	v = _mm_mul_ps(v, max);
+	v = _mm_add_ps(v, _mm_or_ps(_mm_and_ps(v, sign), _mm_set1_ps(0.5f)));
+
+	return _mm_cvttps_epi32(v);
+}
+#elif defined(VERTEX_NEON)
+static inline int32x4_t neon_unorm(const float *src, float32x4_t max)
+{
+	float32x4_t v = vld1q_f32(src);
+
+	v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+	v = vaddq_f32(vmulq_f32(v, max), vdupq_n_f32(0.5f));
+
+	return vcvtq_s32_f32(v);
+}
+
+static inline int32x4_t neon_snorm(const float *src, float32x4_t max)
+{
+	float32x4_t v = vld1q_f32(src);
+	uint32x4_t neg;
+
+	v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+	v = vmulq_f32(v, max);
+	neg = vcltq_f32(v, vdupq_n_f32(0.0f));
+	v = vaddq_f32(v, vbslq_f32(neg, vdupq_n_f32(-0.5f),
+				   vdupq_n_f32(0.5f)));
+
+	return vcvtq_s32_f32(v);
+}
+#endif
+
+static void convert_unorm8(uint8_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(VERTEX_SSE2)
+	__m128 max = _mm_set1_ps(255.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i lo = sse_unorm(src + i, max);
+		__m128i hi = sse_unorm(src + i + 4, max);
+		__m128i v = _mm_packs_epi32(lo, hi);
+
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(v, v));
+	}
+#elif defined(VERTEX_NEON)
+	float32x4_t max = vdupq_n_f32(255.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		uint16x4_t lo = vmovn_u32(vreinterpretq_u32_s32(
+						neon_unorm(src + i, max)));
+		uint16x4_t hi = vmovn_u32(vreinterpretq_u32_s32(
+						neon_unorm(src + i + 4, max)));
+
+		vst1_u8(dst + i, vmovn_u16(vcombine_u16(lo, hi)));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_unorm(src[i], 255.0f);
+}
+
+static void convert_snorm8(int8_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(VERTEX_SSE2)
+	__m128 max = _mm_set1_ps(127.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i lo = sse_snorm(src + i, max);
+		__m128i hi = sse_snorm(src + i + 4, max);
+		__m128i v = _mm_packs_epi32(lo, hi);
+
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packs_epi16(v, v));
+	}
+#elif defined(VERTEX_NEON)
+	float32x4_t max = vdupq_n_f32(127.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		int16x4_t lo = vmovn_s32(neon_snorm(src + i, max));
+		int16x4_t hi = vmovn_s32(neon_snorm(src + i + 4, max));
+
+		vst1_s8(dst + i, vmovn_s16(vcombine_s16(lo, hi)));
+	}
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_snorm(src[i], 127.0f);
+}
+
+static void convert_unorm16(uint16_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(VERTEX_SSE2)
+	__m128 max = _mm_set1_ps(65535.0f);
+	__m128i bias = _mm_set1_epi32(0x8000);
+
+	for (; i + 8 <= count; i += 8) {
+		/* SSE2 lacks packus_epi32, pack signed and flip back */
+		__m128i lo = _mm_sub_epi32(sse_unorm(src + i, max), bias);
+		__m128i hi = _mm_sub_epi32(sse_unorm(src + i + 4, max), bias);
+		__m128i v = _mm_packs_epi32(lo, hi);
+
+		v = _mm_xor_si128(v, _mm_set1_epi16((short)0x8000));
+		_mm_storeu_si128((__m128i *)(dst + i), v);
+	}
+#elif defined(VERTEX_NEON)
+	float32x4_t max = vdupq_n_f32(65535.0f);
+
+	for (; i + 4 <= count; i += 4)
+		vst1_u16(dst + i, vmovn_u32(vreinterpretq_u32_s32(
+						neon_unorm(src + i, max))));
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_unorm(src[i], 65535.0f);
+}
+
+static void convert_snorm16(int16_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(VERTEX_SSE2)
+	__m128 max = _mm_set1_ps(32767.0f);
+
+	for (; i + 8 <= count; i += 8) {
+		__m128i lo = sse_snorm(src + i, max);
+		__m128i hi = sse_snorm(src + i + 4, max);
+
+		_mm_storeu_si128((__m128i *)(dst + i),
+				 _mm_packs_epi32(lo, hi));
+	}
+#elif defined(VERTEX_NEON)
+	float32x4_t max = vdupq_n_f32(32767.0f);
+
+	for (; i + 4 <= count; i += 4)
+		vst1_s16(dst + i, vmovn_s32(neon_snorm(src + i, max)));
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_snorm(src[i], 32767.0f);
+}
+
+static void convert_half(uint16_t *dst, const float *src, unsigned count)
+{
+	unsigned i = 0;
+
+#if defined(VERTEX_SSE2) && defined(__F16C__)
+	for (; i + 4 <= count; i += 4)
+		_mm_storel_epi64((__m128i *)(dst + i),
+				 _mm_cvtps_ph(_mm_loadu_ps(src + i), 0));
+#elif defined(VERTEX_NEON) && defined(__ARM_FP) && (__ARM_FP & 2)
+	for (; i + 4 <= count; i += 4)
+		vst1_u16(dst + i, vreinterpret_u16_f16(
+					vcvt_f16_f32(vld1q_f32(src + i))));
+#endif
+	for (; i < count; i++)
+		dst[i] = float_to_half(src[i]);
+}
+
+static unsigned vertex_type_size(unsigned type)
+{
+	switch (type) {
+	case TGR3D_ATTRIB_TYPE_UBYTE_NORM:
+	case TGR3D_ATTRIB_TYPE_SBYTE_NORM:
+		return 1;
+	case TGR3D_ATTRIB_TYPE_USHORT_NORM:
+	case TGR3D_ATTRIB_TYPE_SSHORT_NORM:
+	case TGR3D_ATTRIB_TYPE_FLOAT16:
+		return 2;
+	case TGR3D_ATTRIB_TYPE_FLOAT32:
+		return 4;
+	}
+
+	return 0;
+}
+
+static const float *element_vertex(const struct grate_vertex_element *elem,
+				   unsigned index)
+{
+	unsigned stride = elem->stride ?: elem->size * sizeof(float);
+
+	return (const void *)elem->data + index * stride;
+}
+
+static float element_half_error(const struct grate_vertex_element *elem,
+				unsigned num_vertices)
+{
+	float error = 0.0f;
+	unsigned i, c;
+
+	for (i = 0; i < num_vertices; i++) {
+		const float *v = element_vertex(elem, i);
+
+		for (c = 0; c < elem->size; c++) {
+			float h = half_to_float(float_to_half(v[c]));
+
+			error = MAX(error, fabsf(h - v[c]));
+		}
+	}
+
+	return error;
+}
+
+/*
+ * Picks the smallest type that represents the element within max_error.
+ * Normalised types are tried without remapping first; with allow_remap
+ * the range is mapped to [0, 1] and the shader has to apply scale/bias.
+ */
+static int element_choose_type(struct grate_vertex_element *elem,
+			       unsigned num_vertices)
+{
+	float min[4], max[4], range = 0.0f;
+	bool unsigned_range = true;
+	bool signed_range = true;
+	unsigned i, c;
+
+	for (c = 0; c < 4; c++) {
+		min[c] = FLT_MAX;
+		max[c] = -FLT_MAX;
+		elem->scale[c] = 1.0f;
+		elem->bias[c] = 0.0f;
+	}
+
+	for (i = 0; i < num_vertices; i++) {
+		const float *v = element_vertex(elem, i);
+
+		for (c = 0; c < elem->size; c++) {
+			if (!isfinite(v[c])) {
+				elem->type = TGR3D_ATTRIB_TYPE_FLOAT32;
+				return 0;
+			}
+
+			min[c] = MIN(min[c], v[c]);
+			max[c] = MAX(max[c], v[c]);
+		}
+	}
+
+	for (c = 0; c < elem->size; c++) {
+		if (min[c] < 0.0f || max[c] > 1.0f)
+			unsigned_range = false;
+
+		if (min[c] < -1.0f || max[c] > 1.0f)
+			signed_range = false;
+
+		range = MAX(range, max[c] - min[c]);
+	}
+
+	if (elem->type != GRATE_VERTEX_TYPE_AUTO)
+		goto remap;
+
+	if (unsigned_range && 0.5f / 255.0f <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_UBYTE_NORM;
+	else if (signed_range && 0.5f / 127.0f <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_SBYTE_NORM;
+	else if (elem->allow_remap && range * 0.5f / 255.0f <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_UBYTE_NORM;
+	else if (unsigned_range && 0.5f / 65535.0f <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_USHORT_NORM;
+	else if (signed_range && 0.5f / 32767.0f <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_SSHORT_NORM;
+	else if (element_half_error(elem, num_vertices) <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_FLOAT16;
+	else if (elem->allow_remap &&
+		 range * 0.5f / 65535.0f <= elem->max_error)
+		elem->type = TGR3D_ATTRIB_TYPE_USHORT_NORM;
+	else
+		elem->type = TGR3D_ATTRIB_TYPE_FLOAT32;
+
+remap:
+	switch (elem->type) {
+	case TGR3D_ATTRIB_TYPE_UBYTE_NORM:
+	case TGR3D_ATTRIB_TYPE_USHORT_NORM:
+		if (unsigned_range)
+			break;
+
+		if (!elem->allow_remap) {
+			grate_error("Attribute %u out of range for type %u\n",
+				    elem->location, elem->type);
+			return -1;
+		}
+
+		for (c = 0; c < elem->size; c++) {
+			elem->bias[c] = min[c];
+			elem->scale[c] = max[c] > min[c] ? max[c] - min[c] : 1.0f;
+		}
+		break;
+
+	case TGR3D_ATTRIB_TYPE_SBYTE_NORM:
+	case TGR3D_ATTRIB_TYPE_SSHORT_NORM:
+		if (!signed_range) {
+			grate_error("Attribute %u out of range for type %u\n",
+				    elem->location, elem->type);
+			return -1;
+		}
+		break;
+
+	case TGR3D_ATTRIB_TYPE_FLOAT16:
+	case TGR3D_ATTRIB_TYPE_FLOAT32:
+		break;
+
+	default:
+		grate_error("Unsupported type %u\n", elem->type);
+		return -1;
+	}
+
+	return 0;
+}
+
+int grate_vertex_format_choose(struct grate_vertex_element *elements,
+			       unsigned num_elements, unsigned num_vertices)
+{
+	unsigned stride = 0;
+	unsigned i;
+
+	for (i = 0; i < num_elements; i++) {
+		struct grate_vertex_element *elem = &elements[i];
+
+		if (elem->size < 1 || elem->size > 4) {
+			grate_error("Invalid size %u\n", elem->size);
+			return -1;
+		}
+
+		if (element_choose_type(elem, num_vertices))
+			return -1;
+
+		/* keep every attribute 4 bytes aligned */
+		elem->offset = stride;
+		stride += ALIGN(elem->size * vertex_type_size(elem->type), 4);
+	}
+
+	return stride;
+}
+
+void grate_vertex_format_pack(const struct grate_vertex_element *elements,
+			      unsigned num_elements, unsigned num_vertices,
+			      void *dst, unsigned stride)
+{
+	float src[VERTEX_BATCH * 4];
+	uint8_t out[VERTEX_BATCH * 4 * sizeof(float)];
+	unsigned first, count, i, c, e;
+
+	for (e = 0; e < num_elements; e++) {
+		const struct grate_vertex_element *elem = &elements[e];
+		unsigned type_size = vertex_type_size(elem->type);
+		unsigned size = elem->size;
+		bool remap = false;
+
+		for (c = 0; c < size; c++) {
+			if (elem->scale[c] != 1.0f || elem->bias[c] != 0.0f)
+				remap = true;
+		}
+
+		for (first = 0; first < num_vertices; first += count) {
+			count = MIN(num_vertices - first, VERTEX_BATCH);
+
+			for (i = 0; i < count; i++) {
+				const float *v = element_vertex(elem, first + i);
+
+				if (!remap) {
+					memcpy(&src[i * size], v,
+					       size * sizeof(float));
+					continue;
+				}
+
+				for (c = 0; c < size; c++)
+					src[i * size + c] =
+						(v[c] - elem->bias[c]) /
+						elem->scale[c];
+			}
+
+			switch (elem->type) {
+			case TGR3D_ATTRIB_TYPE_UBYTE_NORM:
+				convert_unorm8(out, src, count * size);
+				break;
+			case TGR3D_ATTRIB_TYPE_SBYTE_NORM:
+				convert_snorm8((int8_t *)out, src, count * size);
+				break;
+			case TGR3D_ATTRIB_TYPE_USHORT_NORM:
+				convert_unorm16((uint16_t *)out, src,
+						count * size);
+				break;
+			case TGR3D_ATTRIB_TYPE_SSHORT_NORM:
+				convert_snorm16((int16_t *)out, src,
+						count * size);
+				break;
+			case TGR3D_ATTRIB_TYPE_FLOAT16:
+				convert_half((uint16_t *)out, src,
+					     count * size);
+				break;
+			default:
+				memcpy(out, src, count * size * sizeof(float));
+				break;
+			}
+
+			for (i = 0; i < count; i++)
+				memcpy(dst + (first + i) * stride + elem->offset,
+				       out + i * size * type_size,
+				       size * type_size);
+		}
+	}
+}
+
+struct grate_vertex_stream *
+grate_vertex_stream_create(struct grate *grate,
+			   struct grate_vertex_element *elements,
+			   unsigned num_elements, unsigned num_vertices)
+{
+	struct grate_vertex_stream *stream;
+	unsigned i;
+	void *map;
+	int stride;
+
+	if (num_elements > ARRAY_SIZE(stream->attribs)) {
+		grate_error("Too many elements %u\n", num_elements);
+		return NULL;
+	}
+
+	stride = grate_vertex_format_choose(elements, num_elements,
+					    num_vertices);
+	if (stride <= 0)
+		return NULL;
+
+	stream = calloc(1, sizeof(*stream));
+	if (!stream)
+		return NULL;
+
+	stream->bo = grate_bo_create_and_map(grate, NVHOST_BO_FLAG_ATTRIBUTES,
+					     stride * num_vertices, &map);
+	if (!stream->bo)
+		goto err_free;
+
+	grate_vertex_format_pack(elements, num_elements, num_vertices,
+				 map, stride);
+
+	HOST1X_BO_FLUSH(stream->bo, stream->bo->offset, stride * num_vertices);
+
+	for (i = 0; i < num_elements; i++) {
+		struct grate_vertex_attrib *attrib = &stream->attribs[i];
+
+		attrib->bo = host1x_bo_wrap(stream->bo, elements[i].offset,
+					    stream->bo->size - elements[i].offset);
+		if (!attrib->bo)
+			goto err_free;
+
+		attrib->location = elements[i].location;
+		attrib->size = elements[i].size;
+		attrib->type = elements[i].type;
+	}
+
+	stream->num_attribs = num_elements;
+	stream->num_vertices = num_vertices;
+	stream->stride = stride;
+
+	grate_info("packed %u attributes into %d bytes per vertex\n",
+		   num_elements, stride);
+
+	return stream;
+
+err_free:
+	grate_vertex_stream_free(stream);
+
+	return NULL;
+}
+
+int grate_vertex_stream_bind(struct grate_3d_ctx *ctx,
+			     struct grate_vertex_stream *stream)
+{
+	unsigned i;
+	int err;
+
+	for (i = 0; i < stream->num_attribs; i++) {
+		struct grate_vertex_attrib *attrib = &stream->attribs[i];
+
+		err = grate_3d_ctx_vertex_attrib_pointer(ctx, attrib->location,
+							 attrib->size,
+							 attrib->type,
+							 stream->stride,
+							 attrib->bo);
+		if (err)
+			return err;
+
+		err = grate_3d_ctx_enable_vertex_attrib_array(ctx,
+							      attrib->location);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+void grate_vertex_stream_free(struct grate_vertex_stream *stream)
+{
+	unsigned i;
+
+	if (!stream)
+		return;
+
+	for (i = 0; i < ARRAY_SIZE(stream->attribs); i++) {
+		if (stream->attribs[i].bo)
+			host1x_bo_free(stream->attribs[i].bo);
+	}
+
+	if (stream->bo)
+		host1x_bo_free(stream->bo);
+
+	free(stream);
+}
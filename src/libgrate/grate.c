@@ -197,6 +197,9 @@ struct grate *grate_init_with_fd(struct grate_options *options, int fd)
 
 	grate->options = options;
 
+	grate_residency_init(grate);
+	grate_texture_cache_init(grate);
+
 	chip_info = grate->host1x_options.chip_info;
 
 	if (grate->options->nodisplay)
@@ -228,8 +231,11 @@ void grate_exit(struct grate *grate)
 {
 	struct termios term;
 
-	if (grate)
+	if (grate) {
+		grate_loader_destroy(grate->loader);
 		host1x_close(grate->host1x);
+		free(grate->texture_cache_dir);
+	}
 
 	if (termio_adjusted && saved_c_lflag) {
 		/* Restore terminal input */
@@ -264,6 +270,7 @@ static void grate_display_framebuffer(struct grate *grate,
 void grate_bind_framebuffer(struct grate *grate, struct grate_framebuffer *fb)
 {
 	grate->fb = fb;
+	grate_framebuffer_damage_all(fb);
 	grate_display_framebuffer(grate, fb, true);
 }
 
@@ -276,6 +283,19 @@ void grate_flush(struct grate *grate)
 {
 }
 
+static size_t grate_framebuffer_size(struct grate_framebuffer *fb)
+{
+	size_t size = fb->front->pixbuf->bo->size;
+
+	if (fb->back)
+		size += fb->back->pixbuf->bo->size;
+
+	if (fb->spare)
+		size += fb->spare->pixbuf->bo->size;
+
+	return size;
+}
+
 struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   unsigned int width,
 						   unsigned int height,
@@ -296,7 +316,7 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 		return NULL;
 	}
 
-	if ((flags & GRATE_DOUBLE_BUFFERED) &&
+	if ((flags & (GRATE_DOUBLE_BUFFERED | GRATE_TRIPLE_BUFFERED)) &&
 	    !grate->options->singlebuffered) {
 		fb->back = host1x_framebuffer_create(grate->host1x, width,
 						     height, format, layout, 0);
@@ -307,14 +327,34 @@ struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 		}
 	}
 
+	if ((flags & GRATE_TRIPLE_BUFFERED) && fb->back) {
+		fb->spare = host1x_framebuffer_create(grate->host1x, width,
+						      height, format, layout, 0);
+		if (!fb->spare) {
+			host1x_framebuffer_free(fb->back);
+			host1x_framebuffer_free(fb->front);
+			free(fb);
+			return NULL;
+		}
+	}
+
+	fb->grate = grate;
+	fb->flags = flags;
+	grate_framebuffer_damage_all(fb);
+	grate_residency_account(grate, GRATE_MEMORY_FRAMEBUFFER,
+				grate_framebuffer_size(fb));
+
 	return fb;
 }
 
 void grate_framebuffer_free(struct grate_framebuffer *fb)
 {
 	if (fb) {
+		grate_residency_account(fb->grate, GRATE_MEMORY_FRAMEBUFFER,
+					-(ssize_t)grate_framebuffer_size(fb));
 		host1x_framebuffer_free(fb->front);
 		host1x_framebuffer_free(fb->back);
+		host1x_framebuffer_free(fb->spare);
 	}
 
 	free(fb);
@@ -324,7 +364,11 @@ static void grate_framebuffer_swap(struct grate_framebuffer *fb)
 {
 	struct host1x_framebuffer *tmp = fb->front;
 
-	if (fb->back) {
+	if (fb->spare) {
+		fb->front = fb->back;
+		fb->back = fb->spare;
+		fb->spare = tmp;
+	} else if (fb->back) {
 		fb->front = fb->back;
 		fb->back = tmp;
 	}
@@ -343,6 +387,10 @@ void grate_framebuffer_save(struct grate *grate,
 
 void grate_swap_buffers(struct grate *grate)
 {
+	/* nothing was redrawn since the last swap */
+	if (!grate_framebuffer_damaged(grate->fb))
+		return;
+
 	grate_framebuffer_swap(grate->fb);
 
 	if (grate->display || grate->overlay) {
@@ -350,6 +398,8 @@ void grate_swap_buffers(struct grate *grate)
 	} else {
 		grate_framebuffer_save(grate, grate->fb, "test.png");
 	}
+
+	grate_framebuffer_sync_damage(grate->fb);
 }
 
 void grate_wait_for_key(struct grate *grate)
@@ -43,6 +43,16 @@ struct grate;
 
 #define GRATE_SINGLE_BUFFERED (0 << 0)
 #define GRATE_DOUBLE_BUFFERED (1 << 0)
+/*
+ * Only the regions reported via grate_framebuffer_damage() are presented
+ * on swap, everything else is assumed to be unchanged since the last one.
+ */
+#define GRATE_DAMAGE_TRACKED  (1 << 1)
+/*
+ * Adds a third buffer so that a swap only queues the flip and rendering
+ * of the next frame can start before it has hit the screen.
+ */
+#define GRATE_TRIPLE_BUFFERED (1 << 2)
 
 struct grate_framebuffer *grate_framebuffer_create(struct grate *grate,
 						   unsigned int width,
@@ -54,6 +64,9 @@ void grate_framebuffer_free(struct grate_framebuffer *fb);
 void grate_framebuffer_save(struct grate *grate, struct grate_framebuffer *fb,
 			    const char *path);
 void *grate_framebuffer_data(struct grate_framebuffer *fb, bool front);
+void grate_framebuffer_damage(struct grate_framebuffer *fb,
+			      unsigned int x, unsigned int y,
+			      unsigned int width, unsigned int height);
 
 struct host1x_bo *grate_bo_create_and_map(struct grate *grate,
 					  unsigned long flags,
@@ -135,6 +148,12 @@ int grate_get_vertex_uniform_location(struct grate_program *program,
 				      const char *name);
 int grate_get_fragment_uniform_location(struct grate_program *program,
 					const char *name);
+struct grate_uniform_handle
+grate_get_vertex_uniform_handle(struct grate_program *program,
+				const char *name);
+struct grate_uniform_handle
+grate_get_fragment_uniform_handle(struct grate_program *program,
+				  const char *name);
 
 void grate_program_link(struct grate_program *program);
 void grate_use_program(struct grate *grate, struct grate_program *program);
@@ -155,6 +174,121 @@ void grate_3d_draw_elements(struct grate_3d_ctx *ctx,
 			    struct host1x_bo *indices_bo,
 			    unsigned index_mode,
 			    unsigned vtx_count);
+void grate_3d_draw_elements_range(struct grate_3d_ctx *ctx,
+				  unsigned primitive_type,
+				  struct host1x_bo *indices_bo,
+				  unsigned index_mode,
+				  unsigned first_index,
+				  unsigned vtx_count,
+				  unsigned first_vtx);
+
+/*
+ * A mesh with 32-bit indices split into clusters addressable by 16-bit
+ * indices. remap[] maps each vertex of the remapped vertex stream to the
+ * source vertex, indices[] are relative to the cluster's first_vertex.
+ */
+struct grate_mesh_cluster {
+	unsigned first_vertex;
+	unsigned num_vertices;
+	unsigned first_index;
+	unsigned num_indices;
+};
+
+struct grate_mesh {
+	struct grate_mesh_cluster *clusters;
+	unsigned num_clusters;
+	uint16_t *indices;
+	unsigned num_indices;
+	uint32_t *remap;
+	unsigned num_vertices;
+};
+
+struct grate_mesh *grate_mesh_split(const uint32_t *indices,
+				    unsigned num_indices,
+				    unsigned num_vertices,
+				    unsigned max_cluster_vertices);
+void grate_mesh_remap_vertices(const struct grate_mesh *mesh,
+			       void *dst, const void *src, unsigned stride);
+void grate_mesh_free(struct grate_mesh *mesh);
+void grate_3d_draw_mesh(struct grate_3d_ctx *ctx,
+			const struct grate_mesh *mesh,
+			struct host1x_bo *indices_bo);
+
+int grate_optimize_indices(uint16_t *indices, unsigned num_indices,
+			   unsigned num_vertices);
+int grate_indices_to_strip(const uint16_t *indices, unsigned num_indices,
+			   uint16_t **strip);
+unsigned grate_indices_count_transforms(const uint16_t *indices,
+					unsigned num_indices,
+					unsigned cache_size);
+int grate_optimize_index_bo(struct host1x_bo *bo, unsigned index_mode,
+			    unsigned num_indices, unsigned num_vertices,
+			    bool strip);
+
+/*
+ * Vertex attribute packing. Elements are converted to the smallest type
+ * representing the source floats within max_error and interleaved into a
+ * single stream. Remapped elements store (value - bias) / scale, the
+ * vertex program is expected to apply value * scale + bias.
+ */
+#define GRATE_VERTEX_TYPE_AUTO	(~0u)
+
+struct grate_vertex_element {
+	unsigned location;
+	const float *data;
+	unsigned size;
+	unsigned stride;
+	unsigned type;
+	float max_error;
+	bool allow_remap;
+
+	/* filled in by grate_vertex_format_choose() */
+	unsigned offset;
+	float scale[4];
+	float bias[4];
+};
+
+struct grate_vertex_attrib {
+	struct host1x_bo *bo;
+	unsigned location;
+	unsigned size;
+	unsigned type;
+};
+
+struct grate_vertex_stream {
+	struct host1x_bo *bo;
+	struct grate_vertex_attrib attribs[16];
+	unsigned num_attribs;
+	unsigned num_vertices;
+	unsigned stride;
+};
+
+int grate_vertex_format_choose(struct grate_vertex_element *elements,
+			       unsigned num_elements, unsigned num_vertices);
+void grate_vertex_format_pack(const struct grate_vertex_element *elements,
+			      unsigned num_elements, unsigned num_vertices,
+			      void *dst, unsigned stride);
+struct grate_vertex_stream *
+grate_vertex_stream_create(struct grate *grate,
+			   struct grate_vertex_element *elements,
+			   unsigned num_elements, unsigned num_vertices);
+int grate_vertex_stream_bind(struct grate_3d_ctx *ctx,
+			     struct grate_vertex_stream *stream);
+void grate_vertex_stream_free(struct grate_vertex_stream *stream);
+
+struct grate_stream_ring;
+
+struct grate_stream_ring *grate_stream_ring_create(struct grate *grate,
+						   size_t size,
+						   unsigned long flags);
+struct host1x_bo *grate_stream_ring_alloc(struct grate_stream_ring *ring,
+					  size_t size, size_t align,
+					  void **map);
+int grate_stream_ring_commit(struct grate_stream_ring *ring,
+			     struct host1x_bo *bo, size_t written);
+void grate_stream_ring_fence(struct grate_stream_ring *ring,
+			     struct grate_3d_ctx *ctx);
+void grate_stream_ring_free(struct grate_stream_ring *ring);
 
 enum grate_textute_wrap_mode {
 	GRATE_TEXTURE_CLAMP_TO_EDGE,
@@ -181,6 +315,69 @@ struct grate_texture *grate_create_texture2(struct grate *grate,
 					    enum layout_format layout);
 int grate_texture_load(struct grate *grate, struct grate_texture *tex,
 		       const char *path);
+/*
+ * Levels are flipped to the bottom-left origin of decoded images, unless a
+ * KTXorientation says "T=u". Loading fails if a level that needs the
+ * flip is compressed, taller than one block and not a whole number of
+ * blocks high.
+ */
+struct grate_texture *grate_texture_load_container(struct grate *grate,
+						   const char *path);
+
+int grate_texture_cache_set_dir(struct grate *grate, const char *dir);
+
+enum grate_memory_type {
+	GRATE_MEMORY_TEXTURE,
+	GRATE_MEMORY_MIPMAP,
+	GRATE_MEMORY_FRAMEBUFFER,
+	GRATE_MEMORY_TYPES,
+};
+
+struct grate_memory_stats {
+	size_t allocated[GRATE_MEMORY_TYPES];
+	size_t budget;
+	unsigned long evictions;
+	unsigned long restores;
+	unsigned long long evicted_bytes;
+	unsigned long long restored_bytes;
+	unsigned evicted_textures;
+};
+
+/* a budget of 0 (the default) disables eviction */
+void grate_set_memory_budget(struct grate *grate, size_t budget);
+void grate_get_memory_stats(struct grate *grate,
+			    struct grate_memory_stats *stats);
+
+struct grate_atlas;
+struct grate_atlas_entry;
+
+struct grate_atlas *grate_atlas_create(struct grate *grate,
+				       unsigned page_size,
+				       enum pixel_format format);
+void grate_atlas_free(struct grate_atlas *atlas);
+struct grate_atlas_entry *grate_atlas_alloc(struct grate_atlas *atlas,
+					    unsigned width, unsigned height);
+struct grate_atlas_entry *grate_atlas_load(struct grate_atlas *atlas,
+					   const char *path);
+int grate_atlas_entry_upload(struct grate_atlas_entry *entry,
+			     const void *data, unsigned pitch);
+void grate_atlas_release(struct grate_atlas_entry *entry);
+struct grate_texture *
+grate_atlas_entry_texture(const struct grate_atlas_entry *entry);
+void grate_atlas_entry_uv(const struct grate_atlas_entry *entry,
+			  float *scale, float *offset);
+int grate_atlas_compact(struct grate_atlas *atlas);
+
+struct grate_texture_request;
+
+struct grate_texture_request *
+grate_texture_load_async(struct grate *grate, const char *path,
+			 enum pixel_format format, enum layout_format layout);
+int grate_texture_request_poll(struct grate_texture_request *req);
+struct grate_texture *
+grate_texture_request_wait(struct grate_texture_request *req);
+void grate_texture_request_free(struct grate_texture_request *req);
+
 struct host1x_pixelbuffer *grate_texture_pixbuf(struct grate_texture *tex);
 void grate_texture_free(struct grate_texture *tex);
 void grate_texture_set_max_lod(struct grate_texture *tex, unsigned max_lod);
@@ -198,6 +395,11 @@ void grate_texture_clear_rect(struct grate *grate,
 			      struct grate_texture *texture,
 			      uint32_t color, unsigned x, unsigned y,
 			      unsigned width, unsigned height);
+int grate_texture_update_rect(struct grate *grate,
+			      struct grate_texture *texture,
+			      unsigned x, unsigned y,
+			      unsigned width, unsigned height,
+			      const void *data, unsigned pitch);
 int grate_texture_generate_mipmap(struct grate *grate,
 				  struct grate_texture *tex);
 int grate_texture_load_miplevel(struct grate *grate,
@@ -221,6 +423,24 @@ void grate_3d_printf(struct grate *grate,
 		     float x, float y, float scale,
 		     const char *fmt, ...);
 
+struct grate_text_batch;
+
+struct grate_text_batch *grate_text_batch_create(struct grate *grate,
+						 unsigned max_glyphs);
+void grate_text_batch_begin(struct grate_text_batch *batch,
+			    struct grate_3d_ctx *ctx,
+			    unsigned render_target);
+int grate_text_batch_add(struct grate_text_batch *batch,
+			 struct grate_font *font,
+			 float x, float y, float scale,
+			 const char *text);
+int grate_text_batch_printf(struct grate_text_batch *batch,
+			    struct grate_font *font,
+			    float x, float y, float scale,
+			    const char *fmt, ...);
+int grate_text_batch_flush(struct grate_text_batch *batch);
+void grate_text_batch_free(struct grate_text_batch *batch);
+
 void grate_init_data_path(char *fpath);
 
 const struct host1x_chip_info *grate_chip_info(void);
@@ -1,8 +1,11 @@
 #ifndef GRATE_LIBGRATE_PRIVATE_H
 #define GRATE_LIBGRATE_PRIVATE_H 1
 
+#include <byteswap.h>
+
 #include "grate.h"
 #include "libcgc.h"
+#include "list.h"
 
 struct host1x_pushbuf;
 
@@ -17,9 +20,37 @@ struct grate_color {
 	float r, g, b, a;
 };
 
+#define GRATE_DAMAGE_MAX_RECTS 16
+
+struct grate_damage {
+	struct host1x_gr2d_rect rects[GRATE_DAMAGE_MAX_RECTS];
+	unsigned int num_rects;
+	bool full;
+};
+
 struct grate_framebuffer {
+	struct grate *grate;
 	struct host1x_framebuffer *front;
 	struct host1x_framebuffer *back;
+	struct host1x_framebuffer *spare;
+	unsigned long flags;
+	struct grate_damage damage;
+	struct grate_damage prev_damage;
+};
+
+void grate_framebuffer_damage_all(struct grate_framebuffer *fb);
+bool grate_framebuffer_damaged(struct grate_framebuffer *fb);
+const struct host1x_gr2d_rect *
+grate_framebuffer_get_damage(struct grate_framebuffer *fb,
+			     unsigned int *count);
+void grate_framebuffer_sync_damage(struct grate_framebuffer *fb);
+
+struct grate_residency {
+	struct list_head textures;
+	size_t allocated[GRATE_MEMORY_TYPES];
+	size_t budget;
+	unsigned long clock;
+	struct grate_memory_stats stats;
 };
 
 struct grate {
@@ -30,6 +61,9 @@ struct grate {
 	struct grate_color clear;
 	struct host1x_options host1x_options;
 	struct host1x *host1x;
+	struct grate_loader *loader;
+	char *texture_cache_dir;
+	struct grate_residency residency;
 };
 
 struct grate_display *grate_display_open(struct grate *grate);
@@ -47,6 +81,90 @@ void grate_overlay_show(struct grate_overlay *overlay,
 			unsigned int y, unsigned int width,
 			unsigned int height, bool vsync, bool reflect_y);
 
+/* CPU side image, flipped to GR3D's origin and optionally compressed */
+struct grate_image {
+	void *data;
+	unsigned width;
+	unsigned height;
+	unsigned bpp;
+	unsigned pitch;
+	unsigned long size;
+
+	/* set if data points into a mapped texture cache entry */
+	void *map;
+	size_t map_size;
+};
+
+int grate_image_decode(const char *path, enum pixel_format format,
+		       unsigned width, unsigned height,
+		       struct grate_image *img);
+int grate_image_compress(struct grate_image *img, enum pixel_format format,
+			 unsigned num_threads);
+int grate_image_upload(struct grate *grate, struct grate_texture **tex,
+		       const struct grate_image *img, bool create,
+		       enum pixel_format format, enum layout_format layout);
+void grate_image_free(struct grate_image *img);
+
+int grate_texture_alloc_mipmap(struct grate *grate, struct grate_texture *tex);
+int grate_texture_reload(struct grate *grate, struct grate_texture *tex);
+unsigned long grate_texture_lod_layout(struct host1x_pixelbuffer *mipmap,
+				       struct host1x_pixelbuffer *dst,
+				       unsigned level);
+void grate_texture_lod_pixbuf(struct host1x_pixelbuffer *mipmap,
+			      struct host1x_pixelbuffer *dst,
+			      unsigned level);
+int grate_mipmap_generate_cpu(struct grate *grate, struct grate_texture *tex);
+
+/* Tegra's GR3D uses a different layout for ETC1 data */
+static inline uint64_t grate_etc1_swap_block(uint64_t word)
+{
+	return (uint64_t)bswap_32(word) << 32 | bswap_32(word >> 32);
+}
+
+int grate_dxt_encode(const void *src, unsigned width, unsigned height,
+		     unsigned src_pitch, enum pixel_format format,
+		     void *dst, unsigned dst_pitch, unsigned num_threads);
+int grate_dxt_decode(const void *src, unsigned width, unsigned height,
+		     unsigned src_pitch, enum pixel_format format,
+		     void *dst, unsigned dst_pitch);
+
+void grate_loader_destroy(struct grate_loader *loader);
+
+void grate_residency_init(struct grate *grate);
+void grate_residency_account(struct grate *grate,
+			     enum grate_memory_type type, ssize_t delta);
+void grate_residency_add_texture(struct grate *grate,
+				 struct grate_texture *tex);
+void grate_residency_add_mipmap(struct grate_texture *tex);
+void grate_residency_remove_texture(struct grate_texture *tex);
+void grate_residency_tick(struct grate *grate);
+void grate_texture_touch(struct grate_texture *tex);
+int grate_texture_restore(struct grate_texture *tex);
+int grate_texture_make_resident(struct grate_texture *tex);
+void grate_texture_modified(struct grate_texture *tex);
+
+struct grate_texture_key {
+	uint64_t hash;
+	enum pixel_format format;
+	enum layout_format layout;
+	unsigned level;
+	unsigned width;
+	unsigned height;
+};
+
+void grate_texture_cache_init(struct grate *grate);
+int grate_texture_cache_key(struct grate *grate, const char *path,
+			    enum pixel_format format,
+			    enum layout_format layout, unsigned level,
+			    unsigned width, unsigned height,
+			    struct grate_texture_key *key);
+int grate_texture_cache_load(struct grate *grate,
+			     const struct grate_texture_key *key,
+			     struct grate_image *img);
+void grate_texture_cache_store(struct grate *grate,
+			       const struct grate_texture_key *key,
+			       const struct grate_image *img);
+
 #define grate_error(fmt, args...) \
 	fprintf(stderr, "\033[31mERROR: %s: " fmt "\033[0m", \
 		__func__, ##args)
@@ -23,31 +23,254 @@
  */
 
 #include <math.h>
+#include <string.h>
 
 #include "matrix.h"
 
+/*
+ * The SIMD code is written with GCC vector extensions, which are emitted
+ * as SSE or NEON depending on the target (and as scalar code elsewhere).
+ * Loads and stores go through memcpy() since neither struct mat4 nor the
+ * context uniforms are guaranteed to be 16 bytes aligned.
+ */
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int v4si __attribute__((vector_size(16)));
+
+#ifdef __clang__
+#define v4_shuffle(a, b, x, y, z, w) \
+	__builtin_shufflevector(a, b, x, y, (z) + 4, (w) + 4)
+#else
+#define v4_shuffle(a, b, x, y, z, w) \
+	__builtin_shuffle(a, b, (v4si){ x, y, (z) + 4, (w) + 4 })
+#endif
+
+#define v4_swizzle(a, x, y, z, w)	v4_shuffle(a, a, x, y, z, w)
+
+static inline v4sf v4_load(const float *p)
+{
+	v4sf v;
+
+	memcpy(&v, p, sizeof(v));
+
+	return v;
+}
+
+static inline void v4_store(float *p, v4sf v)
+{
+	memcpy(p, &v, sizeof(v));
+}
+
+static inline v4sf v4_splat(float f)
+{
+	return (v4sf){ f, f, f, f };
+}
+
+static inline float v4_dot3(v4sf a, v4sf b)
+{
+	v4sf v = a * b;
+
+	return v[0] + v[1] + v[2];
+}
+
+static inline v4sf v4_cross(v4sf a, v4sf b)
+{
+	return v4_swizzle(a, 1, 2, 0, 3) * v4_swizzle(b, 2, 0, 1, 3) -
+	       v4_swizzle(a, 2, 0, 1, 3) * v4_swizzle(b, 1, 2, 0, 3);
+}
+
+static inline v4sf v4_normalize3(v4sf v)
+{
+	float len = sqrtf(v4_dot3(v, v));
+
+	return len > 0.0f ? v / v4_splat(len) : v;
+}
+
+/*
+ * Result rows are accumulated in the same order as the original scalar
+ * implementation, so results are bit-identical to it.
+ */
+static inline void mat4_multiply_rows(float *r, const float *a,
+				      const v4sf b[4])
+{
+	v4sf rows[4];
+	unsigned i;
+
+	for (i = 0; i < 4; i++) {
+		rows[i] = v4_splat(a[i * 4 + 0]) * b[0];
+		rows[i] += v4_splat(a[i * 4 + 1]) * b[1];
+		rows[i] += v4_splat(a[i * 4 + 2]) * b[2];
+		rows[i] += v4_splat(a[i * 4 + 3]) * b[3];
+	}
+
+	/* stored last, result may alias a */
+	for (i = 0; i < 4; i++)
+		v4_store(r + i * 4, rows[i]);
+}
+
 void mat4_multiply(struct mat4 *result, const struct mat4 *a,
 		   const struct mat4 *b)
 {
-	result->xx = a->xx * b->xx + a->xy * b->yx + a->xz * b->zx + a->xw * b->wx;
-	result->xy = a->xx * b->xy + a->xy * b->yy + a->xz * b->zy + a->xw * b->wy;
-	result->xz = a->xx * b->xz + a->xy * b->yz + a->xz * b->zz + a->xw * b->wz;
-	result->xw = a->xx * b->xw + a->xy * b->yw + a->xz * b->zw + a->xw * b->ww;
-
-	result->yx = a->yx * b->xx + a->yy * b->yx + a->yz * b->zx + a->yw * b->wx;
-	result->yy = a->yx * b->xy + a->yy * b->yy + a->yz * b->zy + a->yw * b->wy;
-	result->yz = a->yx * b->xz + a->yy * b->yz + a->yz * b->zz + a->yw * b->wz;
-	result->yw = a->yx * b->xw + a->yy * b->yw + a->yz * b->zw + a->yw * b->ww;
-
-	result->zx = a->zx * b->xx + a->zy * b->yx + a->zz * b->zx + a->zw * b->wx;
-	result->zy = a->zx * b->xy + a->zy * b->yy + a->zz * b->zy + a->zw * b->wy;
-	result->zz = a->zx * b->xz + a->zy * b->yz + a->zz * b->zz + a->zw * b->wz;
-	result->zw = a->zx * b->xw + a->zy * b->yw + a->zz * b->zw + a->zw * b->ww;
-
-	result->wx = a->wx * b->xx + a->wy * b->yx + a->wz * b->zx + a->ww * b->wx;
-	result->wy = a->wx * b->xy + a->wy * b->yy + a->wz * b->zy + a->ww * b->wy;
-	result->wz = a->wx * b->xz + a->wy * b->yz + a->wz * b->zz + a->ww * b->wz;
-	result->ww = a->wx * b->xw + a->wy * b->yw + a->wz * b->zw + a->ww * b->ww;
+	const float *mb = &b->xx;
+	v4sf rows[4] = {
+		v4_load(mb + 0), v4_load(mb + 4),
+		v4_load(mb + 8), v4_load(mb + 12),
+	};
+
+	mat4_multiply_rows(&result->xx, &a->xx, rows);
+}
+
+/* results[i] = a * b[i], e.g. view-projection times model matrices */
+void mat4_multiply_batch(struct mat4 *results, const struct mat4 *a,
+			 const struct mat4 *b, unsigned count)
+{
+	unsigned i;
+
+	for (i = 0; i < count; i++)
+		mat4_multiply(&results[i], a, &b[i]);
+}
+
+void mat4_transpose(struct mat4 *result, const struct mat4 *m)
+{
+	const float *f = &m->xx;
+	v4sf r0 = v4_load(f + 0), r1 = v4_load(f + 4);
+	v4sf r2 = v4_load(f + 8), r3 = v4_load(f + 12);
+	v4sf t0 = v4_shuffle(r0, r1, 0, 1, 0, 1);
+	v4sf t1 = v4_shuffle(r0, r1, 2, 3, 2, 3);
+	v4sf t2 = v4_shuffle(r2, r3, 0, 1, 0, 1);
+	v4sf t3 = v4_shuffle(r2, r3, 2, 3, 2, 3);
+
+	v4_store(&result->xx, v4_shuffle(t0, t2, 0, 2, 0, 2));
+	v4_store(&result->yx, v4_shuffle(t0, t2, 1, 3, 1, 3));
+	v4_store(&result->zx, v4_shuffle(t1, t3, 0, 2, 0, 2));
+	v4_store(&result->wx, v4_shuffle(t1, t3, 1, 3, 1, 3));
+}
+
+/* 2x2 blocks are stored as (m00, m01, m10, m11) */
+static inline v4sf mat2_mul(v4sf a, v4sf b)
+{
+	return a * v4_swizzle(b, 0, 3, 0, 3) +
+	       v4_swizzle(a, 1, 0, 3, 2) * v4_swizzle(b, 2, 1, 2, 1);
+}
+
+/* adj(a) * b */
+static inline v4sf mat2_adj_mul(v4sf a, v4sf b)
+{
+	return v4_swizzle(a, 3, 3, 0, 0) * b -
+	       v4_swizzle(a, 1, 1, 2, 2) * v4_swizzle(b, 2, 3, 0, 1);
+}
+
+/* a * adj(b) */
+static inline v4sf mat2_mul_adj(v4sf a, v4sf b)
+{
+	return a * v4_swizzle(b, 3, 0, 3, 0) -
+	       v4_swizzle(a, 1, 0, 3, 2) * v4_swizzle(b, 2, 1, 2, 1);
+}
+
+/*
+ * Blockwise inversion of general 4x4 matrices, see the 2x2 block
+ * formulation of the Schur complement. Returns false for singular input,
+ * leaving the result untouched.
+ */
+bool mat4_inverse(struct mat4 *result, const struct mat4 *m)
+{
+	const float *f = &m->xx;
+	v4sf r0 = v4_load(f + 0), r1 = v4_load(f + 4);
+	v4sf r2 = v4_load(f + 8), r3 = v4_load(f + 12);
+	v4sf A = v4_shuffle(r0, r1, 0, 1, 0, 1);
+	v4sf B = v4_shuffle(r0, r1, 2, 3, 2, 3);
+	v4sf C = v4_shuffle(r2, r3, 0, 1, 0, 1);
+	v4sf D = v4_shuffle(r2, r3, 2, 3, 2, 3);
+	v4sf det_sub, D_C, A_B, X, Y, Z, W, tr, rdet;
+	float det_a, det_b, det_c, det_d, det;
+
+	det_sub = v4_shuffle(r0, r2, 0, 2, 0, 2) *
+		  v4_shuffle(r1, r3, 1, 3, 1, 3) -
+		  v4_shuffle(r0, r2, 1, 3, 1, 3) *
+		  v4_shuffle(r1, r3, 0, 2, 0, 2);
+
+	det_a = det_sub[0];
+	det_b = det_sub[1];
+	det_c = det_sub[2];
+	det_d = det_sub[3];
+
+	D_C = mat2_adj_mul(D, C);
+	A_B = mat2_adj_mul(A, B);
+
+	X = v4_splat(det_d) * A - mat2_mul(B, D_C);
+	W = v4_splat(det_a) * D - mat2_mul(C, A_B);
+	Y = v4_splat(det_b) * C - mat2_mul_adj(D, A_B);
+	Z = v4_splat(det_c) * B - mat2_mul_adj(A, D_C);
+
+	tr = A_B * v4_swizzle(D_C, 0, 2, 1, 3);
+	det = det_a * det_d + det_b * det_c - (tr[0] + tr[1] + tr[2] + tr[3]);
+
+	if (det == 0.0f || !isfinite(det))
+		return false;
+
+	rdet = (v4sf){ 1.0f, -1.0f, -1.0f, 1.0f } / v4_splat(det);
+
+	X *= rdet;
+	Y *= rdet;
+	Z *= rdet;
+	W *= rdet;
+
+	v4_store(&result->xx, v4_shuffle(X, Y, 3, 1, 3, 1));
+	v4_store(&result->yx, v4_shuffle(X, Y, 2, 0, 2, 0));
+	v4_store(&result->zx, v4_shuffle(Z, W, 3, 1, 3, 1));
+	v4_store(&result->wx, v4_shuffle(Z, W, 2, 0, 2, 0));
+
+	return true;
+}
+
+/*
+ * Inverse transpose of the upper 3x3, i.e. the cofactor matrix divided by
+ * the determinant, padded to a mat4 so that it maps to vec4 uniforms.
+ */
+bool mat4_normal_matrix(struct mat4 *result, const struct mat4 *m)
+{
+	const float *f = &m->xx;
+	v4sf mask = { 1.0f, 1.0f, 1.0f, 0.0f };
+	v4sf r0 = v4_load(f + 0) * mask;
+	v4sf r1 = v4_load(f + 4) * mask;
+	v4sf r2 = v4_load(f + 8) * mask;
+	v4sf c0 = v4_cross(r1, r2);
+	v4sf c1 = v4_cross(r2, r0);
+	v4sf c2 = v4_cross(r0, r1);
+	float det = v4_dot3(r0, c0);
+	v4sf rdet;
+
+	if (det == 0.0f || !isfinite(det))
+		return false;
+
+	rdet = v4_splat(1.0f / det);
+
+	v4_store(&result->xx, c0 * rdet);
+	v4_store(&result->yx, c1 * rdet);
+	v4_store(&result->zx, c2 * rdet);
+	v4_store(&result->wx, (v4sf){ 0.0f, 0.0f, 0.0f, 1.0f });
+
+	return true;
+}
+
+void mat4_look_at(struct mat4 *m, float eye_x, float eye_y, float eye_z,
+		  float center_x, float center_y, float center_z,
+		  float up_x, float up_y, float up_z)
+{
+	v4sf eye = { eye_x, eye_y, eye_z, 0.0f };
+	v4sf center = { center_x, center_y, center_z, 0.0f };
+	v4sf up = { up_x, up_y, up_z, 0.0f };
+	v4sf f = v4_normalize3(center - eye);
+	v4sf s = v4_normalize3(v4_cross(f, up));
+	v4sf u = v4_cross(s, f);
+
+	s[3] = -v4_dot3(s, eye);
+	u[3] = -v4_dot3(u, eye);
+	f[3] = -v4_dot3(f, eye);
+
+	v4_store(&m->xx, s);
+	v4_store(&m->yx, u);
+	v4_store(&m->zx, -f);
+	v4_store(&m->wx, (v4sf){ 0.0f, 0.0f, 0.0f, 1.0f });
 }
 
 void mat4_zero(struct mat4 *m)
@@ -25,6 +25,8 @@
 #ifndef GRATE_NVHOST_MATRIX_H
 #define GRATE_NVHOST_MATRIX_H 1
 
+#include <stdbool.h>
+
 struct mat4 {
 	float xx, xy, xz, xw;
 	float yx, yy, yz, yw;
@@ -34,6 +36,11 @@ struct mat4 {
 
 void mat4_multiply(struct mat4 *result, const struct mat4 *a,
 		   const struct mat4 *b);
+void mat4_multiply_batch(struct mat4 *results, const struct mat4 *a,
+			 const struct mat4 *b, unsigned count);
+void mat4_transpose(struct mat4 *result, const struct mat4 *m);
+bool mat4_inverse(struct mat4 *result, const struct mat4 *m);
+bool mat4_normal_matrix(struct mat4 *result, const struct mat4 *m);
 void mat4_zero(struct mat4 *m);
 void mat4_identity(struct mat4 *m);
 void mat4_translate(struct mat4 *m, float x, float y, float z);
@@ -44,5 +51,8 @@ void mat4_rotate_z(struct mat4 *m, float angle);
 
 void mat4_perspective(struct mat4 *m, float fov, float aspect,
 		      float near, float far);
+void mat4_look_at(struct mat4 *m, float eye_x, float eye_y, float eye_z,
+		  float center_x, float center_y, float center_z,
+		  float up_x, float up_y, float up_z);
 
 #endif
@@ -229,16 +229,99 @@ void grate_program_free(struct grate_program *program)
 	if (program) {
 		grate_shader_free(program->fs);
 		grate_shader_free(program->vs);
+		free(program->attributes_table.entries);
+		free(program->vs_uniforms_table.entries);
+		free(program->fs_uniforms_table.entries);
 	}
 
 	free(program);
 }
 
+static uint32_t grate_symbol_hash(const char *name)
+{
+	uint32_t hash = 2166136261u;
+
+	while (*name) {
+		hash ^= (uint8_t)*name++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static const struct grate_symbol_entry *
+grate_symbol_table_find(const struct grate_symbol_table *table,
+			const char *name)
+{
+	uint32_t hash = grate_symbol_hash(name);
+	unsigned i;
+
+	if (!table->entries)
+		return NULL;
+
+	for (i = hash & table->mask; table->entries[i].name;
+	     i = (i + 1) & table->mask) {
+		if (table->entries[i].hash == hash &&
+		    strcmp(table->entries[i].name, name) == 0)
+			return &table->entries[i];
+	}
+
+	return NULL;
+}
+
+static int grate_symbol_table_init(struct grate_symbol_table *table,
+				   unsigned count)
+{
+	unsigned size;
+
+	free(table->entries);
+
+	/* keep the load factor at or below 50% */
+	for (size = 4; size < count * 2; size <<= 1)
+		;
+
+	table->entries = calloc(size, sizeof(*table->entries));
+	if (!table->entries) {
+		grate_error("Failed to allocate symbol table\n");
+		return -1;
+	}
+
+	table->mask = size - 1;
+
+	return 0;
+}
+
+static void grate_symbol_table_insert(struct grate_symbol_table *table,
+				      const char *name, int position)
+{
+	uint32_t hash = grate_symbol_hash(name);
+	unsigned i;
+
+	/* first definition wins, like the linear lookup did */
+	if (grate_symbol_table_find(table, name))
+		return;
+
+	for (i = hash & table->mask; table->entries[i].name;
+	     i = (i + 1) & table->mask)
+		;
+
+	table->entries[i].hash = hash;
+	table->entries[i].position = position;
+	table->entries[i].name = name;
+}
+
 int grate_get_attribute_location(struct grate_program *program,
 				 const char *name)
 {
+	const struct grate_symbol_entry *entry;
 	unsigned i;
 
+	if (program->attributes_table.entries) {
+		entry = grate_symbol_table_find(&program->attributes_table,
+						name);
+		return entry ? entry->position : -1;
+	}
+
 	for (i = 0; i < program->num_attributes; i++) {
 		struct grate_attribute *attribute = &program->attributes[i];
 
@@ -252,8 +335,15 @@ int grate_get_attribute_location(struct grate_program *program,
 int grate_get_vertex_uniform_location(struct grate_program *program,
 				      const char *name)
 {
+	const struct grate_symbol_entry *entry;
 	unsigned i;
 
+	if (program->vs_uniforms_table.entries) {
+		entry = grate_symbol_table_find(&program->vs_uniforms_table,
+						name);
+		return entry ? entry->position : -1;
+	}
+
 	for (i = 0; i < program->num_vs_uniforms; i++) {
 		struct grate_uniform *uniform = &program->vs_uniforms[i];
 
@@ -267,8 +357,15 @@ int grate_get_vertex_uniform_location(struct grate_program *program,
 int grate_get_fragment_uniform_location(struct grate_program *program,
 					const char *name)
 {
+	const struct grate_symbol_entry *entry;
 	unsigned i;
 
+	if (program->fs_uniforms_table.entries) {
+		entry = grate_symbol_table_find(&program->fs_uniforms_table,
+						name);
+		return entry ? entry->position : -1;
+	}
+
 	for (i = 0; i < program->num_fs_uniforms; i++) {
 		struct grate_uniform *uniform = &program->fs_uniforms[i];
 
@@ -279,6 +376,49 @@ int grate_get_fragment_uniform_location(struct grate_program *program,
 	return -1;
 }
 
+struct grate_uniform_handle
+grate_get_vertex_uniform_handle(struct grate_program *program,
+				const char *name)
+{
+	struct grate_uniform_handle handle = { 0 };
+	int location;
+
+	location = grate_get_vertex_uniform_location(program, name);
+	if (location < 0 || location >= 256)
+		return handle;
+
+	handle.bits = GRATE_UNIFORM_VALID | location;
+
+	return handle;
+}
+
+struct grate_uniform_handle
+grate_get_fragment_uniform_handle(struct grate_program *program,
+				  const char *name)
+{
+	struct grate_uniform_handle handle = { 0 };
+	unsigned components_mask;
+	int location;
+
+	location = grate_get_fragment_uniform_location(program, name);
+	if (location < 0)
+		return handle;
+
+	components_mask = (location >> 8) & 0xf;
+
+	if (components_mask == 0 || (location & 0xff) >= 64)
+		return handle;
+
+	handle.bits = GRATE_UNIFORM_VALID | GRATE_UNIFORM_FRAGMENT |
+		      components_mask << GRATE_UNIFORM_MASK_SHIFT |
+		      (location & 0xff);
+
+	if (location & 0x8000)
+		handle.bits |= GRATE_UNIFORM_LOWP;
+
+	return handle;
+}
+
 static void grate_program_add_attribute(struct grate_program *program,
 					struct cgc_symbol *symbol)
 {
@@ -453,4 +593,28 @@ void grate_program_link(struct grate_program *program)
 
 		printf("\n");
 	}
+
+	if (grate_symbol_table_init(&program->attributes_table,
+				    program->num_attributes) == 0) {
+		for (i = 0; i < program->num_attributes; i++)
+			grate_symbol_table_insert(&program->attributes_table,
+						  program->attributes[i].name,
+						  program->attributes[i].position);
+	}
+
+	if (grate_symbol_table_init(&program->vs_uniforms_table,
+				    program->num_vs_uniforms) == 0) {
+		for (i = 0; i < program->num_vs_uniforms; i++)
+			grate_symbol_table_insert(&program->vs_uniforms_table,
+						  program->vs_uniforms[i].name,
+						  program->vs_uniforms[i].position);
+	}
+
+	if (grate_symbol_table_init(&program->fs_uniforms_table,
+				    program->num_fs_uniforms) == 0) {
+		for (i = 0; i < program->num_fs_uniforms; i++)
+			grate_symbol_table_insert(&program->fs_uniforms_table,
+						  program->fs_uniforms[i].name,
+						  program->fs_uniforms[i].position);
+	}
 }
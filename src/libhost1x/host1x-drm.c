@@ -27,6 +27,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <string.h>
 #include <time.h>
@@ -58,6 +60,12 @@
 
 struct drm;
 
+/* property IDs are looked up once per plane */
+struct drm_plane_props {
+	uint32_t rotation;
+	uint32_t fb_id;
+};
+
 struct drm_bo {
 	struct host1x_bo base;
 	struct drm *drm;
@@ -93,8 +101,23 @@ struct drm_display {
 	unsigned int pipe;
 	uint32_t plane;
 	uint32_t crtc;
+	uint32_t scanout;
 	int reflected;
 	bool upside_down;
+	bool atomic;
+
+	struct drm_plane_props props;
+
+	/*
+	 * At most one flip is queued at a time, its completion event is
+	 * handled by the flip thread.
+	 */
+	pthread_t flip_thread;
+	pthread_mutex_t flip_lock;
+	pthread_cond_t flip_cond;
+	bool flip_thread_running;
+	bool flip_pending;
+	int flip_wake[2];
 };
 
 static inline struct drm_display *to_drm_display(struct host1x_display *display)
@@ -105,6 +128,7 @@ static inline struct drm_display *to_drm_display(struct host1x_display *display)
 struct drm_overlay {
 	struct host1x_overlay base;
 	struct drm_display *display;
+	struct drm_plane_props props;
 	uint32_t plane;
 
 	unsigned int x;
@@ -208,34 +232,44 @@ static int drm_display_find_plane(struct drm_display *display,
 	return 0;
 }
 
-static int drm_overlay_reflect(struct drm_display *display, uint32_t plane_id,
-			       bool reflect_y)
+static void drm_plane_props_init(struct drm *drm, uint32_t plane_id,
+				 struct drm_plane_props *props)
 {
-#ifdef DRM_MODE_REFLECT_Y
-	struct drm *drm = display->drm;
 	drmModeObjectPropertiesPtr properties;
 	drmModePropertyPtr property;
-	drmModeAtomicReqPtr req;
-	unsigned int rotate_display;
-	unsigned int reflect_flag;
 	unsigned int i;
-	int ret;
 
-	req = drmModeAtomicAlloc();
-	if (!req) {
-		host1x_error("drmModeAtomicAlloc() failed\n");
-		return -ENOMEM;
-	}
+	memset(props, 0, sizeof(*props));
 
 	properties = drmModeObjectGetProperties(drm->fd, plane_id,
 						DRM_MODE_OBJECT_PLANE);
 	if (!properties) {
 		host1x_error("drmModeObjectGetProperties() failed\n");
-		ret = -EINVAL;
-		goto atomic_free;
+		return;
+	}
+
+	for (i = 0; i < properties->count_props; i++) {
+		property = drmModeGetProperty(drm->fd, properties->props[i]);
+		if (!property)
+			continue;
+
+		if (!strcmp(property->name, "rotation"))
+			props->rotation = property->prop_id;
+		else if (!strcmp(property->name, "FB_ID"))
+			props->fb_id = property->prop_id;
+
+		drmModeFreeProperty(property);
 	}
 
-	rotate_display = drm->base.options->rotate_display;
+	drmModeFreeObjectProperties(properties);
+}
+
+#ifdef DRM_MODE_REFLECT_Y
+static uint64_t drm_plane_rotation(struct drm_display *display,
+				   bool reflect_y)
+{
+	unsigned int rotate_display = display->drm->base.options->rotate_display;
+	uint64_t value;
 
 	if (rotate_display != 0 && rotate_display != 180) {
 		host1x_error("unsupported display rotation %u, only 0 and 180 are supported\n",
@@ -247,34 +281,44 @@ static int drm_overlay_reflect(struct drm_display *display, uint32_t plane_id,
 	if (display->upside_down)
 		rotate_display = (rotate_display == 0) ? 180 : 0;
 
-	for (i = 0, ret = -100; i < properties->count_props; i++) {
-		property = drmModeGetProperty(drm->fd, properties->props[i]);
-		if (!property)
-			continue;
+	if (reflect_y)
+		value = DRM_MODE_REFLECT_Y;
+	else
+		value = 0;
 
-		if (reflect_y)
-			reflect_flag = DRM_MODE_REFLECT_Y;
-		else
-			reflect_flag = 0;
-
-		if (!strcmp(property->name, "rotation")) {
-			if (rotate_display == 180)
-				reflect_flag |= DRM_MODE_ROTATE_180;
-			else
-				reflect_flag |= DRM_MODE_ROTATE_0;
-
-			ret = drmModeAtomicAddProperty(req, plane_id,
-						       property->prop_id,
-						       reflect_flag);
-			if (ret < 0)
-				host1x_error("drmModeAtomicAddProperty() failed: %d\n",
-					     ret);
-		}
+	if (rotate_display == 180)
+		value |= DRM_MODE_ROTATE_180;
+	else
+		value |= DRM_MODE_ROTATE_0;
 
-		free(property);
+	return value;
+}
+#endif
+
+static int drm_overlay_reflect(struct drm_display *display, uint32_t plane_id,
+			       const struct drm_plane_props *props,
+			       bool reflect_y)
+{
+#ifdef DRM_MODE_REFLECT_Y
+	struct drm *drm = display->drm;
+	drmModeAtomicReqPtr req;
+	int ret;
+
+	if (!props->rotation) {
+		host1x_error("couldn't get DRM plane \"rotation\" property\n");
+		return -100;
+	}
+
+	req = drmModeAtomicAlloc();
+	if (!req) {
+		host1x_error("drmModeAtomicAlloc() failed\n");
+		return -ENOMEM;
 	}
 
-	free(properties);
+	ret = drmModeAtomicAddProperty(req, plane_id, props->rotation,
+				       drm_plane_rotation(display, reflect_y));
+	if (ret < 0)
+		host1x_error("drmModeAtomicAddProperty() failed: %d\n", ret);
 
 	if (ret >= 0) {
 		ret = drmModeAtomicCommit(drm->fd, req, 0, NULL);
@@ -282,12 +326,8 @@ static int drm_overlay_reflect(struct drm_display *display, uint32_t plane_id,
 			host1x_error("drmModeAtomicCommit() failed: %d\n", ret);
 	}
 
-atomic_free:
 	drmModeAtomicFree(req);
 
-	if (ret == -100)
-		host1x_error("couldn't get DRM plane \"rotation\" property\n");
-
 	return ret;
 #else
 	return 0;
@@ -318,7 +358,8 @@ static int drm_overlay_set(struct host1x_overlay *overlay,
 	int err;
 
 	if (plane->reflected != reflect_y) {
-		drm_overlay_reflect(display, plane->plane, reflect_y);
+		drm_overlay_reflect(display, plane->plane, &plane->props,
+				    reflect_y);
 		plane->reflected = reflect_y;
 	}
 
@@ -378,6 +419,8 @@ static int drm_overlay_create(struct host1x_display *display,
 	overlay->plane = plane;
 	overlay->reflected = -1;
 
+	drm_plane_props_init(drm->drm, plane, &overlay->props);
+
 	*overlayp = &overlay->base;
 
 	return 0;
@@ -387,6 +430,12 @@ static void drm_display_on_page_flip(int fd, unsigned int frame,
 				     unsigned int sec, unsigned int usec,
 				     void *data)
 {
+	struct drm_display *drm = data;
+
+	pthread_mutex_lock(&drm->flip_lock);
+	drm->flip_pending = false;
+	pthread_cond_broadcast(&drm->flip_cond);
+	pthread_mutex_unlock(&drm->flip_lock);
 }
 
 static void drm_display_on_vblank(int fd, unsigned int frame,
@@ -395,62 +444,252 @@ static void drm_display_on_vblank(int fd, unsigned int frame,
 {
 }
 
-static int drm_display_set(struct host1x_display *display,
-			   struct host1x_framebuffer *fb,
-			   bool vsync, bool reflect_y)
+/*
+ * Re-presenting the framebuffer that is already being scanned out only
+ * needs the damaged regions to be flushed; on atomic drivers the kernel
+ * forwards these as FB_DAMAGE_CLIPS to the plane.
+ */
+static int drm_display_dirty(struct drm_display *drm,
+			     struct host1x_framebuffer *fb)
 {
-	struct drm_display *drm = to_drm_display(display);
-	int err;
+	struct host1x_display *display = &drm->base;
+	drmModeClip clips[display->num_damage];
+	unsigned int i;
 
-	if (drm->reflected != reflect_y) {
-		drm_overlay_reflect(drm, drm->plane, reflect_y);
-		drm->reflected = reflect_y;
+	for (i = 0; i < display->num_damage; i++) {
+		const struct host1x_gr2d_rect *r = &display->damage[i];
+
+		clips[i].x1 = r->x;
+		clips[i].y1 = r->y;
+		clips[i].x2 = r->x + r->width;
+		clips[i].y2 = r->y + r->height;
 	}
 
-	if (vsync) {
-		struct timeval timeout;
-		fd_set fds;
+	if (drmModeDirtyFB(drm->drm->fd, fb->handle, clips, i) < 0)
+		return -errno;
 
-		err = drmModePageFlip(drm->drm->fd, drm->crtc, fb->handle,
-				      DRM_MODE_PAGE_FLIP_EVENT, drm);
-		if (err < 0) {
-			err = drmModeSetCrtc(drm->drm->fd, drm->crtc,
-					     fb->handle, 0, 0, &drm->connector,
-					     1, &drm->mode);
-		}
+	return 0;
+}
 
-		if (err < 0) {
-			host1x_error("drmModePageFlip() failed: %m\n");
-			return -errno;
+static void *drm_display_flip_thread(void *arg)
+{
+	struct drm_display *drm = arg;
+	drmEventContext context;
+	struct pollfd fds[2];
+
+	memset(&context, 0, sizeof(context));
+	context.version = DRM_EVENT_CONTEXT_VERSION;
+	context.page_flip_handler = drm_display_on_page_flip;
+	context.vblank_handler = drm_display_on_vblank;
+
+	fds[0].fd = drm->drm->fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = drm->flip_wake[0];
+	fds[1].events = POLLIN;
+
+	for (;;) {
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+
+			host1x_error("poll() failed: %m\n");
+			break;
 		}
 
-		memset(&timeout, 0, sizeof(timeout));
-		timeout.tv_sec = 1;
-		timeout.tv_usec = 0;
+		if (fds[1].revents)
+			break;
 
-		FD_ZERO(&fds);
-		FD_SET((unsigned)drm->drm->fd, &fds);
+		if (fds[0].revents & POLLIN)
+			drmHandleEvent(drm->drm->fd, &context);
+	}
 
-		err = select(drm->drm->fd + 1, &fds, NULL, NULL, &timeout);
-		if (err <= 0) {
-		}
+	return NULL;
+}
 
-		if (FD_ISSET((unsigned)drm->drm->fd, &fds)) {
-			drmEventContext context;
+static int drm_display_start_flip_thread(struct drm_display *drm)
+{
+	int err;
 
-			memset(&context, 0, sizeof(context));
-			context.version = DRM_EVENT_CONTEXT_VERSION;
-			context.page_flip_handler = drm_display_on_page_flip;
-			context.vblank_handler = drm_display_on_vblank;
+	if (pipe(drm->flip_wake) < 0)
+		return -errno;
 
-			drmHandleEvent(drm->drm->fd, &context);
+	pthread_mutex_init(&drm->flip_lock, NULL);
+	pthread_cond_init(&drm->flip_cond, NULL);
+
+	err = pthread_create(&drm->flip_thread, NULL, drm_display_flip_thread,
+			     drm);
+	if (err) {
+		pthread_cond_destroy(&drm->flip_cond);
+		pthread_mutex_destroy(&drm->flip_lock);
+		close(drm->flip_wake[0]);
+		close(drm->flip_wake[1]);
+		return -err;
+	}
+
+	drm->flip_thread_running = true;
+
+	return 0;
+}
+
+/* blocks until the queued flip, if any, has hit the screen */
+static int drm_display_wait(struct host1x_display *display)
+{
+	struct drm_display *drm = to_drm_display(display);
+	struct timespec timeout;
+	int err = 0;
+
+	if (!drm->flip_thread_running)
+		return 0;
+
+	clock_gettime(CLOCK_REALTIME, &timeout);
+	timeout.tv_sec += 1;
+
+	pthread_mutex_lock(&drm->flip_lock);
+
+	while (drm->flip_pending && err == 0)
+		err = pthread_cond_timedwait(&drm->flip_cond, &drm->flip_lock,
+					     &timeout);
+
+	if (drm->flip_pending) {
+		host1x_error("page flip timed out\n");
+		drm->flip_pending = false;
+		err = -ETIMEDOUT;
+	}
+
+	pthread_mutex_unlock(&drm->flip_lock);
+
+	return err;
+}
+
+static void drm_display_stop_flip_thread(struct drm_display *drm)
+{
+	char c = 0;
+
+	if (!drm->flip_thread_running)
+		return;
+
+	drm_display_wait(&drm->base);
+
+	if (write(drm->flip_wake[1], &c, 1) == 1)
+		pthread_join(drm->flip_thread, NULL);
+	else
+		pthread_cancel(drm->flip_thread);
+
+	pthread_cond_destroy(&drm->flip_cond);
+	pthread_mutex_destroy(&drm->flip_lock);
+	close(drm->flip_wake[0]);
+	close(drm->flip_wake[1]);
+
+	drm->flip_thread_running = false;
+}
+
+static int drm_display_flip(struct drm_display *drm,
+			    struct host1x_framebuffer *fb)
+{
+	int err;
+
+#ifdef DRM_MODE_ATOMIC_NONBLOCK
+	if (drm->atomic) {
+		drmModeAtomicReqPtr req;
+
+		req = drmModeAtomicAlloc();
+		if (!req)
+			return -ENOMEM;
+
+		err = drmModeAtomicAddProperty(req, drm->plane,
+					       drm->props.fb_id, fb->handle);
+		if (err >= 0)
+			err = drmModeAtomicCommit(drm->drm->fd, req,
+						  DRM_MODE_ATOMIC_NONBLOCK |
+						  DRM_MODE_PAGE_FLIP_EVENT,
+						  drm);
+
+		/*
+		 * Only give up on atomic flips if the driver rejects the
+		 * request itself, not because of a transient failure.
+		 */
+		if (err == -EINVAL || err == -EOPNOTSUPP) {
+			err = drmModeAtomicCommit(drm->drm->fd, req,
+						  DRM_MODE_ATOMIC_TEST_ONLY,
+						  NULL);
+			if (err == -EINVAL || err == -EOPNOTSUPP) {
+				host1x_info("atomic page flips unsupported: %d, using legacy flips\n",
+					    err);
+				drm->atomic = false;
+			}
+
+			err = -EINVAL;
 		}
-	} else {
-		err = drmModeSetCrtc(drm->drm->fd, drm->crtc, fb->handle, 0,
-				     0, &drm->connector, 1, &drm->mode);
-		if (err < 0)
-			return -errno;
+
+		drmModeAtomicFree(req);
+
+		if (err >= 0)
+			return 0;
+
+		if (drm->atomic)
+			return err;
 	}
+#endif
+
+	err = drmModePageFlip(drm->drm->fd, drm->crtc, fb->handle,
+			      DRM_MODE_PAGE_FLIP_EVENT, drm);
+	if (err < 0)
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * With vsync the flip is queued and this returns right away. Only when
+ * the previous flip is still pending does it block, callers that reuse
+ * the old front buffer straight away need host1x_display_wait().
+ */
+static int drm_display_set(struct host1x_display *display,
+			   struct host1x_framebuffer *fb,
+			   bool vsync, bool reflect_y)
+{
+	struct drm_display *drm = to_drm_display(display);
+	int err;
+
+	if (drm->reflected != reflect_y) {
+		drm_display_wait(display);
+		drm_overlay_reflect(drm, drm->plane, &drm->props, reflect_y);
+		drm->reflected = reflect_y;
+	}
+
+	/* only one flip can be queued */
+	drm_display_wait(display);
+
+	/*
+	 * Nothing of ours is on the CRTC yet (e.g. fbcon's framebuffer), so
+	 * the first frame has to go through a modeset before we can flip.
+	 */
+	if (vsync && drm->flip_thread_running && drm->scanout) {
+		pthread_mutex_lock(&drm->flip_lock);
+		drm->flip_pending = true;
+		pthread_mutex_unlock(&drm->flip_lock);
+
+		if (drm_display_flip(drm, fb) == 0)
+			goto done;
+
+		pthread_mutex_lock(&drm->flip_lock);
+		drm->flip_pending = false;
+		pthread_mutex_unlock(&drm->flip_lock);
+	} else if (display->num_damage && drm->scanout == fb->handle &&
+		   drm_display_dirty(drm, fb) == 0) {
+		return 0;
+	}
+
+	err = drmModeSetCrtc(drm->drm->fd, drm->crtc, fb->handle, 0, 0,
+			     &drm->connector, 1, &drm->mode);
+	if (err < 0) {
+		err = -errno;
+		host1x_error("drmModeSetCrtc() failed: %d\n", err);
+		return err;
+	}
+
+done:
+	drm->scanout = fb->handle;
 
 	return 0;
 }
@@ -549,6 +788,7 @@ retry_connector:
 static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 {
 	struct drm_display *display;
+	bool atomic = false;
 	int err;
 
 	display = calloc(1, sizeof(*display));
@@ -565,6 +805,8 @@ static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 	err = drmSetClientCap(drm->fd, DRM_CLIENT_CAP_ATOMIC, 1);
 	if (err)
 		host1x_error("drmSetClientCap(ATOMIC) failed: %d\n", err);
+	else
+		atomic = true;
 
 	err = drmSetClientCap(drm->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1);
 	if (err)
@@ -580,6 +822,14 @@ static int drm_display_create(struct drm_display **displayp, struct drm *drm)
 	display->base.height = display->mode.vdisplay;
 	display->base.create_overlay = drm_overlay_create;
 	display->base.set = drm_display_set;
+	display->base.wait = drm_display_wait;
+
+	drm_plane_props_init(drm, display->plane, &display->props);
+	display->atomic = atomic && display->props.fb_id;
+
+	err = drm_display_start_flip_thread(display);
+	if (err < 0)
+		host1x_error("failed to start page flip thread: %d\n", err);
 
 	*displayp = display;
 
@@ -605,6 +855,7 @@ static int drm_display_close(struct drm_display *display)
 
 	drm = display->drm;
 
+	drm_display_stop_flip_thread(display);
 	drmDropMaster(drm->fd);
 	free(display);
 
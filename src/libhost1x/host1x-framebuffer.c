@@ -113,6 +113,9 @@ struct host1x_framebuffer *host1x_framebuffer_create(struct host1x *host1x,
 
 void host1x_framebuffer_free(struct host1x_framebuffer *fb)
 {
+	if (!fb)
+		return;
+
 	host1x_pixelbuffer_free(fb->pixbuf);
 	free(fb);
 }
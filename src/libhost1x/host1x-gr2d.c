@@ -23,6 +23,7 @@
 
 #include <errno.h>
 #include <math.h>
+#include <stdlib.h>
 
 #include "host1x.h"
 #include "host1x-private.h"
@@ -128,69 +129,38 @@ int host1x_gr2d_clear(struct host1x_gr2d *gr2d,
 				      pixbuf->width, pixbuf->height);
 }
 
-int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
-			   struct host1x_pixelbuffer *pixbuf,
-			   uint32_t color,
-			   unsigned x, unsigned y,
-			   unsigned width, unsigned height)
-{
-	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
-	unsigned tiled = 0;
-	uint32_t fence;
-	int err;
-
-	job = HOST1X_JOB_CREATE(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
-
-	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return -ENOMEM;
-	}
-
-	if (x + width > pixbuf->width)
-		return -EINVAL;
+/*
+ * Operations are batched into jobs of up to GR2D_BATCH_OPS rectangles,
+ * the surface setup is emitted once per job and every further rectangle
+ * only updates the registers that differ, with the write to dstps
+ * triggering it.
+ */
+#define GR2D_BATCH_OPS	1024
 
-	if (y + height > pixbuf->height)
-		return -EINVAL;
+/* a surface blit takes ~33 words of the 8K words command buffer */
+#define GR2D_SURFACE_BATCH_OPS	64
 
+static int gr2d_layout_tiled(struct host1x_pixelbuffer *pixbuf,
+			     unsigned *tiled)
+{
 	switch (pixbuf->layout) {
 	case PIX_BUF_LAYOUT_TILED_16x16:
-		tiled = 1;
+		*tiled = 1;
+		return 0;
 	case PIX_BUF_LAYOUT_LINEAR:
-		break;
+		*tiled = 0;
+		return 0;
 	default:
 		host1x_error("Invalid layout %u\n", pixbuf->layout);
 		return -EINVAL;
 	}
+}
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x09, 9));
-	host1x_pushbuf_push(pb, 0x0000003a);
-	host1x_pushbuf_push(pb, 0x00000000);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x1e, 7));
-	host1x_pushbuf_push(pb, 0x00000000);
-	host1x_pushbuf_push(pb, /* controlmain */
-			(PIX_BUF_FORMAT_BYTES(pixbuf->format) >> 1) << 16 |
-			1 << 6 | /* srcsld */
-			1 << 2 /* turbofill */);
-	host1x_pushbuf_push(pb, 0x000000cc);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x2b, 9));
-	HOST1X_PUSHBUF_RELOCATE(pb, pixbuf->bo, pixbuf->bo->offset, 0);
-	host1x_pushbuf_push(pb, 0xdeadbeef);
-	host1x_pushbuf_push(pb, pixbuf->pitch);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x35, 1));
-	host1x_pushbuf_push(pb, color);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x46, 1));
-	host1x_pushbuf_push(pb, tiled << 20); /* tilemode */
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x38, 5));
-	host1x_pushbuf_push(pb, height << 16 | width);
-	host1x_pushbuf_push(pb, y << 16 | x);
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 1));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+static int gr2d_submit_and_wait(struct host1x_gr2d *gr2d,
+				struct host1x_job *job)
+{
+	uint32_t fence;
+	int err;
 
 	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
 	if (err < 0) {
@@ -204,62 +174,127 @@ int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
 	if (err < 0)
 		return err;
 
-	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
+	return HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
+}
+
+int host1x_gr2d_fill_rects(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *pixbuf,
+			   const struct host1x_gr2d_rect *rects,
+			   const uint32_t *colors,
+			   unsigned num_rects)
+{
+	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned tiled, i, n;
+	int err;
+
+	err = gr2d_layout_tiled(pixbuf, &tiled);
 	if (err < 0)
 		return err;
 
+	for (i = 0; i < num_rects; i++) {
+		if (rects[i].x + rects[i].width > pixbuf->width ||
+		    rects[i].y + rects[i].height > pixbuf->height)
+			return -EINVAL;
+	}
+
+	for (i = 0; i < num_rects; i += n) {
+		const struct host1x_gr2d_rect *r = &rects[i];
+
+		n = MIN(num_rects - i, GR2D_BATCH_OPS);
+
+		job = HOST1X_JOB_CREATE(syncpt->id, 1);
+		if (!job)
+			return -ENOMEM;
+
+		pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
+		if (!pb) {
+			host1x_job_free(job);
+			return -ENOMEM;
+		}
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x09, 9));
+		host1x_pushbuf_push(pb, 0x0000003a);
+		host1x_pushbuf_push(pb, 0x00000000);
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x1e, 7));
+		host1x_pushbuf_push(pb, 0x00000000);
+		host1x_pushbuf_push(pb, /* controlmain */
+				(PIX_BUF_FORMAT_BYTES(pixbuf->format) >> 1) << 16 |
+				1 << 6 | /* srcsld */
+				1 << 2 /* turbofill */);
+		host1x_pushbuf_push(pb, 0x000000cc);
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x2b, 9));
+		HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, pixbuf->bo,
+					       pixbuf->bo->offset, 0,
+					       HOST1X_BO_ACCESS_WRITE);
+		host1x_pushbuf_push(pb, 0xdeadbeef);
+		host1x_pushbuf_push(pb, pixbuf->pitch);
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x35, 1));
+		host1x_pushbuf_push(pb, colors[i]);
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x46, 1));
+		host1x_pushbuf_push(pb, tiled << 20); /* tilemode */
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x38, 5));
+		host1x_pushbuf_push(pb, r->height << 16 | r->width);
+		host1x_pushbuf_push(pb, r->y << 16 | r->x);
+
+		for (r++; r < &rects[i + n]; r++) {
+			if (colors[r - rects] != colors[r - rects - 1]) {
+				host1x_pushbuf_push(pb,
+					HOST1X_OPCODE_NONINCR(0x35, 1));
+				host1x_pushbuf_push(pb, colors[r - rects]);
+			}
+
+			host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x38, 5));
+			host1x_pushbuf_push(pb, r->height << 16 | r->width);
+			host1x_pushbuf_push(pb, r->y << 16 | r->x);
+		}
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x00, 1));
+		host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+		err = gr2d_submit_and_wait(gr2d, job);
+		if (err < 0)
+			return err;
+	}
+
 	host1x_pixelbuffer_check_guard(pixbuf);
 
 	return 0;
 }
 
-int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
-		     struct host1x_pixelbuffer *src,
-		     struct host1x_pixelbuffer *dst,
-		     unsigned int sx, unsigned int sy,
-		     unsigned int dx, unsigned int dy,
-		     unsigned int width, int height)
+int host1x_gr2d_clear_rect(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *pixbuf,
+			   uint32_t color,
+			   unsigned x, unsigned y,
+			   unsigned width, unsigned height)
+{
+	struct host1x_gr2d_rect rect = { x, y, width, height };
+
+	return host1x_gr2d_fill_rects(gr2d, pixbuf, &rect, &color, 1);
+}
+
+/* one rectangle converted to GR2D's coordinates */
+struct gr2d_blit_op {
+	unsigned sx, sy, dx, dy;
+	unsigned width, height;
+	uint32_t controlmain;
+};
+
+static int gr2d_blit_op_setup(struct host1x_pixelbuffer *src,
+			      struct host1x_pixelbuffer *dst,
+			      unsigned int sx, unsigned int sy,
+			      unsigned int dx, unsigned int dy,
+			      unsigned int width, int height,
+			      struct gr2d_blit_op *op)
 {
 	struct host1x_bo *src_orig = src->bo->wrapped ?: src->bo;
 	struct host1x_bo *dst_orig = dst->bo->wrapped ?: dst->bo;
-	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
-	unsigned src_tiled = 0;
-	unsigned dst_tiled = 0;
 	unsigned yflip = 0;
 	unsigned xdir = 0;
 	unsigned ydir = 0;
 	unsigned bytes;
-	uint32_t fence;
-	int err;
-
-	if (PIX_BUF_FORMAT_BYTES(src->format) !=
-		PIX_BUF_FORMAT_BYTES(dst->format))
-	{
-		host1x_error("Unequal bytes size\n");
-		return -EINVAL;
-	}
-
-	switch (src->layout) {
-	case PIX_BUF_LAYOUT_TILED_16x16:
-		src_tiled = 1;
-	case PIX_BUF_LAYOUT_LINEAR:
-		break;
-	default:
-		host1x_error("Invalid src layout %u\n", src->layout);
-		return -EINVAL;
-	}
-
-	switch (dst->layout) {
-	case PIX_BUF_LAYOUT_TILED_16x16:
-		dst_tiled = 1;
-	case PIX_BUF_LAYOUT_LINEAR:
-		break;
-	default:
-		host1x_error("Invalid dst layout %u\n", dst->layout);
-		return -EINVAL;
-	}
 
 	if (height < 0) {
 		yflip = 1;
@@ -344,74 +379,180 @@ yflip_setup:
 		bytes = PIX_BUF_FORMAT_BYTES(dst->format);
 	}
 
-	job = HOST1X_JOB_CREATE(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
-
-	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return -ENOMEM;
-	}
-
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
-
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x009, 0x9));
-	host1x_pushbuf_push(pb, 0x0000003a); /* trigger */
-	host1x_pushbuf_push(pb, 0x00000000); /* cmdsel */
-
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x01e, 0x7));
-	host1x_pushbuf_push(pb, 0x00000000); /* controlsecond */
+	op->sx = sx;
+	op->sy = sy;
+	op->dx = dx;
+	op->dy = dy;
+	op->width = width;
+	op->height = height;
 	/*
 	 * [20:20] source color depth (0: mono, 1: same)
 	 * [17:16] destination color depth (0: 8 bpp, 1: 16 bpp, 2: 32 bpp)
 	 */
-	host1x_pushbuf_push(pb, /* controlmain */
-			1 << 20 |
-			(bytes >> 1) << 16 |
-			yflip << 14 | ydir << 10 | xdir << 9);
-	host1x_pushbuf_push(pb, 0x000000cc); /* ropfade */
+	op->controlmain = 1 << 20 |
+			  (bytes >> 1) << 16 |
+			  yflip << 14 | ydir << 10 | xdir << 9;
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x046, 1));
-	/*
-	 * [20:20] destination write tile mode (0: linear, 1: tiled)
-	 * [ 0: 0] tile mode Y/RGB (0: linear, 1: tiled)
-	 */
-	host1x_pushbuf_push(pb, dst_tiled << 20 | src_tiled); /* tilemode */
+	return 0;
+}
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x02b, 0xe149));
-	HOST1X_PUSHBUF_RELOCATE(pb, dst->bo, dst->bo->offset, 0);
-	host1x_pushbuf_push(pb, 0xdeadbeef); /* dstba */
-	host1x_pushbuf_push(pb, dst->pitch); /* dstst */
-	HOST1X_PUSHBUF_RELOCATE(pb, src->bo, src->bo->offset, 0);
-	host1x_pushbuf_push(pb, 0xdeadbeef); /* srcba */
-	host1x_pushbuf_push(pb, src->pitch); /* srcst */
-	host1x_pushbuf_push(pb, height << 16 | width); /* dstsize */
-	host1x_pushbuf_push(pb, sy << 16 | sx); /* srcps */
-	host1x_pushbuf_push(pb, dy << 16 | dx); /* dstps */
+static int gr2d_blit_ops(struct host1x_gr2d *gr2d,
+			 struct host1x_pixelbuffer *src,
+			 struct host1x_pixelbuffer *dst,
+			 const struct gr2d_blit_op *ops,
+			 unsigned num_ops)
+{
+	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	const struct gr2d_blit_op *op, *prev;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned src_tiled;
+	unsigned dst_tiled;
+	unsigned i, n;
+	int err;
 
-	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
-	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+	err = gr2d_layout_tiled(src, &src_tiled);
+	if (err < 0)
+		return err;
 
-	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
-	if (err < 0) {
-		host1x_job_free(job);
+	err = gr2d_layout_tiled(dst, &dst_tiled);
+	if (err < 0)
 		return err;
+
+	for (i = 0; i < num_ops; i += n) {
+		op = &ops[i];
+		n = MIN(num_ops - i, GR2D_BATCH_OPS);
+
+		job = HOST1X_JOB_CREATE(syncpt->id, 1);
+		if (!job)
+			return -ENOMEM;
+
+		pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
+		if (!pb) {
+			host1x_job_free(job);
+			return -ENOMEM;
+		}
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x51, 0));
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x009, 0x9));
+		host1x_pushbuf_push(pb, 0x0000003a); /* trigger */
+		host1x_pushbuf_push(pb, 0x00000000); /* cmdsel */
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x01e, 0x7));
+		host1x_pushbuf_push(pb, 0x00000000); /* controlsecond */
+		host1x_pushbuf_push(pb, op->controlmain); /* controlmain */
+		host1x_pushbuf_push(pb, 0x000000cc); /* ropfade */
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x046, 1));
+		/*
+		 * [20:20] destination write tile mode (0: linear, 1: tiled)
+		 * [ 0: 0] tile mode Y/RGB (0: linear, 1: tiled)
+		 */
+		host1x_pushbuf_push(pb, dst_tiled << 20 | src_tiled); /* tilemode */
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x02b, 0xe149));
+		HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, dst->bo, dst->bo->offset, 0,
+					       HOST1X_BO_ACCESS_WRITE);
+		host1x_pushbuf_push(pb, 0xdeadbeef); /* dstba */
+		host1x_pushbuf_push(pb, dst->pitch); /* dstst */
+		HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, src->bo, src->bo->offset, 0,
+					       HOST1X_BO_ACCESS_READ);
+		host1x_pushbuf_push(pb, 0xdeadbeef); /* srcba */
+		host1x_pushbuf_push(pb, src->pitch); /* srcst */
+		host1x_pushbuf_push(pb, op->height << 16 | op->width); /* dstsize */
+		host1x_pushbuf_push(pb, op->sy << 16 | op->sx); /* srcps */
+		host1x_pushbuf_push(pb, op->dy << 16 | op->dx); /* dstps */
+
+		for (prev = op++; op < &ops[i + n]; prev = op++) {
+			/* blit direction of overlapping copies */
+			if (op->controlmain != prev->controlmain) {
+				host1x_pushbuf_push(pb,
+					HOST1X_OPCODE_NONINCR(0x01f, 1));
+				host1x_pushbuf_push(pb, op->controlmain);
+			}
+
+			host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x038, 0x7));
+			host1x_pushbuf_push(pb, op->height << 16 | op->width);
+			host1x_pushbuf_push(pb, op->sy << 16 | op->sx);
+			host1x_pushbuf_push(pb, op->dy << 16 | op->dx);
+		}
+
+		host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
+		host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
+
+		err = gr2d_submit_and_wait(gr2d, job);
+		if (err < 0)
+			return err;
 	}
 
-	host1x_job_free(job);
+	host1x_pixelbuffer_check_guard(dst);
 
-	err = HOST1X_CLIENT_FLUSH(gr2d->client, &fence);
-	if (err < 0)
-		return err;
+	return 0;
+}
 
-	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
+int host1x_gr2d_blit(struct host1x_gr2d *gr2d,
+		     struct host1x_pixelbuffer *src,
+		     struct host1x_pixelbuffer *dst,
+		     unsigned int sx, unsigned int sy,
+		     unsigned int dx, unsigned int dy,
+		     unsigned int width, int height)
+{
+	struct gr2d_blit_op op;
+	int err;
+
+	if (PIX_BUF_FORMAT_BYTES(src->format) !=
+		PIX_BUF_FORMAT_BYTES(dst->format))
+	{
+		host1x_error("Unequal bytes size\n");
+		return -EINVAL;
+	}
+
+	err = gr2d_blit_op_setup(src, dst, sx, sy, dx, dy, width, height, &op);
 	if (err < 0)
 		return err;
 
-	host1x_pixelbuffer_check_guard(dst);
+	return gr2d_blit_ops(gr2d, src, dst, &op, 1);
+}
 
-	return 0;
+int host1x_gr2d_blit_rects(struct host1x_gr2d *gr2d,
+			   struct host1x_pixelbuffer *src,
+			   struct host1x_pixelbuffer *dst,
+			   const struct host1x_gr2d_blit_rect *rects,
+			   unsigned num_rects)
+{
+	struct gr2d_blit_op *ops;
+	unsigned i;
+	int err;
+
+	if (num_rects == 0)
+		return 0;
+
+	if (PIX_BUF_FORMAT_BYTES(src->format) !=
+		PIX_BUF_FORMAT_BYTES(dst->format))
+	{
+		host1x_error("Unequal bytes size\n");
+		return -EINVAL;
+	}
+
+	ops = malloc(num_rects * sizeof(*ops));
+	if (!ops)
+		return -ENOMEM;
+
+	for (i = 0; i < num_rects; i++) {
+		const struct host1x_gr2d_blit_rect *r = &rects[i];
+
+		err = gr2d_blit_op_setup(src, dst, r->sx, r->sy, r->dx, r->dy,
+					 r->width, r->height, &ops[i]);
+		if (err < 0)
+			goto out;
+	}
+
+	err = gr2d_blit_ops(gr2d, src, dst, ops, num_rects);
+out:
+	free(ops);
+
+	return err;
 }
 
 static uint32_t sb_offset(struct host1x_pixelbuffer *pixbuf,
@@ -436,17 +577,18 @@ static uint32_t sb_offset(struct host1x_pixelbuffer *pixbuf,
 	return offset;
 }
 
-int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
-			     struct host1x_pixelbuffer *src,
-			     struct host1x_pixelbuffer *dst,
-			     unsigned int sx, unsigned int sy,
-			     unsigned int src_width, int src_height,
-			     unsigned int dx, unsigned int dy,
-			     unsigned int dst_width, int dst_height)
+static int gr2d_surface_blit_emit(struct host1x_gr2d *gr2d,
+				  struct host1x_pushbuf *pb,
+				  struct host1x_pixelbuffer *src,
+				  unsigned long src_offset,
+				  struct host1x_pixelbuffer *dst,
+				  unsigned long dst_offset,
+				  unsigned int sx, unsigned int sy,
+				  unsigned int src_width, int src_height,
+				  unsigned int dx, unsigned int dy,
+				  unsigned int dst_width, int dst_height)
 {
 	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
-	struct host1x_pushbuf *pb;
-	struct host1x_job *job;
 	float inv_scale_x;
 	float inv_scale_y;
 	unsigned src_tiled = 0;
@@ -458,8 +600,6 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	unsigned vftype;
 	unsigned hfen = 1;
 	unsigned vfen = 1;
-	uint32_t fence;
-	int err;
 
 	switch (src->layout) {
 	case PIX_BUF_LAYOUT_TILED_16x16:
@@ -577,16 +717,6 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	src_height = MAX(src_height, 0);
 	dst_height = MAX(dst_height, 0);
 
-	job = HOST1X_JOB_CREATE(syncpt->id, 1);
-	if (!job)
-		return -ENOMEM;
-
-	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
-	if (!pb) {
-		host1x_job_free(job);
-		return -ENOMEM;
-	}
-
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_SETCL(0, 0x52, 0));
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x009, 0xF09));
@@ -629,22 +759,30 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	 * [ 0: 0] tile mode Y/RGB (0: linear, 1: tiled)
 	 */
 	host1x_pushbuf_push(pb, dst_tiled << 20 | src_tiled); /* tilemode */
-	HOST1X_PUSHBUF_RELOCATE(pb, src->bo,
-				src->bo->offset + sb_offset(src, sx, sy), 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, src->bo,
+				       src->bo->offset + src_offset +
+				       sb_offset(src, sx, sy), 0,
+				       HOST1X_BO_ACCESS_READ);
 	host1x_pushbuf_push(pb, 0xdeadbeef); /* srcba_sb_surfbase */
-	HOST1X_PUSHBUF_RELOCATE(pb, dst->bo,
-				dst->bo->offset + sb_offset(dst, dx, dy) +
-				yflip * dst->pitch * dst_height, 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, dst->bo,
+				       dst->bo->offset + dst_offset +
+				       sb_offset(dst, dx, dy) +
+				       yflip * dst->pitch * dst_height, 0,
+				       HOST1X_BO_ACCESS_WRITE);
 	host1x_pushbuf_push(pb, 0xdeadbeef); /* dstba_sb_surfbase */
 
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_MASK(0x02b, 0x3149));
-	HOST1X_PUSHBUF_RELOCATE(pb, dst->bo,
-				dst->bo->offset + sb_offset(dst, dx, dy) +
-				yflip * dst->pitch * dst_height, 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, dst->bo,
+				       dst->bo->offset + dst_offset +
+				       sb_offset(dst, dx, dy) +
+				       yflip * dst->pitch * dst_height, 0,
+				       HOST1X_BO_ACCESS_WRITE);
 	host1x_pushbuf_push(pb, 0xdeadbeef); /* dstba */
 	host1x_pushbuf_push(pb, dst->pitch); /* dstst */
-	HOST1X_PUSHBUF_RELOCATE(pb, src->bo,
-				src->bo->offset + sb_offset(src, sx, sy), 0);
+	HOST1X_PUSHBUF_RELOCATE_ACCESS(pb, src->bo,
+				       src->bo->offset + src_offset +
+				       sb_offset(src, sx, sy), 0,
+				       HOST1X_BO_ACCESS_READ);
 	host1x_pushbuf_push(pb, 0xdeadbeef); /* srcba */
 	host1x_pushbuf_push(pb, src->pitch); /* srcst */
 	host1x_pushbuf_push(pb, src_height << 16 | src_width); /* srcsize */
@@ -653,23 +791,156 @@ int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
 	host1x_pushbuf_push(pb, HOST1X_OPCODE_NONINCR(0x000, 1));
 	host1x_pushbuf_push(pb, 0x000001 << 8 | syncpt->id);
 
-	err = HOST1X_CLIENT_SUBMIT(gr2d->client, job);
+	return 0;
+}
+
+int host1x_gr2d_surface_blit(struct host1x_gr2d *gr2d,
+			     struct host1x_pixelbuffer *src,
+			     struct host1x_pixelbuffer *dst,
+			     unsigned int sx, unsigned int sy,
+			     unsigned int src_width, int src_height,
+			     unsigned int dx, unsigned int dy,
+			     unsigned int dst_width, int dst_height)
+{
+	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	int err;
+
+	job = HOST1X_JOB_CREATE(syncpt->id, 1);
+	if (!job)
+		return -ENOMEM;
+
+	pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
+	if (!pb) {
+		host1x_job_free(job);
+		return -ENOMEM;
+	}
+
+	err = gr2d_surface_blit_emit(gr2d, pb, src, 0, dst, 0,
+				     sx, sy, src_width, src_height,
+				     dx, dy, dst_width, dst_height);
 	if (err < 0) {
 		host1x_job_free(job);
 		return err;
 	}
 
-	host1x_job_free(job);
-
-	err = HOST1X_CLIENT_FLUSH(gr2d->client, &fence);
+	err = gr2d_submit_and_wait(gr2d, job);
 	if (err < 0)
 		return err;
 
-	err = HOST1X_CLIENT_WAIT(gr2d->client, fence, ~0u);
-	if (err < 0)
-		return err;
+	host1x_pixelbuffer_check_guard(dst);
+
+	return 0;
+}
+
+/*
+ * Unscaled surface blits of several rectangles, converting between RGBA
+ * and BGRA like host1x_gr2d_surface_blit(). A negative rectangle height
+ * flips it vertically into the destination.
+ */
+int host1x_gr2d_surface_blit_rects(struct host1x_gr2d *gr2d,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *dst,
+				   const struct host1x_gr2d_blit_rect *rects,
+				   unsigned num_rects)
+{
+	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	const struct host1x_gr2d_blit_rect *r;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned i, j, n;
+	int err;
+
+	for (i = 0; i < num_rects; i += n) {
+		n = MIN(num_rects - i, GR2D_SURFACE_BATCH_OPS);
+
+		job = HOST1X_JOB_CREATE(syncpt->id, n);
+		if (!job)
+			return -ENOMEM;
+
+		pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
+		if (!pb) {
+			host1x_job_free(job);
+			return -ENOMEM;
+		}
+
+		for (j = i; j < i + n; j++) {
+			r = &rects[j];
+
+			err = gr2d_surface_blit_emit(gr2d, pb, src, 0, dst, 0,
+						     r->sx, r->sy, r->width,
+						     abs(r->height), r->dx,
+						     r->dy, r->width,
+						     r->height);
+			if (err < 0) {
+				host1x_job_free(job);
+				return err;
+			}
+		}
+
+		err = gr2d_submit_and_wait(gr2d, job);
+		if (err < 0)
+			return err;
+	}
 
 	host1x_pixelbuffer_check_guard(dst);
 
 	return 0;
 }
+
+/*
+ * Downscales src into levels[0] and then every level into the next one.
+ * Each level is read from the one written before it, hence every level
+ * is a job of its own that has completed before the next one starts. The
+ * levels may share a BO, offsets[] locates each of them relative to its
+ * BO's offset.
+ */
+int host1x_gr2d_surface_blit_chain(struct host1x_gr2d *gr2d,
+				   struct host1x_pixelbuffer *src,
+				   struct host1x_pixelbuffer *levels,
+				   const unsigned long *offsets,
+				   unsigned num_levels)
+{
+	struct host1x_syncpt *syncpt = &gr2d->client->syncpts[0];
+	struct host1x_pixelbuffer *from = src;
+	unsigned long from_offset = 0;
+	struct host1x_pushbuf *pb;
+	struct host1x_job *job;
+	unsigned i;
+	int err;
+
+	for (i = 0; i < num_levels; i++) {
+		job = HOST1X_JOB_CREATE(syncpt->id, 1);
+		if (!job)
+			return -ENOMEM;
+
+		pb = HOST1X_JOB_APPEND(job, gr2d->commands, 0);
+		if (!pb) {
+			host1x_job_free(job);
+			return -ENOMEM;
+		}
+
+		err = gr2d_surface_blit_emit(gr2d, pb, from, from_offset,
+					     &levels[i], offsets[i],
+					     0, 0, from->width, from->height,
+					     0, 0, levels[i].width,
+					     levels[i].height);
+		if (err < 0) {
+			host1x_job_free(job);
+			return err;
+		}
+
+		err = gr2d_submit_and_wait(gr2d, job);
+		if (err < 0)
+			return err;
+
+		from = &levels[i];
+		from_offset = offsets[i];
+	}
+
+	if (num_levels)
+		host1x_pixelbuffer_check_guard(levels);
+
+	return 0;
+}
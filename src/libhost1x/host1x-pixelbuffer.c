@@ -25,6 +25,7 @@
 
 #define PIXBUF_GUARD_PATTERN	0xF5132803
 
+#include <errno.h>
 #include <string.h>
 #include "host1x-private.h"
 
@@ -83,10 +84,238 @@ struct host1x_pixelbuffer *host1x_pixelbuffer_create(
 
 void host1x_pixelbuffer_free(struct host1x_pixelbuffer *pixbuf)
 {
+	if (!pixbuf)
+		return;
+
 	host1x_bo_free(pixbuf->bo);
 	free(pixbuf);
 }
 
+/*
+ * 16x16 tiles are 16 bytes wide and 16 rows high, stored row-major one
+ * after another. For compressed formats a row is a row of blocks.
+ */
+static inline unsigned long tile_offset(unsigned pitch, unsigned xb,
+					unsigned y)
+{
+	return (y / 16) * 16 * pitch + (xb / 16) * 256 + (y % 16) * 16 +
+	       xb % 16;
+}
+
+void host1x_pixelbuffer_tile_16x16(void *dst, unsigned dst_pitch,
+				   const void *src, unsigned src_pitch,
+				   unsigned row_bytes, unsigned rows)
+{
+	unsigned x, y;
+
+	for (y = 0; y < rows; y++) {
+		const uint8_t *row = src + y * src_pitch;
+
+		for (x = 0; x < row_bytes; x += 16)
+			memcpy(dst + tile_offset(dst_pitch, x, y), row + x,
+			       MIN(row_bytes - x, 16));
+	}
+}
+
+void host1x_pixelbuffer_untile_16x16(void *dst, unsigned dst_pitch,
+				     const void *src, unsigned src_pitch,
+				     unsigned row_bytes, unsigned rows)
+{
+	unsigned x, y;
+
+	for (y = 0; y < rows; y++) {
+		uint8_t *row = dst + y * dst_pitch;
+
+		for (x = 0; x < row_bytes; x += 16)
+			memcpy(row + x, src + tile_offset(src_pitch, x, y),
+			       MIN(row_bytes - x, 16));
+	}
+}
+
+/*
+ * Linear data is tiled or re-pitched on the CPU while copying it into
+ * the BO. GR2D can't blit compressed formats and a CPU copy is cheaper
+ * than a temporary pixbuf plus a blit job for the rest.
+ */
+static int host1x_pixelbuffer_copy_linear(struct host1x_pixelbuffer *pixbuf,
+					  const void *data,
+					  unsigned data_pitch)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(pixbuf->format);
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+	unsigned row_bytes = ALIGN(pixbuf->width, tw) / tw *
+			     PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	unsigned rows = ALIGN(pixbuf->height, th) / th;
+	unsigned long size;
+	void *map;
+	unsigned y;
+	int err;
+
+	row_bytes = MIN(row_bytes, data_pitch);
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &map);
+	if (err)
+		return err;
+
+	map += pixbuf->bo->offset;
+
+	if (pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16) {
+		host1x_pixelbuffer_tile_16x16(map, pixbuf->pitch, data,
+					      data_pitch, row_bytes, rows);
+		size = pixbuf->pitch * ALIGN(rows, 16);
+	} else {
+		for (y = 0; y < rows; y++)
+			memcpy(map + y * pixbuf->pitch,
+			       data + y * data_pitch, row_bytes);
+		size = pixbuf->pitch * rows;
+	}
+
+	return HOST1X_BO_FLUSH(pixbuf->bo, pixbuf->bo->offset, size);
+}
+
+/*
+ * Every flush is a cache maintenance syscall with nvhost. Ranges are
+ * rounded to whole cache lines and neighbouring ones are merged if the
+ * gap between them is cheaper to flush than issuing another call.
+ */
+#define FLUSH_CACHE_LINE	32
+#define FLUSH_MERGE_GAP		4096
+
+struct flush_range {
+	unsigned long start;
+	unsigned long end;
+};
+
+static int flush_range_commit(struct host1x_bo *bo, struct flush_range *r)
+{
+	int err = 0;
+
+	if (r->end > r->start)
+		err = HOST1X_BO_FLUSH(bo, r->start, r->end - r->start);
+
+	r->start = r->end = 0;
+
+	return err;
+}
+
+/* ranges have to be added in ascending order */
+static int flush_range_add(struct host1x_bo *bo, struct flush_range *r,
+			   unsigned long start, unsigned long end)
+{
+	int err = 0;
+
+	start &= ~(FLUSH_CACHE_LINE - 1ul);
+	end = ALIGN(end, FLUSH_CACHE_LINE);
+
+	if (r->end > r->start && start <= r->end + FLUSH_MERGE_GAP) {
+		r->end = MAX(r->end, end);
+		return 0;
+	}
+
+	err = flush_range_commit(bo, r);
+
+	r->start = start;
+	r->end = end;
+
+	return err;
+}
+
+/*
+ * Copies a rectangle of linear client data into the pixbuf. Rows are in
+ * memory order as for host1x_pixelbuffer_load_data(), rectangles within
+ * compressed pixbufs have to be aligned to whole blocks. Only the cache
+ * lines touched by the update are flushed.
+ */
+int host1x_pixelbuffer_update_rect(struct host1x_pixelbuffer *pixbuf,
+				   unsigned x, unsigned y,
+				   unsigned width, unsigned height,
+				   const void *data, unsigned data_pitch)
+{
+	unsigned tw = PIX_BUF_FORMAT_TEXEL_WIDTH(pixbuf->format);
+	unsigned th = PIX_BUF_FORMAT_TEXEL_HEIGHT(pixbuf->format);
+	unsigned bpp = PIX_BUF_FORMAT_BYTES(pixbuf->format);
+	unsigned long base = pixbuf->bo->offset;
+	struct flush_range range = { 0 };
+	unsigned row_bytes, rows, xb, yb;
+	unsigned i, n, band;
+	void *map;
+	int err;
+
+	if (!width || !height ||
+	    x >= pixbuf->width || width > pixbuf->width - x ||
+	    y >= pixbuf->height || height > pixbuf->height - y) {
+		host1x_error("invalid rect %ux%u+%u+%u for %ux%u pixbuf\n",
+			     width, height, x, y, pixbuf->width,
+			     pixbuf->height);
+		return -EINVAL;
+	}
+
+	if (x % tw || y % th ||
+	    (width % tw && x + width != pixbuf->width) ||
+	    (height % th && y + height != pixbuf->height)) {
+		host1x_error("rect %ux%u+%u+%u isn't block aligned\n",
+			     width, height, x, y);
+		return -EINVAL;
+	}
+
+	xb = x / tw * bpp;
+	yb = y / th;
+	row_bytes = ALIGN(width, tw) / tw * bpp;
+	rows = ALIGN(height, th) / th;
+
+	if (data_pitch < row_bytes)
+		return -EINVAL;
+
+	err = HOST1X_BO_MMAP(pixbuf->bo, &map);
+	if (err)
+		return err;
+
+	map += base;
+
+	if (pixbuf->layout != PIX_BUF_LAYOUT_TILED_16x16) {
+		for (i = 0; i < rows; i++) {
+			unsigned long offset = (yb + i) * pixbuf->pitch + xb;
+
+			memcpy(map + offset, data + i * data_pitch, row_bytes);
+
+			err = flush_range_add(pixbuf->bo, &range,
+					      base + offset,
+					      base + offset + row_bytes);
+			if (err)
+				return err;
+		}
+
+		return flush_range_commit(pixbuf->bo, &range);
+	}
+
+	for (i = 0; i < rows; i++) {
+		const uint8_t *row = data + i * data_pitch;
+
+		for (n = 0; n < row_bytes; ) {
+			unsigned chunk = MIN(16 - (xb + n) % 16, row_bytes - n);
+
+			memcpy(map + tile_offset(pixbuf->pitch, xb + n, yb + i),
+			       row + n, chunk);
+			n += chunk;
+		}
+	}
+
+	/* the touched tiles of a band of 16 rows are contiguous */
+	for (band = yb / 16; band <= (yb + rows - 1) / 16; band++) {
+		unsigned long start = band * 16 * pixbuf->pitch +
+				      xb / 16 * 256;
+		unsigned long end = band * 16 * pixbuf->pitch +
+				    ALIGN(xb + row_bytes, 16) / 16 * 256;
+
+		err = flush_range_add(pixbuf->bo, &range,
+				      base + start, base + end);
+		if (err)
+			return err;
+	}
+
+	return flush_range_commit(pixbuf->bo, &range);
+}
+
 int host1x_pixelbuffer_load_data(struct host1x *host1x,
 				 struct host1x_pixelbuffer *pixbuf,
 				 void *data,
@@ -122,6 +351,14 @@ int host1x_pixelbuffer_load_data(struct host1x *host1x,
 		blit = true;
 	}
 
+	if (blit && data_layout == PIX_BUF_LAYOUT_LINEAR &&
+	    (pixbuf->layout == PIX_BUF_LAYOUT_TILED_16x16 ||
+	     PIX_BUF_FORMAT_COMPRESSED(data_format))) {
+		host1x_info("using CPU load\n");
+		return host1x_pixelbuffer_copy_linear(pixbuf, data,
+						      data_pitch);
+	}
+
 	if (blit) {
 		host1x_info("using 2-pass blit-load\n");
 
@@ -43,7 +43,20 @@ struct host1x_syncpt {
 	uint32_t value;
 };
 
+/* a BO is used by GR2D and GR3D at most */
+#define HOST1X_BO_MAX_FENCES	2
+
+/* sequence numbers of the last jobs of a client accessing a BO */
+struct host1x_bo_fence {
+	struct host1x_client *client;
+	uint64_t read_seq;
+	uint64_t write_seq;
+};
+
 struct host1x_bo_priv {
+	struct host1x_bo_fence fences[HOST1X_BO_MAX_FENCES];
+	unsigned long cpu_access;
+
 	int (*mmap)(struct host1x_bo *bo);
 	int (*invalidate)(struct host1x_bo *bo, unsigned long offset,
 			  size_t length);
@@ -65,10 +78,15 @@ struct host1x_display {
 	void *priv;
 	bool needs_explicit_vsync;
 
+	/* damage hint for the next set(), in framebuffer coordinates */
+	const struct host1x_gr2d_rect *damage;
+	unsigned int num_damage;
+
 	int (*create_overlay)(struct host1x_display *display,
 			      struct host1x_overlay **overlayp);
 	int (*set)(struct host1x_display *display,
 		   struct host1x_framebuffer *fb, bool vsync, bool reflect_y);
+	int (*wait)(struct host1x_display *display);
 };
 
 struct host1x_overlay {
@@ -79,10 +97,22 @@ struct host1x_overlay {
 		   bool vsync, bool reflect_y);
 };
 
+#define HOST1X_CLIENT_FLUSH_HISTORY	16
+
+/* fence returned by a flush, covering all jobs up to seq */
+struct host1x_client_flush {
+	uint64_t seq;
+	uint32_t fence;
+};
+
 struct host1x_client {
 	struct host1x_syncpt *syncpts;
 	unsigned int num_syncpts;
 
+	uint64_t submit_seq;
+	struct host1x_client_flush flushes[HOST1X_CLIENT_FLUSH_HISTORY];
+	unsigned int num_flushes;
+
 	int (*submit)(struct host1x_client *client, struct host1x_job *job);
 	int (*flush)(struct host1x_client *client, uint32_t *fence);
 	int (*wait)(struct host1x_client *client, uint32_t fence,
@@ -106,7 +106,38 @@ int host1x_display_set(struct host1x_display *display,
 		       struct host1x_framebuffer *fb,
 		       bool vsync, bool reflect_y)
 {
-	return display->set(display, fb, vsync, reflect_y);
+	int err;
+
+	err = display->set(display, fb, vsync, reflect_y);
+
+	display->damage = NULL;
+	display->num_damage = 0;
+
+	return err;
+}
+
+/*
+ * Restrict the next host1x_display_set() to the given framebuffer regions.
+ * Backends are free to ignore the hint and present the whole framebuffer.
+ */
+void host1x_display_set_damage(struct host1x_display *display,
+			       const struct host1x_gr2d_rect *rects,
+			       unsigned int count)
+{
+	display->damage = count ? rects : NULL;
+	display->num_damage = rects ? count : 0;
+}
+
+/*
+ * Waits for a flip queued by host1x_display_set() to complete, after which
+ * the previously shown framebuffer may be rendered to again.
+ */
+int host1x_display_wait(struct host1x_display *display)
+{
+	if (display->wait)
+		return display->wait(display);
+
+	return 0;
 }
 
 int host1x_overlay_create(struct host1x_overlay **overlayp,
@@ -241,6 +272,9 @@ struct host1x_bo *host1x_bo_wrap(struct host1x_bo *bo,
 	wrap = bo->priv->clone(bo);
 	if (wrap) {
 		memcpy(priv, bo->priv, sizeof(*priv));
+		/* fences are tracked by the original BO */
+		memset(priv->fences, 0, sizeof(priv->fences));
+		priv->cpu_access = 0;
 		wrap->offset += (bo->wrapped ? bo->size : 0) + offset;
 		wrap->wrapped = orig;
 		wrap->size = size;
@@ -323,8 +357,10 @@ int host1x_pushbuf_push(struct host1x_pushbuf *pb, uint32_t word)
 	return 0;
 }
 
-int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
-			    unsigned long offset, unsigned long shift)
+int host1x_pushbuf_relocate_access(struct host1x_pushbuf *pb,
+				   struct host1x_bo *target,
+				   unsigned long offset, unsigned long shift,
+				   unsigned long access)
 {
 	struct host1x_pushbuf_reloc *reloc;
 	size_t size;
@@ -344,18 +380,200 @@ int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
 	reloc->target_handle = target->handle;
 	reloc->target_offset = offset;
 	reloc->shift = shift;
+	reloc->access = access;
+
+	return 0;
+}
+
+/* the GPU may read and write anything it isn't told otherwise about */
+int host1x_pushbuf_relocate(struct host1x_pushbuf *pb, struct host1x_bo *target,
+			    unsigned long offset, unsigned long shift)
+{
+	return host1x_pushbuf_relocate_access(pb, target, offset, shift,
+					      HOST1X_BO_ACCESS_RW);
+}
+
+/*
+ * Fences are only known once a client is flushed, so jobs are numbered
+ * on submission and BOs remember the numbers of the last jobs reading
+ * and writing them. Each flush maps the numbers submitted so far to the
+ * fence it returned.
+ */
+static int host1x_client_wait_seq(struct host1x_client *client,
+				  uint64_t seq, uint32_t timeout)
+{
+	struct host1x_client_flush *flush = NULL;
+	uint32_t fence;
+	unsigned int i;
+	int err;
+
+	if (!client->num_flushes ||
+	    client->flushes[(client->num_flushes - 1) %
+			    HOST1X_CLIENT_FLUSH_HISTORY].seq < seq) {
+		err = host1x_client_flush(client, &fence);
+		if (err < 0)
+			return err;
+	}
+
+	/* the oldest flush covering seq, or the oldest one remembered */
+	for (i = client->num_flushes; i > 0; i--) {
+		struct host1x_client_flush *f;
+
+		if (client->num_flushes - i == HOST1X_CLIENT_FLUSH_HISTORY)
+			break;
+
+		f = &client->flushes[(i - 1) % HOST1X_CLIENT_FLUSH_HISTORY];
+		if (f->seq < seq)
+			break;
+
+		flush = f;
+	}
+
+	if (!flush)
+		return 0;
+
+	return client->wait(client, flush->fence, timeout);
+}
+
+static int host1x_bo_fence_wait(struct host1x_bo_fence *f,
+				unsigned long access, uint32_t timeout)
+{
+	uint64_t seq = f->write_seq;
+	int err;
+
+	if (access & HOST1X_BO_ACCESS_WRITE)
+		seq = MAX(seq, f->read_seq);
+
+	if (!f->client || !seq)
+		return 0;
+
+	err = host1x_client_wait_seq(f->client, seq, timeout);
+	if (err < 0)
+		return err;
+
+	if (f->write_seq <= seq)
+		f->write_seq = 0;
+
+	if (f->read_seq <= seq)
+		f->read_seq = 0;
+
+	if (!f->read_seq && !f->write_seq)
+		f->client = NULL;
 
 	return 0;
 }
 
+/*
+ * Makes sure the BO has a fence slot for the client, which may have to
+ * wait for the oldest other client. Done before the job is submitted, so
+ * that recording the submission can't fail.
+ */
+static int host1x_bo_reserve_fence(struct host1x_bo *bo,
+				   struct host1x_client *client)
+{
+	struct host1x_bo_priv *priv = (bo->wrapped ?: bo)->priv;
+	struct host1x_bo_fence *f = NULL;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < HOST1X_BO_MAX_FENCES; i++) {
+		if (priv->fences[i].client == client)
+			return 0;
+
+		if (!f && !priv->fences[i].client)
+			f = &priv->fences[i];
+	}
+
+	if (!f) {
+		/* out of slots, retire the oldest client */
+		f = &priv->fences[0];
+
+		err = host1x_bo_fence_wait(f, HOST1X_BO_ACCESS_RW, ~0u);
+		if (err < 0)
+			return err;
+
+		f->read_seq = 0;
+		f->write_seq = 0;
+	}
+
+	f->client = client;
+
+	return 0;
+}
+
+static void host1x_bo_track(struct host1x_bo *bo, struct host1x_client *client,
+			    uint64_t seq, unsigned long access)
+{
+	struct host1x_bo_priv *priv = (bo->wrapped ?: bo)->priv;
+	struct host1x_bo_fence *f;
+	unsigned int i;
+
+	for (i = 0; i < HOST1X_BO_MAX_FENCES; i++) {
+		f = &priv->fences[i];
+
+		if (f->client != client)
+			continue;
+
+		if (access & HOST1X_BO_ACCESS_READ)
+			f->read_seq = seq;
+
+		if (access & HOST1X_BO_ACCESS_WRITE)
+			f->write_seq = seq;
+
+		break;
+	}
+}
+
 int host1x_client_submit(struct host1x_client *client, struct host1x_job *job)
 {
-	return client->submit(client, job);
+	struct host1x_pushbuf *pb;
+	unsigned int i, j;
+	int err;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		pb = &job->pushbufs[i];
+
+		for (j = 0; j < pb->num_relocs; j++) {
+			err = host1x_bo_reserve_fence(pb->relocs[j].target_bo,
+						      client);
+			if (err < 0)
+				return err;
+		}
+	}
+
+	err = client->submit(client, job);
+	if (err < 0)
+		return err;
+
+	client->submit_seq++;
+
+	for (i = 0; i < job->num_pushbufs; i++) {
+		pb = &job->pushbufs[i];
+
+		for (j = 0; j < pb->num_relocs; j++)
+			host1x_bo_track(pb->relocs[j].target_bo, client,
+					client->submit_seq,
+					pb->relocs[j].access);
+	}
+
+	return 0;
 }
 
 int host1x_client_flush(struct host1x_client *client, uint32_t *fence)
 {
-	return client->flush(client, fence);
+	struct host1x_client_flush *flush;
+	int err;
+
+	err = client->flush(client, fence);
+	if (err < 0)
+		return err;
+
+	flush = &client->flushes[client->num_flushes++ %
+				 HOST1X_CLIENT_FLUSH_HISTORY];
+	flush->seq = client->submit_seq;
+	flush->fence = *fence;
+
+	return 0;
 }
 
 int host1x_client_wait(struct host1x_client *client, uint32_t fence,
@@ -363,3 +581,45 @@ int host1x_client_wait(struct host1x_client *client, uint32_t fence,
 {
 	return client->wait(client, fence, timeout);
 }
+
+/*
+ * Waits for the GPU jobs conflicting with a CPU access: readers wait for
+ * the last writers, writers for everyone. The CPU caches are invalidated
+ * for reading, host1x_bo_cpu_fini() flushes them after writing. Returns
+ * -ETIMEDOUT (or whatever the backend reports) if the jobs don't finish
+ * within timeout.
+ */
+int host1x_bo_cpu_prep(struct host1x_bo *bo, unsigned long access,
+		       uint32_t timeout)
+{
+	struct host1x_bo_priv *priv = (bo->wrapped ?: bo)->priv;
+	unsigned long offset = bo->wrapped ? bo->offset : 0;
+	unsigned int i;
+	int err;
+
+	for (i = 0; i < HOST1X_BO_MAX_FENCES; i++) {
+		err = host1x_bo_fence_wait(&priv->fences[i], access, timeout);
+		if (err < 0)
+			return err;
+	}
+
+	bo->priv->cpu_access = access;
+
+	if (access & HOST1X_BO_ACCESS_READ)
+		return host1x_bo_invalidate(bo, offset, bo->size);
+
+	return 0;
+}
+
+int host1x_bo_cpu_fini(struct host1x_bo *bo)
+{
+	unsigned long offset = bo->wrapped ? bo->offset : 0;
+	unsigned long access = bo->priv->cpu_access;
+
+	bo->priv->cpu_access = 0;
+
+	if (access & HOST1X_BO_ACCESS_WRITE)
+		return host1x_bo_flush(bo, offset, bo->size);
+
+	return 0;
+}
@@ -29,6 +29,12 @@
 #ifdef HAVE_XCB
 
 #include <errno.h>
+#include <string.h>
+
+#ifdef HAVE_XCB_SHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif
 
 #define WIN_WIDTH	720
 #define WIN_HEIGHT	576
@@ -87,17 +93,250 @@ static void *fbdata(struct xcb_stuff *stuff, struct host1x_framebuffer *fb)
 	return mmap_fb(stuff->pixbuf);
 }
 
+#ifdef HAVE_XCB_SHM
+/*
+ * GEM/nvmap BOs can't back a SysV segment, so the staging pixbuf is
+ * copied into one that the X server reads directly instead of pushing
+ * every pixel through the socket. Remote or SHM-less servers keep using
+ * plain PutImage.
+ */
+static void x11_shm_init(struct xcb_stuff *stuff)
+{
+	xcb_shm_query_version_reply_t *version;
+	xcb_void_cookie_t cookie;
+	xcb_generic_error_t *error;
+	int id;
+
+	version = xcb_shm_query_version_reply(stuff->disp,
+				xcb_shm_query_version(stuff->disp), NULL);
+	if (!version) {
+		host1x_info("MIT-SHM unsupported, using PutImage\n");
+		return;
+	}
+
+	free(version);
+
+	id = shmget(IPC_PRIVATE, WIN_WIDTH * WIN_HEIGHT * 4, IPC_CREAT | 0600);
+	if (id < 0) {
+		host1x_info("shmget() failed: %m, using PutImage\n");
+		return;
+	}
+
+	stuff->shm_addr = shmat(id, NULL, 0);
+	if (stuff->shm_addr == (void *)-1) {
+		host1x_info("shmat() failed: %m, using PutImage\n");
+		stuff->shm_addr = NULL;
+		shmctl(id, IPC_RMID, NULL);
+		return;
+	}
+
+	stuff->shm_seg = xcb_generate_id(stuff->disp);
+	cookie = xcb_shm_attach_checked(stuff->disp, stuff->shm_seg, id, 0);
+	error = xcb_request_check(stuff->disp, cookie);
+
+	/* the segment goes away once both sides have detached */
+	shmctl(id, IPC_RMID, NULL);
+
+	if (error) {
+		host1x_info("xcb_shm_attach() failed, using PutImage\n");
+		shmdt(stuff->shm_addr);
+		stuff->shm_addr = NULL;
+		free(error);
+	}
+}
+
+/* don't overwrite the segment while the server may still be reading it */
+static void x11_shm_wait(struct xcb_stuff *stuff)
+{
+	if (stuff->shm_busy) {
+		free(xcb_get_input_focus_reply(stuff->disp,
+				xcb_get_input_focus(stuff->disp), NULL));
+		stuff->shm_busy = false;
+	}
+}
+
+/* map is the staging pixbuf's data, laid out with its pitch */
+static bool x11_shm_put(struct xcb_stuff *stuff, const uint8_t *map,
+			unsigned int src_pitch,
+			unsigned int x, unsigned int y,
+			unsigned int width, unsigned int height)
+{
+	unsigned int pitch = WIN_WIDTH * 4;
+	unsigned int i;
+
+	if (!stuff->shm_addr)
+		return false;
+
+	x11_shm_wait(stuff);
+
+	if (width == WIN_WIDTH && src_pitch == pitch) {
+		memcpy(stuff->shm_addr + y * pitch, map + y * pitch,
+		       height * pitch);
+	} else {
+		for (i = y; i < y + height; i++)
+			memcpy(stuff->shm_addr + i * pitch + x * 4,
+			       map + i * src_pitch + x * 4, width * 4);
+	}
+
+	xcb_shm_put_image(stuff->disp, stuff->win, stuff->gc,
+			  WIN_WIDTH, WIN_HEIGHT, x, y, width, height, x, y,
+			  24, XCB_IMAGE_FORMAT_Z_PIXMAP, 0, stuff->shm_seg, 0);
+
+	return true;
+}
+
+/* deferred until all rectangles of a frame have been copied */
+static void x11_shm_done(struct xcb_stuff *stuff)
+{
+	if (stuff->shm_addr)
+		stuff->shm_busy = true;
+}
+#else
+static inline void x11_shm_init(struct xcb_stuff *stuff)
+{
+}
+
+static inline bool x11_shm_put(struct xcb_stuff *stuff, const uint8_t *map,
+			       unsigned int src_pitch,
+			       unsigned int x, unsigned int y,
+			       unsigned int width, unsigned int height)
+{
+	return false;
+}
+
+static inline void x11_shm_done(struct xcb_stuff *stuff)
+{
+}
+#endif
+
+static bool damage_usable(struct xcb_stuff *stuff,
+			  struct host1x_display *displayp,
+			  struct host1x_framebuffer *fb)
+{
+	struct host1x_pixelbuffer *pixbuf = fb->pixbuf;
+	unsigned int i;
+
+	/* the window copy must already hold the previous frame, 1:1 */
+	if (!stuff->pixbuf || !displayp->num_damage ||
+	    pixbuf->width != WIN_WIDTH || pixbuf->height != WIN_HEIGHT)
+		return false;
+
+	for (i = 0; i < displayp->num_damage; i++) {
+		const struct host1x_gr2d_rect *r = &displayp->damage[i];
+
+		if (!r->width || !r->height ||
+		    r->x + r->width > WIN_WIDTH ||
+		    r->y + r->height > WIN_HEIGHT)
+			return false;
+	}
+
+	return true;
+}
+
+static int x11_display_set_damaged(struct xcb_stuff *stuff,
+				   struct host1x_display *displayp,
+				   struct host1x_framebuffer *fb)
+{
+	struct host1x_gr2d_blit_rect blits[displayp->num_damage];
+	struct host1x_bo *bo = stuff->pixbuf->bo;
+	unsigned int pitch = stuff->pixbuf->pitch;
+	unsigned int min_y = WIN_HEIGHT, max_y = 0;
+	unsigned int i, y;
+	uint8_t *rows = NULL;
+	void *map;
+	int err;
+
+	for (i = 0; i < displayp->num_damage; i++) {
+		const struct host1x_gr2d_rect *r = &displayp->damage[i];
+
+		blits[i].sx = r->x;
+		blits[i].sy = r->y;
+		blits[i].dx = r->x;
+		blits[i].dy = WIN_HEIGHT - r->y - r->height;
+		blits[i].width = r->width;
+		blits[i].height = -(int)r->height;
+
+		if (blits[i].dy < min_y)
+			min_y = blits[i].dy;
+		if (blits[i].dy + r->height > max_y)
+			max_y = blits[i].dy + r->height;
+	}
+
+	/* converts to BGRA like the full-frame path */
+	err = host1x_gr2d_surface_blit_rects(stuff->host1x->gr2d, fb->pixbuf,
+					     stuff->pixbuf, blits,
+					     displayp->num_damage);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_MMAP(bo, &map);
+	if (err < 0)
+		return err;
+
+	err = HOST1X_BO_INVALIDATE(bo, bo->offset + min_y * pitch,
+				   (max_y - min_y) * pitch);
+	if (err < 0)
+		return err;
+
+	map += bo->offset;
+
+	for (i = 0; i < displayp->num_damage; i++) {
+		const struct host1x_gr2d_blit_rect *b = &blits[i];
+		unsigned int height = -b->height;
+		unsigned int stride = b->width * 4;
+		uint8_t *data = map + b->dy * pitch + b->dx * 4;
+
+		if (x11_shm_put(stuff, map, pitch, b->dx, b->dy, b->width,
+				height))
+			continue;
+
+		/* full-width spans are already packed */
+		if (stride != pitch) {
+			if (!rows) {
+				rows = malloc(pitch * (max_y - min_y));
+				if (!rows)
+					return -ENOMEM;
+			}
+
+			for (y = 0; y < height; y++)
+				memcpy(rows + y * stride, data + y * pitch,
+				       stride);
+
+			data = rows;
+		}
+
+		xcb_put_image(stuff->disp, XCB_IMAGE_FORMAT_Z_PIXMAP,
+			      stuff->win, stuff->gc, b->width, height,
+			      b->dx, b->dy, 0, 24, stride * height, data);
+	}
+
+	x11_shm_done(stuff);
+	xcb_flush(stuff->disp);
+	free(rows);
+
+	return 0;
+}
+
 static int x11_display_set(struct host1x_display *displayp,
 			   struct host1x_framebuffer *fb,
 			   bool vsync, bool reflect_y)
 {
 	struct xcb_stuff *stuff = displayp->priv;
 
+	if (damage_usable(stuff, displayp, fb))
+		return x11_display_set_damaged(stuff, displayp, fb);
+
 	stuff->img->data = fbdata(stuff, fb);
 	if (!stuff->img->data)
 		return -1;
 
-	xcb_image_put(stuff->disp, stuff->win, stuff->gc, stuff->img, 0, 0, 0);
+	if (x11_shm_put(stuff, stuff->img->data, stuff->pixbuf->pitch,
+			0, 0, WIN_WIDTH, WIN_HEIGHT))
+		x11_shm_done(stuff);
+	else
+		xcb_image_put(stuff->disp, stuff->win, stuff->gc, stuff->img,
+			      0, 0, 0);
+
 	xcb_flush(stuff->disp);
 
 	return 0;
@@ -168,6 +407,8 @@ int x11_display_create(struct host1x *host1x, struct host1x_display *base,
 	stuff->gc = xcb_generate_id(stuff->disp);
 	xcb_create_gc(stuff->disp, stuff->gc, stuff->win, 0, NULL);
 
+	x11_shm_init(stuff);
+
 	base->width = WIN_WIDTH;
 	base->height = WIN_HEIGHT;
 	base->create_overlay = x11_overlay_create;
@@ -31,6 +31,10 @@
 #include <xcb/xcb_icccm.h>
 #include <xcb/xcb_image.h>
 
+#ifdef HAVE_XCB_SHM
+#include <xcb/shm.h>
+#endif
+
 struct xcb_stuff {
 	struct host1x_pixelbuffer *pixbuf;
 	struct host1x *host1x;
@@ -39,6 +43,12 @@ struct xcb_stuff {
 	xcb_window_t win;
 	xcb_image_t *img;
 	int drm_fd;
+
+#ifdef HAVE_XCB_SHM
+	xcb_shm_seg_t shm_seg;
+	void *shm_addr;
+	bool shm_busy;
+#endif
 };
 
 void dri2_display_create(struct xcb_stuff *stuff, struct host1x_display *disp);
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grate.h"
+#include "grate-3d.h"
+
+/*
+ * Checks that the bulk fragment uniform setter converts to fp20 and fx10
+ * bit for bit like the per-location setter, for random bit patterns and
+ * the special values, through the vector bodies and the scalar tails.
+ * fx10 is only defined while value * 256 fits into an int32, finite lowp
+ * values are reduced into that range.
+ */
+
+#define ITERATIONS	20000
+
+static const uint32_t specials[] = {
+	0x00000000, 0x80000000, 0x7f800000, 0xff800000,
+	0x7fc00000, 0xffc00000, 0x7f800001, 0x00000001,
+	0x807fffff, 0x3f800000, 0xbf800000, 0x3f7fffff,
+	0x3f000000, 0x40000000, 0xc0000000, 0x7f7fffff,
+};
+
+static float random_float(void)
+{
+	union { uint32_t u; float f; } v;
+
+	if (rand() % 4 == 0)
+		v.u = specials[rand() % ARRAY_SIZE(specials)];
+	else
+		v.u = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+
+	return v.f;
+}
+
+static int check(struct grate_3d_ctx *ctx, bool lowp, unsigned nb,
+		 float *values)
+{
+	unsigned regs = lowp ? (nb + 1) / 2 : nb;
+	unsigned flags = lowp ? 0x8000 : 0;
+	uint32_t expected[32];
+	unsigned i, n;
+
+	if (lowp) {
+		for (i = 0; i < nb; i++)
+			if (isfinite(values[i]))
+				values[i] = fmodf(values[i], 8388608.0f);
+	}
+
+	memset(ctx->fs_uniforms, 0, regs * sizeof(uint32_t));
+
+	for (i = 0; i < nb; i += n) {
+		n = MIN(nb - i, 4);
+
+		if (grate_3d_ctx_set_fragment_uniform(ctx,
+				(lowp ? i : i * 2) | flags |
+				((1 << n) - 1) << 8, n, &values[i]))
+			return -1;
+	}
+
+	memcpy(expected, ctx->fs_uniforms, regs * sizeof(uint32_t));
+	memset(ctx->fs_uniforms, 0, regs * sizeof(uint32_t));
+
+	if (grate_3d_ctx_set_fragment_uniform_block(ctx, flags, nb, values))
+		return -1;
+
+	for (i = 0; i < regs; i++) {
+		if (ctx->fs_uniforms[i] != expected[i]) {
+			fprintf(stderr, "%s register %u: 0x%08x, expected "
+				"0x%08x\n", lowp ? "lowp" : "highp", i,
+				ctx->fs_uniforms[i], expected[i]);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	struct grate_shader *vs, *fs, *linker;
+	struct grate_program *program;
+	struct grate_options options;
+	struct grate_3d_ctx *ctx;
+	struct grate *grate;
+	float values[32];
+	unsigned i, j, nb;
+
+	grate_init_data_path(argv[0]);
+
+	if (!grate_parse_command_line(&options, argc, argv))
+		return 1;
+
+	grate = grate_init(&options);
+	if (!grate)
+		return 1;
+
+	vs = grate_shader_parse_vertex_asm_from_file(
+				"tests/grate/asm/texture_wrap_vs.txt");
+	fs = grate_shader_parse_fragment_asm_from_file(
+				"tests/grate/asm/texture_wrap_fs.txt");
+	linker = grate_shader_parse_linker_asm_from_file(
+				"tests/grate/asm/texture_wrap_linker.txt");
+	if (!vs || !fs || !linker) {
+		fprintf(stderr, "texture_wrap assembler parse failed\n");
+		return 1;
+	}
+
+	program = grate_program_new(grate, vs, fs, linker);
+	if (!program) {
+		fprintf(stderr, "grate_program_new() failed\n");
+		return 1;
+	}
+
+	grate_program_link(program);
+
+	ctx = grate_3d_alloc_ctx(grate);
+	if (!ctx)
+		return 1;
+
+	if (!grate_3d_ctx_set_fragment_uniform_block(ctx, 0, 1, values)) {
+		fprintf(stderr, "uniforms were set without a program\n");
+		return 1;
+	}
+
+	grate_3d_ctx_bind_program(ctx, program);
+
+	for (i = 0; i < ITERATIONS; i++) {
+		nb = 1 + i % 32;
+
+		for (j = 0; j < nb; j++)
+			values[j] = random_float();
+
+		if (check(ctx, false, nb, values) ||
+		    check(ctx, true, nb, values)) {
+			fprintf(stderr, "iteration %u failed\n", i);
+			return 1;
+		}
+	}
+
+	printf("%u bulk conversions match\n", ITERATIONS * 2);
+
+	grate_3d_free_ctx(ctx);
+	grate_exit(grate);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2026 The grate authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Counts vertex shader invocations of a triangulated grid with shuffled
+ * triangle order before and after index optimisation, using a FIFO model
+ * of the post-transform vertex cache.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "grate.h"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, const uint16_t *indices,
+		   unsigned num_indices, unsigned num_vertices,
+		   unsigned num_triangles, unsigned cache_size)
+{
+	unsigned transforms;
+
+	transforms = grate_indices_count_transforms(indices, num_indices,
+						    cache_size);
+
+	printf("%-10s %7u indices %7u VS invocations, ACMR %.3f ATVR %.3f\n",
+	       name, num_indices, transforms,
+	       (double)transforms / num_triangles,
+	       (double)transforms / num_vertices);
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned size = argc > 1 ? strtoul(argv[1], NULL, 10) : 100;
+	unsigned cache_size = argc > 2 ? strtoul(argv[2], NULL, 10) : 16;
+	unsigned num_vertices = (size + 1) * (size + 1);
+	unsigned num_triangles = size * size * 2;
+	unsigned num_indices = num_triangles * 3;
+	uint16_t *indices, *strip;
+	unsigned x, y, i;
+	double start;
+	int err;
+
+	if (size == 0 || num_vertices > 65536) {
+		fprintf(stderr, "usage: %s [grid size <= 255] [cache size]\n",
+			argv[0]);
+		return 1;
+	}
+
+	indices = malloc(num_indices * sizeof(*indices));
+	if (!indices)
+		return 1;
+
+	for (y = 0, i = 0; y < size; y++) {
+		for (x = 0; x < size; x++) {
+			uint16_t v = y * (size + 1) + x;
+
+			indices[i++] = v;
+			indices[i++] = v + size + 1;
+			indices[i++] = v + 1;
+			indices[i++] = v + 1;
+			indices[i++] = v + size + 1;
+			indices[i++] = v + size + 2;
+		}
+	}
+
+	report("grid", indices, num_indices, num_vertices, num_triangles,
+	       cache_size);
+
+	srand(1);
+
+	for (i = num_triangles - 1; i > 0; i--) {
+		unsigned j = rand() % (i + 1);
+		uint16_t tmp[3];
+
+		for (x = 0; x < 3; x++) {
+			tmp[x] = indices[i * 3 + x];
+			indices[i * 3 + x] = indices[j * 3 + x];
+			indices[j * 3 + x] = tmp[x];
+		}
+	}
+
+	report("shuffled", indices, num_indices, num_vertices, num_triangles,
+	       cache_size);
+
+	start = now();
+	err = grate_optimize_indices(indices, num_indices, num_vertices);
+	if (err) {
+		fprintf(stderr, "optimisation failed: %d\n", err);
+		return 1;
+	}
+
+	report("optimized", indices, num_indices, num_vertices,
+	       num_triangles, cache_size);
+	printf("optimisation took %.3f ms\n", (now() - start) * 1000.0);
+
+	start = now();
+	err = grate_indices_to_strip(indices, num_indices, &strip);
+	if (err < 0) {
+		fprintf(stderr, "stripification failed: %d\n", err);
+		return 1;
+	}
+
+	report("strip", strip, err, num_vertices, num_triangles, cache_size);
+	printf("stripification took %.3f ms\n", (now() - start) * 1000.0);
+
+	free(strip);
+	free(indices);
+
+	return 0;
+}